@@ -305,3 +305,66 @@ int omap_get_dma_active_status(int lch)
 	return 0;
 }
 EXPORT_SYMBOL(omap_get_dma_active_status);
+
+/**
+ * omap_enable_dma_irq - raise a completion interrupt for a slot
+ * @lch: channel whose parameter RAM slot is being configured
+ * @bits: sDMA interrupt bits; only OMAP_DMA_BLOCK_IRQ has an equivalent
+ *
+ * The completion code is that of @lch, so its callback is called when
+ * the transfer in the slot completes, also when the slot has been
+ * reloaded into another channel through a link.
+ */
+void omap_enable_dma_irq(int lch, u16 bits)
+{
+	struct edmacc_param p_ram;
+
+	if (!(bits & OMAP_DMA_BLOCK_IRQ))
+		return;
+
+	edma_read_slot(lch, &p_ram);
+	p_ram.opt &= ~EDMA_TCC(0x3f);
+	p_ram.opt |= TCINTEN | EDMA_TCC(EDMA_CHAN_SLOT(lch));
+	edma_write_slot(lch, &p_ram);
+}
+EXPORT_SYMBOL(omap_enable_dma_irq);
+
+void omap_disable_dma_irq(int lch, u16 bits)
+{
+	struct edmacc_param p_ram;
+
+	if (!(bits & OMAP_DMA_BLOCK_IRQ))
+		return;
+
+	edma_read_slot(lch, &p_ram);
+	p_ram.opt &= ~TCINTEN;
+	edma_write_slot(lch, &p_ram);
+}
+EXPORT_SYMBOL(omap_disable_dma_irq);
+
+/**
+ * omap_dma_link_lch - link two parameter RAM slots
+ * @lch_head: channel whose transfer is followed by that of @lch_queue
+ * @lch_queue: channel whose parameter RAM slot is linked to
+ *
+ * Unlike sDMA links, which start @lch_queue, an EDMA link reloads the
+ * slot of @lch_queue into @lch_head once its transfer completes, so the
+ * transfer continues on @lch_head and its hardware event. @lch_queue need
+ * not be mapped to any event.
+ */
+void omap_dma_link_lch(int lch_head, int lch_queue)
+{
+	edma_link((unsigned)lch_head, (unsigned)lch_queue);
+}
+EXPORT_SYMBOL(omap_dma_link_lch);
+
+/**
+ * omap_dma_unlink_lch - cut the link of a parameter RAM slot
+ * @lch_head: channel whose slot was linked with omap_dma_link_lch()
+ * @lch_queue: not used
+ */
+void omap_dma_unlink_lch(int lch_head, int lch_queue)
+{
+	edma_unlink((unsigned)lch_head);
+}
+EXPORT_SYMBOL(omap_dma_unlink_lch);
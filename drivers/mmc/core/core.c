@@ -200,6 +200,60 @@ static void mmc_wait_done(struct mmc_request *mrq)
 	complete(mrq->done_data);
 }
 
+/**
+ *	mmc_pre_req - prepare a request before it is started
+ *	@host: MMC host the request will be started on
+ *	@mrq: MMC request to prepare
+ *	@is_first_req: true if no other request is running on the host
+ *
+ *	Give the host driver a chance to map the data of @mrq for DMA
+ *	while the previous request is still being transferred. Every
+ *	request prepared this way must be passed to mmc_post_req() once
+ *	it has completed or when it will not be started after all.
+ */
+void mmc_pre_req(struct mmc_host *host, struct mmc_request *mrq,
+		 bool is_first_req)
+{
+	if (host->ops->pre_req)
+		host->ops->pre_req(host, mrq, is_first_req);
+}
+EXPORT_SYMBOL(mmc_pre_req);
+
+/**
+ *	mmc_post_req - release what mmc_pre_req() set up
+ *	@host: MMC host the request ran on
+ *	@mrq: completed MMC request
+ *	@err: non-zero if the request was never started
+ */
+void mmc_post_req(struct mmc_host *host, struct mmc_request *mrq, int err)
+{
+	if (host->ops->post_req)
+		host->ops->post_req(host, mrq, err);
+}
+EXPORT_SYMBOL(mmc_post_req);
+
+/**
+ *	mmc_start_req - start a request without waiting for it
+ *	@host: MMC host to start command
+ *	@mrq: MMC request to start
+ *	@done: completion signalled when the request has finished
+ *
+ *	Start a new MMC request and return at once, so that the caller
+ *	can prepare the next request meanwhile. The caller must wait for
+ *	@done before looking at the result or starting another request.
+ */
+void mmc_start_req(struct mmc_host *host, struct mmc_request *mrq,
+		   struct completion *done)
+{
+	init_completion(done);
+
+	mrq->done_data = done;
+	mrq->done = mmc_wait_done;
+
+	mmc_start_request(host, mrq);
+}
+EXPORT_SYMBOL(mmc_start_req);
+
 /**
  *	mmc_wait_for_req - start a request and wait for completion
  *	@host: MMC host to start command
@@ -213,10 +267,7 @@ void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
 {
 	DECLARE_COMPLETION_ONSTACK(complete);
 
-	mrq->done_data = &complete;
-	mrq->done = mmc_wait_done;
-
-	mmc_start_request(host, mrq);
+	mmc_start_req(host, mrq, &complete);
 
 	wait_for_completion(&complete);
 }
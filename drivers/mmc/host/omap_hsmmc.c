@@ -133,6 +133,22 @@
 #define OMAP_MMC_SLEEP_TIMEOUT		1000
 #define OMAP_MMC_OFF_TIMEOUT		8000
 
+/*
+ * Up to OMAP_HSMMC_DMA_LINKS logical DMA channels are linked so that as
+ * many sg entries are transferred with a single completion interrupt;
+ * longer lists run in batches of that many.
+ */
+#define OMAP_HSMMC_DMA_LINKS		8
+#define OMAP_HSMMC_MAX_SEGS		64
+
+/* Asks the TI81xx sdma2edma layer for any free channel */
+#define OMAP_HSMMC_ANY_DMA_CH		(-1)
+
+/* Channel status bits that end a DMA transfer early */
+#define OMAP_HSMMC_DMA_ERR_IRQS		(OMAP2_DMA_TRANS_ERR_IRQ | \
+					 OMAP2_DMA_SECURE_ERR_IRQ | \
+					 OMAP2_DMA_SUPERVISOR_ERR_IRQ)
+
 /*
  * One controller can have multiple slots, like on some omap boards using
  * omap.c controller driver. Luckily this is not currently done on any known
@@ -149,6 +165,15 @@
 #define OMAP_HSMMC_WRITE(base, reg, val) \
 	__raw_writel((val), (base) + OMAP_HSMMC_##reg)
 
+/*
+ * Data mapped by omap_hsmmc_pre_req() ahead of its request. The request
+ * carries the cookie in data->host_cookie.
+ */
+struct omap_hsmmc_next {
+	unsigned int	dma_len;
+	s32		cookie;
+};
+
 struct omap_hsmmc_host {
 	struct	device		*dev;
 	struct	mmc_host	*mmc;
@@ -174,6 +199,9 @@ struct omap_hsmmc_host {
 	unsigned int		id;
 	unsigned int		dma_len;
 	unsigned int		dma_sg_idx;
+	int			dma_link[OMAP_HSMMC_DMA_LINKS]; /* [0] is dma_ch */
+	unsigned int		dma_nr_links;	/* channels allocated */
+	unsigned int		dma_batch;	/* sg entries in flight */
 	unsigned char		bus_mode;
 	unsigned char		power_mode;
 	u32			*buffer;
@@ -192,6 +220,7 @@ struct omap_hsmmc_host {
 	int			reqs_blocked;
 	int			use_reg;
 	int			req_in_progress;
+	struct omap_hsmmc_next	next_data;
 
 	struct	omap_mmc_platform_data	*pdata;
 };
@@ -992,6 +1021,12 @@ omap_hsmmc_cmd_done(struct omap_hsmmc_host *host, struct mmc_command *cmd)
 		omap_hsmmc_request_done(host, cmd->mrq);
 }
 
+static void omap_hsmmc_free_dma_links(struct omap_hsmmc_host *host)
+{
+	while (host->dma_nr_links)
+		omap_free_dma(host->dma_link[--host->dma_nr_links]);
+}
+
 /*
  * DMA clean up for command errors
  */
@@ -1007,9 +1042,11 @@ static void omap_hsmmc_dma_cleanup(struct omap_hsmmc_host *host, int errno)
 	spin_unlock(&host->irq_lock);
 
 	if (host->use_dma && dma_ch != -1) {
-		dma_unmap_sg(mmc_dev(host->mmc), host->data->sg, host->dma_len,
-			omap_hsmmc_get_dma_dir(host, host->data));
-		omap_free_dma(dma_ch);
+		if (!host->data->host_cookie)
+			dma_unmap_sg(mmc_dev(host->mmc), host->data->sg,
+				host->data->sg_len,
+				omap_hsmmc_get_dma_dir(host, host->data));
+		omap_hsmmc_free_dma_links(host);
 	}
 	host->data = NULL;
 }
@@ -1338,14 +1375,13 @@ static int omap_hsmmc_get_dma_sync_dev(struct omap_hsmmc_host *host,
 }
 
 static void omap_hsmmc_config_dma_params(struct omap_hsmmc_host *host,
-				       struct mmc_data *data,
+				       struct mmc_data *data, int dma_ch,
 				       struct scatterlist *sgl)
 {
-	int blksz, nblk, dma_ch;
+	int blksz, nblk;
 	int bindex = 0, cindex = 0;
 
-	dma_ch = host->dma_ch;
-	blksz = host->data->blksz;
+	blksz = data->blksz;
 	nblk = sg_dma_len(sgl) / blksz;
 	if (cpu_is_ti81xx()) {
 		bindex = 4;
@@ -1368,8 +1404,42 @@ static void omap_hsmmc_config_dma_params(struct omap_hsmmc_host *host,
 			blksz / 4, nblk, OMAP_DMA_SYNC_FRAME,
 			omap_hsmmc_get_dma_sync_dev(host, data),
 			!(data->flags & MMC_DATA_WRITE));
+}
 
-	omap_start_dma(dma_ch);
+/*
+ * Program one channel per sg entry, starting at dma_sg_idx, link them and
+ * start the first. The controller walks the links by itself and only the
+ * last channel of the batch raises an interrupt.
+ */
+static void omap_hsmmc_start_dma_batch(struct omap_hsmmc_host *host,
+				       struct mmc_data *data)
+{
+	struct scatterlist *sgl = data->sg + host->dma_sg_idx;
+	unsigned int i, n;
+
+	/* Undo the links of the previous batch, which may have been longer */
+	if (host->dma_batch > 1) {
+		omap_stop_dma(host->dma_ch);
+		for (i = 0; i + 1 < host->dma_batch; i++)
+			omap_dma_unlink_lch(host->dma_link[i],
+					    host->dma_link[i + 1]);
+	}
+
+	n = min(host->dma_len - host->dma_sg_idx, host->dma_nr_links);
+	for (i = 0; i < n; i++) {
+		int dma_ch = host->dma_link[i];
+
+		omap_hsmmc_config_dma_params(host, data, dma_ch, sgl + i);
+		if (i + 1 < n) {
+			omap_disable_dma_irq(dma_ch, OMAP_DMA_BLOCK_IRQ);
+			omap_dma_link_lch(dma_ch, host->dma_link[i + 1]);
+		} else {
+			omap_enable_dma_irq(dma_ch, OMAP_DMA_BLOCK_IRQ);
+		}
+	}
+	host->dma_batch = n;
+
+	omap_start_dma(host->dma_ch);
 }
 
 /*
@@ -1379,7 +1449,7 @@ static void omap_hsmmc_dma_cb(int lch, u16 ch_status, void *cb_data)
 {
 	struct omap_hsmmc_host *host = cb_data;
 	struct mmc_data *data = host->mrq->data;
-	int dma_ch, req_in_progress;
+	int req_in_progress;
 
 	if (ch_status & OMAP2_DMA_MISALIGNED_ERR_IRQ)
 		dev_dbg(mmc_dev(host->mmc), "MISALIGNED_ADRS_ERR\n");
@@ -1390,25 +1460,40 @@ static void omap_hsmmc_dma_cb(int lch, u16 ch_status, void *cb_data)
 		return;
 	}
 
-	host->dma_sg_idx++;
-	if (host->dma_sg_idx < host->dma_len) {
-		/* Fire up the next transfer. */
-		omap_hsmmc_config_dma_params(host, data,
-					   data->sg + host->dma_sg_idx);
+	if (ch_status & OMAP_HSMMC_DMA_ERR_IRQS) {
+		/*
+		 * Any channel of the chain can fail, not only the last one.
+		 * Stop the whole chain and fail the data; the controller
+		 * ends the transfer with an error of its own.
+		 */
+		dev_err(mmc_dev(host->mmc), "DMA error 0x%x on channel %d\n",
+			ch_status, lch);
+		omap_stop_dma(host->dma_ch);
+		data->error = -EIO;
+	} else if (lch != host->dma_link[host->dma_batch - 1]) {
+		/* Only the last channel of a batch reports its completion */
 		spin_unlock(&host->irq_lock);
 		return;
+	} else {
+		host->dma_sg_idx += host->dma_batch;
+		if (host->dma_sg_idx < host->dma_len) {
+			/* Fire up the next batch. */
+			omap_hsmmc_start_dma_batch(host, data);
+			spin_unlock(&host->irq_lock);
+			return;
+		}
 	}
 
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg, host->dma_len,
-		omap_hsmmc_get_dma_dir(host, data));
+	/* Prepared data is unmapped by omap_hsmmc_post_req() */
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			omap_hsmmc_get_dma_dir(host, data));
 
 	req_in_progress = host->req_in_progress;
-	dma_ch = host->dma_ch;
+	omap_hsmmc_free_dma_links(host);
 	host->dma_ch = -1;
 	spin_unlock(&host->irq_lock);
 
-	omap_free_dma(dma_ch);
-
 	/* If DMA has finished after TC, complete the request */
 	if (!req_in_progress) {
 		struct mmc_request *mrq = host->mrq;
@@ -1418,13 +1503,55 @@ static void omap_hsmmc_dma_cb(int lch, u16 ch_status, void *cb_data)
 	}
 }
 
+/*
+ * Map the data of a request for DMA, or pick up the mapping made by
+ * omap_hsmmc_pre_req(). With 'next' set, the mapping is made ahead of
+ * the request and recorded there instead.
+ */
+static int omap_hsmmc_pre_dma_transfer(struct omap_hsmmc_host *host,
+				       struct mmc_data *data,
+				       struct omap_hsmmc_next *next)
+{
+	int dma_len;
+
+	if (!next && data->host_cookie &&
+	    data->host_cookie != host->next_data.cookie) {
+		dev_warn(mmc_dev(host->mmc), "invalid cookie %d, expected %d\n",
+			 data->host_cookie, host->next_data.cookie);
+		data->host_cookie = 0;
+	}
+
+	if (next || !data->host_cookie) {
+		dma_len = dma_map_sg(mmc_dev(host->mmc), data->sg,
+				     data->sg_len,
+				     omap_hsmmc_get_dma_dir(host, data));
+	} else {
+		dma_len = host->next_data.dma_len;
+		host->next_data.dma_len = 0;
+	}
+
+	if (dma_len == 0)
+		return -EINVAL;
+
+	if (next) {
+		next->dma_len = dma_len;
+		if (++next->cookie < 0)
+			next->cookie = 1;
+		data->host_cookie = next->cookie;
+	} else {
+		host->dma_len = dma_len;
+	}
+
+	return 0;
+}
+
 /*
  * Routine to configure and start DMA for the MMC card
  */
 static int omap_hsmmc_start_dma_transfer(struct omap_hsmmc_host *host,
 					struct mmc_request *req)
 {
-	int dma_ch = 0, ret = 0, i;
+	int dma_ch = 0, link_dev, ret = 0, i;
 	struct mmc_data *data = req->data;
 
 	/* Sanity check: all the SG entries must be aligned by block size. */
@@ -1452,12 +1579,35 @@ static int omap_hsmmc_start_dma_transfer(struct omap_hsmmc_host *host,
 		return ret;
 	}
 
-	host->dma_len = dma_map_sg(mmc_dev(host->mmc), data->sg,
-			data->sg_len, omap_hsmmc_get_dma_dir(host, data));
-	host->dma_ch = dma_ch;
+	host->dma_link[0] = dma_ch;
+	host->dma_nr_links = 1;
+
+	ret = omap_hsmmc_pre_dma_transfer(host, data, NULL);
+	if (ret != 0) {
+		omap_hsmmc_free_dma_links(host);
+		return ret;
+	}
+
+	/*
+	 * Channels to link to are only nice to have: with fewer of them the
+	 * list just runs in more batches. On TI81xx they only lend their
+	 * PaRAM slots to the first channel, so any free channel will do.
+	 */
+	link_dev = cpu_is_ti81xx() ? OMAP_HSMMC_ANY_DMA_CH :
+		   omap_hsmmc_get_dma_sync_dev(host, data);
+	while (host->dma_nr_links < min_t(unsigned int, host->dma_len,
+					  OMAP_HSMMC_DMA_LINKS)) {
+		if (omap_request_dma(link_dev, "MMC/SD", omap_hsmmc_dma_cb,
+				     host, &dma_ch))
+			break;
+		host->dma_link[host->dma_nr_links++] = dma_ch;
+	}
+
+	host->dma_ch = host->dma_link[0];
 	host->dma_sg_idx = 0;
+	host->dma_batch = 0;
 
-	omap_hsmmc_config_dma_params(host, data, data->sg);
+	omap_hsmmc_start_dma_batch(host, data);
 
 	return 0;
 }
@@ -1978,9 +2128,43 @@ static int omap_hsmmc_disable_fclk(struct mmc_host *mmc, int lazy)
 	return 0;
 }
 
+/*
+ * Map the data of the next request while the current one is transferred,
+ * so that starting it only takes programming the DMA channel.
+ */
+static void omap_hsmmc_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			       bool is_first_req)
+{
+	struct omap_hsmmc_host *host = mmc_priv(mmc);
+
+	if (!mrq->data)
+		return;
+
+	if (host->use_dma &&
+	    omap_hsmmc_pre_dma_transfer(host, mrq->data, &host->next_data))
+		mrq->data->host_cookie = 0;
+}
+
+static void omap_hsmmc_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+				int err)
+{
+	struct omap_hsmmc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	if (host->use_dma)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			     omap_hsmmc_get_dma_dir(host, data));
+	data->host_cookie = 0;
+}
+
 static const struct mmc_host_ops omap_hsmmc_ops = {
 	.enable = omap_hsmmc_enable_fclk,
 	.disable = omap_hsmmc_disable_fclk,
+	.pre_req = omap_hsmmc_pre_req,
+	.post_req = omap_hsmmc_post_req,
 	.request = omap_hsmmc_request,
 	.set_ios = omap_hsmmc_set_ios,
 	.get_cd = omap_hsmmc_get_cd,
@@ -1992,6 +2176,8 @@ static const struct mmc_host_ops omap_hsmmc_ops = {
 static const struct mmc_host_ops omap_hsmmc_ps_ops = {
 	.enable = omap_hsmmc_enable,
 	.disable = omap_hsmmc_disable,
+	.pre_req = omap_hsmmc_pre_req,
+	.post_req = omap_hsmmc_post_req,
 	.request = omap_hsmmc_request,
 	.set_ios = omap_hsmmc_set_ios,
 	.get_cd = omap_hsmmc_get_cd,
@@ -2203,9 +2389,8 @@ static int __init omap_hsmmc_probe(struct platform_device *pdev)
 							" clk failed\n");
 	}
 
-	/* Since we do only SG emulation, we can have as many segs
-	 * as we want. */
-	mmc->max_segs = 1;
+	/* Linked DMA channels take the scatterlist without a bounce buffer */
+	mmc->max_segs = OMAP_HSMMC_MAX_SEGS;
 
 	mmc->max_blk_size = 512;       /* Block Length at max can be 1024 */
 	mmc->max_blk_count = 0xFFFF;    /* No. of Blocks is 16 bits */
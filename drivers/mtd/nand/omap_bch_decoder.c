@@ -22,33 +22,37 @@
 #define nn		8191	/* Length of codeword, n = 2**mm - 1 */
 
 #define PPP	0x201B	/* Primary Polynomial : x^13 + x^4 + x^3 + x + 1 */
-#define P	0x001B	/* With omitted x^13 */
-#define POLY	12	/* degree of the primary Polynomial less one */
+
+/* Log/antilog tables for GF(2^13), filled in by omap_bch_decoder_init() */
+static u16 gf_exp[nn] __read_mostly;		/* alpha^i, i = 0..nn-1 */
+static u16 gf_log[nn + 1] __read_mostly;	/* log_alpha(x), x = 1..nn */
 
 /**
  * mpy_mod_gf - GALOIS field multiplier
  * Input  : A(x), B(x)
  * Output : A(x)*B(x) mod P(x)
  */
-static unsigned int mpy_mod_gf(unsigned int a, unsigned int b)
+static inline unsigned int mpy_mod_gf(unsigned int a, unsigned int b)
 {
-	unsigned int R = 0;
-	unsigned int R1 = 0;
-	unsigned int k = 0;
-
-	for (k = 0; k < mm; k++) {
+	unsigned int i;
 
-		R = (R << 1) & 0x1FFE;
-		if (R1 == 1)
-			R ^= P;
+	if (a == 0 || b == 0)
+		return 0;
 
-		if (((a >> (POLY - k)) & 1) == 1)
-			R ^= b;
+	i = gf_log[a] + gf_log[b];
+	if (i >= nn)
+		i -= nn;
+	return gf_exp[i];
+}
 
-		if (k < POLY)
-			R1 = (R >> POLY) & 1;
-	}
-	return R;
+/**
+ * inv_gf - GALOIS field inverse
+ * Input  : A(x), non zero
+ * Output : A(x)^-1 mod P(x)
+ */
+static inline unsigned int inv_gf(unsigned int a)
+{
+	return gf_exp[gf_log[a] ? nn - gf_log[a] : 0];
 }
 
 /**
@@ -61,55 +65,65 @@ static unsigned int mpy_mod_gf(unsigned int a, unsigned int b)
  *	     Size of input codeword
  * Outputs : Up to 8 locations
  *	     No. of errors
+ *
+ * ELP(z) is evaluated at alpha^-(i-1) for increasing i. Each coefficient
+ * err[j] is kept in the log domain and stepped by -(j+1) per position, so
+ * an evaluation costs one table lookup per coefficient. Two consecutive
+ * positions are accumulated side by side in the two halves of one 32-bit
+ * word and tested together. Positions below 2 * ecc_bits are never
+ * reported, so the search starts there.
  */
 static int chien(unsigned int select_4_8, int err_nums,
 				unsigned int err[], unsigned int *location)
 {
-	int i, count; /* Number of dectected errors */
-	/* Contains accumulation of evaluation at x^i (i:1->8) */
-	unsigned int gammas[8] = {0};
-	unsigned int alpha;
-	unsigned int bit, ecc_bits;
-	unsigned int elp_sum;
+	int i, j, count; /* Number of dectected errors */
+	/* log(err[j]) - (j+1) * (i-1), for the non zero coefficients */
+	unsigned int logs[8], steps[8];
+	unsigned int n_coef, start;
+	unsigned int ecc_bits, bit;
+	u32 elp_sum;
 
 	ecc_bits = (select_4_8 == 0) ? 52 : 104;
-
-	/* Start evaluation at Alpha**8192 and decreasing */
-	for (i = 0; i < 8; i++)
-		gammas[i] = err[i];
+	start = 2 * ecc_bits;
+
+	n_coef = 0;
+	for (j = 0; j < 8; j++) {
+		if (err[j] == 0)
+			continue;
+		steps[n_coef] = j + 1;
+		logs[n_coef] = (gf_log[err[j]] +
+				(nn - (j + 1)) * (start - 1)) % nn;
+		n_coef++;
+	}
 
 	count = 0;
-	for (i = 1; (i <= nn) && (count < err_nums); i++) {
-
-		/* Result of evaluation at root */
-		elp_sum = 1 ^ gammas[0] ^ gammas[1] ^
-				gammas[2] ^ gammas[3] ^
-				gammas[4] ^ gammas[5] ^
-				gammas[6] ^ gammas[7];
-
-		alpha = PPP >> 1;
-		gammas[0] = mpy_mod_gf(gammas[0], alpha);
-		alpha = mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-2 */
-		gammas[1] = mpy_mod_gf(gammas[1], alpha);
-		alpha = mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-2 */
-		gammas[2] = mpy_mod_gf(gammas[2], alpha);
-		alpha = mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-3 */
-		gammas[3] = mpy_mod_gf(gammas[3], alpha);
-		alpha = mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-4 */
-		gammas[4] = mpy_mod_gf(gammas[4], alpha);
-		alpha = mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-5 */
-		gammas[5] = mpy_mod_gf(gammas[5], alpha);
-		alpha = mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-6 */
-		gammas[6] = mpy_mod_gf(gammas[6], alpha);
-		alpha = mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-7 */
-		gammas[7] = mpy_mod_gf(gammas[7], alpha);
-
-		if (elp_sum == 0) {
+	for (i = start; (i <= nn) && (count < err_nums); i += 2) {
+
+		/* Evaluation at alpha^-(i-1) in the low half,
+		 * at alpha^-i in the high half
+		 */
+		elp_sum = 1 | (1 << 16);
+		for (j = 0; j < n_coef; j++) {
+			elp_sum ^= gf_exp[logs[j]];
+			logs[j] = (logs[j] < steps[j]) ?
+				logs[j] + nn - steps[j] : logs[j] - steps[j];
+			elp_sum ^= (u32)gf_exp[logs[j]] << 16;
+			logs[j] = (logs[j] < steps[j]) ?
+				logs[j] + nn - steps[j] : logs[j] - steps[j];
+		}
+
+		if ((elp_sum & 0xFFFF) == 0) {
 			/* calculate bit position in main data area */
 			bit = ((i-1) & ~7)|(7-((i-1) & 7));
-			if (i >= 2 * ecc_bits)
-				location[count++] =
-					kk_shorten - (bit - 2 * ecc_bits) - 1;
+			location[count++] =
+				kk_shorten - (bit - 2 * ecc_bits) - 1;
+		}
+
+		if ((elp_sum >> 16) == 0 && (i + 1 <= nn) &&
+				(count < err_nums)) {
+			bit = (i & ~7)|(7-(i & 7));
+			location[count++] =
+				kk_shorten - (bit - 2 * ecc_bits) - 1;
 		}
 	}
 
@@ -144,13 +158,6 @@ static unsigned int berlekamp(unsigned int select_4_8,
 	/* Temporary value that holds an ELP[n](z) coefficient */
 	unsigned int next_gamma = 0;
 
-	int e = 0;
-	unsigned int sign = 0;
-	unsigned int u = 0;
-	unsigned int v = 0;
-	unsigned int C1 = 0, C2 = 0;
-	unsigned int ss = 0;
-	unsigned int tmp_v = 0, tmp_s = 0;
 	unsigned int tmp_poly;
 
 	/*-------------- Step 0 ------------------*/
@@ -176,36 +183,7 @@ static unsigned int berlekamp(unsigned int select_4_8,
 		}
 
 		/* Step 1: 1 cycle only to perform inversion */
-		v = d << 1;
-		e = -1;
-		sign = 1;
-		ss = 0x2000;
-		invd = 0;
-		u = PPP;
-		for (loop = 0; (d != 0) && (loop <= (2 * POLY)); loop++) {
-			pr_debug("%02d. s=1 LL=%x poly NULL\n",
-						loop, LL);
-			C1 = (v >> 13) & 1;
-			C2 = C1 & sign;
-
-			sign ^= C2 ^ (e == 0);
-
-			tmp_v = v;
-			tmp_s = ss;
-
-			if (C1 == 1) {
-				v ^= u;
-				ss ^= invd;
-			}
-			v = (v << 1) & 0x3FFF;
-			if (C2 == 1) {
-				u = tmp_v;
-				invd = tmp_s;
-				e = -e;
-			}
-			invd >>= 1;
-			e--;
-		}
+		invd = (d != 0) ? inv_gf(d) : 0;
 
 		for (loop = 0; (d != 0) && (loop <= (iteration + 1)); loop++) {
 			/* Step 2
@@ -285,18 +263,9 @@ static unsigned int berlekamp(unsigned int select_4_8,
 static void syndrome(unsigned int select_4_8,
 					unsigned char *ecc, unsigned int syn[])
 {
-	unsigned int k, l, t;
-	unsigned int alpha_bit, R_bit;
+	unsigned int i, k, t;
 	int ecc_pos, ecc_min;
 
-	/* 2t-1 = 15 (for t=8) minimal polynomials of the first 15 powers of a
-	 * primitive elemmants of GF(m); Even powers minimal polynomials are
-	 * duplicate of odd powers' minimal polynomials.
-	 * Odd powers of alpha (1 to 15)
-	 */
-	unsigned int pow_alpha[8] = {0x0002, 0x0008, 0x0020, 0x0080,
-				 0x0200, 0x0800, 0x001B, 0x006C};
-
 	pr_debug("\n ECC[0..n]: ");
 	for (k = 0; k < 13; k++)
 		pr_debug("0x%x ", ecc[k]);
@@ -312,29 +281,20 @@ static void syndrome(unsigned int select_4_8,
 	}
 
 	/* total numbber of syndrom to be used is 2t */
-	/* Step1: calculate the odd syndrome(s) */
-	R_bit = ((ecc[ecc_pos/8] >> (7 - ecc_pos%8)) & 1);
-	ecc_pos--;
+	/* Step1: calculate the odd syndrome(s)
+	 * The i-th bit read (starting from ecc_pos) is the coefficient of
+	 * x^i, so it adds alpha^((2k+1)*i) to S(alpha^(2k+1)). With at most
+	 * 104 bits the exponent stays below nn.
+	 */
 	for (k = 0; k < t; k++)
-		syn[2 * k] = R_bit;
-
-	while (ecc_pos >= ecc_min) {
-		R_bit = ((ecc[ecc_pos/8] >> (7 - ecc_pos%8)) & 1);
-		ecc_pos--;
-
-		for (k = 0; k < t; k++) {
-			/* Accumulate value of x^i at alpha^(2k+1) */
-			if (R_bit == 1)
-				syn[2*k] ^= pow_alpha[k];
-
-			/* Compute a**(2k+1), using LSFR */
-			for (l = 0; l < (2 * k + 1); l++) {
-				alpha_bit = (pow_alpha[k] >> POLY) & 1;
-				pow_alpha[k] = (pow_alpha[k] << 1) & 0x1FFF;
-				if (alpha_bit == 1)
-					pow_alpha[k] ^= P;
-			}
-		}
+		syn[2 * k] = 0;
+
+	for (i = 0; ecc_pos >= ecc_min; ecc_pos--, i++) {
+		if (((ecc[ecc_pos/8] >> (7 - ecc_pos%8)) & 1) == 0)
+			continue;
+
+		for (k = 0; k < t; k++)
+			syn[2*k] ^= gf_exp[(2 * k + 1) * i];
 	}
 
 	/* Step2: calculate the even syndrome(s)
@@ -391,3 +351,30 @@ int decode_bch(int select_4_8, unsigned char *ecc, unsigned int *err_loc)
 }
 EXPORT_SYMBOL(decode_bch);
 
+
+static int __init omap_bch_decoder_init(void)
+{
+	unsigned int i, x = 1;
+
+	/* alpha = x is primitive for PPP: walk its powers once */
+	for (i = 0; i < nn; i++) {
+		gf_exp[i] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x & (1 << mm))
+			x ^= PPP;
+	}
+
+	return 0;
+}
+
+static void __exit omap_bch_decoder_exit(void)
+{
+}
+
+/* Tables must be ready before omap2.c probes and reads the first page */
+subsys_initcall(omap_bch_decoder_init);
+module_exit(omap_bch_decoder_exit);
+
+MODULE_DESCRIPTION("OMAP BCH ECC decoder");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2011 Texas Instruments
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Check the table driven OMAP BCH decoder (drivers/mtd/nand/omap_bch_decoder.c)
+ * against the original bit-serial implementation, kept here as reference,
+ * on random error patterns.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/random.h>
+#include <linux/string.h>
+#include <linux/jiffies.h>
+
+#define PRINT_PREF KERN_INFO "mtd_bchtest: "
+
+static int count = 1000;
+module_param(count, int, S_IRUGO);
+MODULE_PARM_DESC(count, "Number of random error patterns per mode");
+
+#if defined(CONFIG_MTD_NAND_OMAP2) || defined(CONFIG_MTD_NAND_OMAP2_MODULE)
+
+int decode_bch(int select_4_8, unsigned char *ecc, unsigned int *err_loc);
+
+#define mm		13
+#define kk_shorten	4096
+#define nn		8191	/* Length of codeword, n = 2**mm - 1 */
+
+#define PPP	0x201B	/* Primary Polynomial : x^13 + x^4 + x^3 + x + 1 */
+#define P	0x001B	/* With omitted x^13 */
+#define POLY	12	/* degree of the primary Polynomial less one */
+
+/**
+ * mpy_mod_gf - GALOIS field multiplier
+ * Input  : A(x), B(x)
+ * Output : A(x)*B(x) mod P(x)
+ */
+static unsigned int ref_mpy_mod_gf(unsigned int a, unsigned int b)
+{
+	unsigned int R = 0;
+	unsigned int R1 = 0;
+	unsigned int k = 0;
+
+	for (k = 0; k < mm; k++) {
+
+		R = (R << 1) & 0x1FFE;
+		if (R1 == 1)
+			R ^= P;
+
+		if (((a >> (POLY - k)) & 1) == 1)
+			R ^= b;
+
+		if (k < POLY)
+			R1 = (R >> POLY) & 1;
+	}
+	return R;
+}
+
+/**
+ * chien - CHIEN search
+ *
+ * @location - Error location vector pointer
+ *
+ * Inputs  : ELP(z)
+ *	     No. of found errors
+ *	     Size of input codeword
+ * Outputs : Up to 8 locations
+ *	     No. of errors
+ */
+static int ref_chien(unsigned int select_4_8, int err_nums,
+				unsigned int err[], unsigned int *location)
+{
+	int i, count; /* Number of dectected errors */
+	/* Contains accumulation of evaluation at x^i (i:1->8) */
+	unsigned int gammas[8] = {0};
+	unsigned int alpha;
+	unsigned int bit, ecc_bits;
+	unsigned int elp_sum;
+
+	ecc_bits = (select_4_8 == 0) ? 52 : 104;
+
+	/* Start evaluation at Alpha**8192 and decreasing */
+	for (i = 0; i < 8; i++)
+		gammas[i] = err[i];
+
+	count = 0;
+	for (i = 1; (i <= nn) && (count < err_nums); i++) {
+
+		/* Result of evaluation at root */
+		elp_sum = 1 ^ gammas[0] ^ gammas[1] ^
+				gammas[2] ^ gammas[3] ^
+				gammas[4] ^ gammas[5] ^
+				gammas[6] ^ gammas[7];
+
+		alpha = PPP >> 1;
+		gammas[0] = ref_mpy_mod_gf(gammas[0], alpha);
+		alpha = ref_mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-2 */
+		gammas[1] = ref_mpy_mod_gf(gammas[1], alpha);
+		alpha = ref_mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-2 */
+		gammas[2] = ref_mpy_mod_gf(gammas[2], alpha);
+		alpha = ref_mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-3 */
+		gammas[3] = ref_mpy_mod_gf(gammas[3], alpha);
+		alpha = ref_mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-4 */
+		gammas[4] = ref_mpy_mod_gf(gammas[4], alpha);
+		alpha = ref_mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-5 */
+		gammas[5] = ref_mpy_mod_gf(gammas[5], alpha);
+		alpha = ref_mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-6 */
+		gammas[6] = ref_mpy_mod_gf(gammas[6], alpha);
+		alpha = ref_mpy_mod_gf(alpha, (PPP >> 1));	/* x alphha^-7 */
+		gammas[7] = ref_mpy_mod_gf(gammas[7], alpha);
+
+		if (elp_sum == 0) {
+			/* calculate bit position in main data area */
+			bit = ((i-1) & ~7)|(7-((i-1) & 7));
+			if (i >= 2 * ecc_bits)
+				location[count++] =
+					kk_shorten - (bit - 2 * ecc_bits) - 1;
+		}
+	}
+
+	/* Failure: No. of detected errors != No. or corrected errors */
+	if (count != err_nums)
+		count = -1;
+
+	return count;
+}
+
+/* synd : 16 Syndromes
+ * return: gamaas - Coefficients to the error polynomial
+ * return: : Number of detected errors
+*/
+static unsigned int ref_berlekamp(unsigned int select_4_8,
+			unsigned int synd[], unsigned int err[])
+{
+	int loop, iteration;
+	unsigned int LL = 0;		/* Detected errors */
+	unsigned int d = 0;	/* Distance between Syndromes and ELP[n](z) */
+	unsigned int invd = 0;		/* Inverse of d */
+	/* Intermediate ELP[n](z).
+	 * Final ELP[n](z) is Error Location Polynomial
+	 */
+	unsigned int gammas[16] = {0};
+	/* Intermediate normalized ELP[n](z) : D[n](z) */
+	unsigned int D[16] = {0};
+	/* Temporary value that holds an ELP[n](z) coefficient */
+	unsigned int next_gamma = 0;
+
+	int e = 0;
+	unsigned int sign = 0;
+	unsigned int u = 0;
+	unsigned int v = 0;
+	unsigned int C1 = 0, C2 = 0;
+	unsigned int ss = 0;
+	unsigned int tmp_v = 0, tmp_s = 0;
+	unsigned int tmp_poly;
+
+	/*-------------- Step 0 ------------------*/
+	for (loop = 0; loop < 16; loop++)
+		gammas[loop] = 0;
+	gammas[0] = 1;
+	D[1] = 1;
+
+	iteration = 0;
+	LL = 0;
+	while ((iteration < ((select_4_8+1)*2*4)) &&
+			(LL <= ((select_4_8+1)*4))) {
+
+		d = 0;
+		/* Step: 0 */
+		for (loop = 0; loop <= LL; loop++) {
+			tmp_poly = ref_mpy_mod_gf(
+					gammas[loop], synd[iteration - loop]);
+			d ^= tmp_poly;
+		}
+
+		/* Step 1: 1 cycle only to perform inversion */
+		v = d << 1;
+		e = -1;
+		sign = 1;
+		ss = 0x2000;
+		invd = 0;
+		u = PPP;
+		for (loop = 0; (d != 0) && (loop <= (2 * POLY)); loop++) {
+			C1 = (v >> 13) & 1;
+			C2 = C1 & sign;
+
+			sign ^= C2 ^ (e == 0);
+
+			tmp_v = v;
+			tmp_s = ss;
+
+			if (C1 == 1) {
+				v ^= u;
+				ss ^= invd;
+			}
+			v = (v << 1) & 0x3FFF;
+			if (C2 == 1) {
+				u = tmp_v;
+				invd = tmp_s;
+				e = -e;
+			}
+			invd >>= 1;
+			e--;
+		}
+
+		for (loop = 0; (d != 0) && (loop <= (iteration + 1)); loop++) {
+			/* Step 2
+			 * Interleaved with Step 3, if L<(n-k)
+			 * invd: Update of ELP[n](z) = ELP[n-1](z) - d.D[n-1](z)
+			 */
+
+			/* Holds value of ELP coefficient until precedent
+			 * value does not have to be used anymore
+			 */
+			tmp_poly = ref_mpy_mod_gf(d, D[loop]);
+
+			next_gamma = gammas[loop] ^ tmp_poly;
+			if ((2 * LL) < (iteration + 1)) {
+				/* Interleaving with Step 3
+				 * for parallelized update of ELP(z) and D(z)
+				 */
+			} else {
+				/* Update of ELP(z) only -> stay in Step 2 */
+				gammas[loop] = next_gamma;
+				if (loop == (iteration + 1)) {
+					/* to step 4 */
+					break;
+				}
+			}
+
+			/* Step 3
+			 * Always interleaved with Step 2 (case when L<(n-k))
+			 * Update of D[n-1](z) = ELP[n-1](z)/d
+			 */
+			D[loop] = ref_mpy_mod_gf(gammas[loop], invd);
+
+			/* Can safely update ELP[n](z) */
+			gammas[loop] = next_gamma;
+
+			if (loop == (iteration + 1)) {
+				/* If update finished */
+				LL = iteration - LL + 1;
+				/* to step 4 */
+				break;
+			}
+			/* Else, interleaving to step 2*/
+		}
+
+		/* Step 4: Update D(z): i:0->L */
+		/* Final update of D[n](z) = D[n](z).z*/
+		for (loop = 0; loop < 15; loop++) /* Left Shift */
+			D[15 - loop] = D[14 - loop];
+
+		D[0] = 0;
+
+		iteration++;
+	} /* while */
+
+	/* Processing finished, copy ELP to final registers : 0->2t-1*/
+	for (loop = 0; loop < 8; loop++)
+		err[loop] = gammas[loop+1];
+
+	return LL;
+}
+
+/*
+ * syndrome - Generate syndrome components from hw generate syndrome
+ * r(x) = c(x) + e(x)
+ * s(x) = c(x) mod g(x) + e(x) mod g(x) =  e(x) mod g(x)
+ * so receiver checks if the syndrome s(x) = r(x) mod g(x) is equal to zero.
+ * unsigned int s[16]; - Syndromes
+ */
+static void ref_syndrome(unsigned int select_4_8,
+					unsigned char *ecc, unsigned int syn[])
+{
+	unsigned int k, l, t;
+	unsigned int alpha_bit, R_bit;
+	int ecc_pos, ecc_min;
+
+	/* 2t-1 = 15 (for t=8) minimal polynomials of the first 15 powers of a
+	 * primitive elemmants of GF(m); Even powers minimal polynomials are
+	 * duplicate of odd powers' minimal polynomials.
+	 * Odd powers of alpha (1 to 15)
+	 */
+	unsigned int pow_alpha[8] = {0x0002, 0x0008, 0x0020, 0x0080,
+				 0x0200, 0x0800, 0x001B, 0x006C};
+
+	if (select_4_8 == 0) {
+		t = 4;
+		ecc_pos = 55; /* bits(52-bits): 55->4 */
+		ecc_min = 4;
+	} else {
+		t = 8;
+		ecc_pos = 103; /* bits: 103->0 */
+		ecc_min = 0;
+	}
+
+	/* total numbber of syndrom to be used is 2t */
+	/* Step1: calculate the odd ref_syndrome(s) */
+	R_bit = ((ecc[ecc_pos/8] >> (7 - ecc_pos%8)) & 1);
+	ecc_pos--;
+	for (k = 0; k < t; k++)
+		syn[2 * k] = R_bit;
+
+	while (ecc_pos >= ecc_min) {
+		R_bit = ((ecc[ecc_pos/8] >> (7 - ecc_pos%8)) & 1);
+		ecc_pos--;
+
+		for (k = 0; k < t; k++) {
+			/* Accumulate value of x^i at alpha^(2k+1) */
+			if (R_bit == 1)
+				syn[2*k] ^= pow_alpha[k];
+
+			/* Compute a**(2k+1), using LSFR */
+			for (l = 0; l < (2 * k + 1); l++) {
+				alpha_bit = (pow_alpha[k] >> POLY) & 1;
+				pow_alpha[k] = (pow_alpha[k] << 1) & 0x1FFF;
+				if (alpha_bit == 1)
+					pow_alpha[k] ^= P;
+			}
+		}
+	}
+
+	/* Step2: calculate the even ref_syndrome(s)
+	 * Compute S(a), where a is an even power of alpha
+	 * Evenry even power of primitive element has the same minimal
+	 * polynomial as some odd power of elemets.
+	 * And based on S(a^2) = S^2(a)
+	 */
+	for (k = 0; k < t; k++)
+		syn[2*k+1] = ref_mpy_mod_gf(syn[k], syn[k]);
+}
+
+/* Original decode_bch() */
+static int ref_decode_bch(int select_4_8, unsigned char *ecc,
+				unsigned int *err_loc)
+{
+	int no_of_err;
+	unsigned int syn[16] = {0,};
+	unsigned int err_poly[8] = {0,};
+
+	ref_syndrome(select_4_8, ecc, syn);
+	no_of_err = ref_berlekamp(select_4_8, syn, err_poly);
+	if (no_of_err <= (4 << select_4_8))
+		no_of_err = ref_chien(select_4_8, no_of_err, err_poly, err_loc);
+
+	return no_of_err;
+}
+
+/* Generator polynomial g(x), one GF(2) coefficient per byte */
+static unsigned char gen[2][8 * mm + 1];
+
+static unsigned int alpha_pow(unsigned int e)
+{
+	unsigned int r = 1;
+
+	while (e--)
+		r = ref_mpy_mod_gf(r, 2);
+	return r;
+}
+
+/*
+ * g(x) is the product of the minimal polynomials of alpha^1, alpha^3, ..
+ * alpha^(2t-1); each one is the product of (x + alpha^c) over the
+ * cyclotomic coset of c.
+ */
+static void build_generator(unsigned int t, unsigned char *g)
+{
+	unsigned int poly[8 * mm + 1];
+	unsigned int deg = 0, i, j, c, root;
+
+	memset(poly, 0, sizeof(poly));
+	poly[0] = 1;
+
+	for (i = 1; i < 2 * t; i += 2) {
+		c = i;
+		do {
+			root = alpha_pow(c);
+			/* poly *= (x + root) */
+			poly[deg + 1] = 0;
+			for (j = deg + 1; j > 0; j--)
+				poly[j] = poly[j - 1] ^
+					ref_mpy_mod_gf(poly[j], root);
+			poly[0] = ref_mpy_mod_gf(poly[0], root);
+			deg++;
+			c = (c * 2) % nn;
+		} while (c != i);
+	}
+
+	for (i = 0; i <= deg; i++)
+		g[i] = poly[i];
+}
+
+/* Bit layout of the remainder as handed to decode_bch() by omap2.c */
+static void pack_remainder(unsigned int select_4_8, unsigned char *r,
+				unsigned char *ecc)
+{
+	unsigned int i, ecc_bits = (select_4_8 == 0) ? 52 : 104;
+	int pos = (select_4_8 == 0) ? 55 : 103;
+
+	memset(ecc, 0, 13);
+	for (i = 0; i < ecc_bits; i++, pos--)
+		if (r[i])
+			ecc[pos / 8] |= 1 << (7 - pos % 8);
+}
+
+static unsigned int expected_location(unsigned int select_4_8, unsigned int p)
+{
+	unsigned int ecc_bits = (select_4_8 == 0) ? 52 : 104;
+	unsigned int bit = (p & ~7) | (7 - (p & 7));
+
+	return kk_shorten - (bit - 2 * ecc_bits) - 1;
+}
+
+static int bch_test_one(unsigned int select_4_8, unsigned int nerr)
+{
+	unsigned int t = 4 << select_4_8, ecc_bits = mm * t;
+	unsigned int err_pos[10], loc[8], ref_loc[8];
+	unsigned char rem[8 * mm], ecc[13], ref_ecc[13];
+	unsigned char *g = gen[select_4_8];
+	unsigned int i, j, p, max = 0, carry;
+	int n, ref_n;
+
+	/* distinct error positions in the data area */
+	for (i = 0; i < nerr; i++) {
+again:
+		p = 2 * ecc_bits + random32() % kk_shorten;
+		for (j = 0; j < i; j++)
+			if (err_pos[j] == p)
+				goto again;
+		err_pos[i] = p;
+		if (p > max)
+			max = p;
+	}
+
+	/* r(x) = e(x) mod g(x), walking x^p mod g(x) up to the last error */
+	memset(rem, 0, sizeof(rem));
+	{
+		unsigned char xp[8 * mm];
+
+		memset(xp, 0, sizeof(xp));
+		xp[0] = 1;
+		for (p = 0; p <= max; p++) {
+			for (i = 0; i < nerr; i++)
+				if (err_pos[i] == p)
+					for (j = 0; j < ecc_bits; j++)
+						rem[j] ^= xp[j];
+			carry = xp[ecc_bits - 1];
+			for (j = ecc_bits - 1; j > 0; j--)
+				xp[j] = xp[j - 1] ^ (carry & g[j]);
+			xp[0] = carry & g[0];
+		}
+	}
+
+	pack_remainder(select_4_8, rem, ecc);
+	memcpy(ref_ecc, ecc, sizeof(ecc));
+
+	n = decode_bch(select_4_8, ecc, loc);
+	ref_n = ref_decode_bch(select_4_8, ref_ecc, ref_loc);
+
+	if (n != ref_n)
+		goto fail;
+	for (i = 0; n > 0 && i < n && i < t; i++)
+		if (loc[i] != ref_loc[i])
+			goto fail;
+
+	/* where the reference locates every injected error, so must we */
+	if (nerr > t || ref_n != nerr)
+		return 0;
+	for (i = 0; i < nerr; i++) {
+		for (j = 0; j < n; j++)
+			if (loc[j] == expected_location(select_4_8, err_pos[i]))
+				break;
+		if (j == n)
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	printk(KERN_ERR "mtd_bchtest: not ok - bch%u, %u errors: "
+			"got %d, reference %d\n", t, nerr, n, ref_n);
+	for (i = 0; i < nerr; i++)
+		printk(KERN_ERR "mtd_bchtest: error at %u (location %u)\n",
+			err_pos[i], expected_location(select_4_8, err_pos[i]));
+	return -1;
+}
+
+static int bch_test(unsigned int select_4_8)
+{
+	unsigned int t = 4 << select_4_8;
+	int i, err = 0;
+
+	build_generator(t, gen[select_4_8]);
+
+	for (i = 0; i < count; i++)
+		/* 1..t errors, plus some uncorrectable t+1, t+2 patterns */
+		if (bch_test_one(select_4_8, 1 + random32() % (t + 2)))
+			err++;
+
+	if (err)
+		printk(KERN_ERR "mtd_bchtest: not ok - bch%u, %d of %d failed\n",
+			t, err, count);
+	else
+		printk(PRINT_PREF "ok - bch%u, %d patterns\n", t, count);
+
+	return err;
+}
+
+#else
+
+static int bch_test(unsigned int select_4_8)
+{
+	return 0;
+}
+
+#endif
+
+static int __init bch_test_init(void)
+{
+	int err = 0;
+
+	srandom32(jiffies);
+
+	if (bch_test(0))
+		err = -EINVAL;
+	if (bch_test(1))
+		err = -EINVAL;
+
+	return err;
+}
+
+static void __exit bch_test_exit(void)
+{
+}
+
+module_init(bch_test_init);
+module_exit(bch_test_exit);
+
+MODULE_DESCRIPTION("OMAP BCH decoder test module");
+MODULE_LICENSE("GPL");
@@ -24,6 +24,9 @@
 #include <linux/phy.h>
 #include <linux/workqueue.h>
 #include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/mm.h>
+#include <linux/if_vlan.h>
 
 
 #include <linux/cpsw.h>
@@ -48,8 +51,11 @@ do {								\
 } while (0)
 
 #define CPSW_POLL_WEIGHT	64
+#define CPSW_MAX_QUEUES		8
+#define CPSW_NUM_PRIO		8
 #define CPSW_MIN_PACKET_SIZE	60
 #define CPSW_MAX_PACKET_SIZE	(1500 + 14 + 4 + 4)
+#define CPSW_RX_COPYBREAK	256	/* frames up to this are copied whole */
 
 #define CPSW_IRQ_QUIRK
 #ifdef CPSW_IRQ_QUIRK
@@ -82,6 +88,10 @@ static int rx_packet_max = CPSW_MAX_PACKET_SIZE;
 module_param(rx_packet_max, int, 0);
 MODULE_PARM_DESC(rx_packet_max, "maximum receive packet size (bytes)");
 
+static int queues = 4;
+module_param(queues, int, 0);
+MODULE_PARM_DESC(queues, "number of tx/rx queue pairs (cpdma channels)");
+
 struct cpsw_ss_regs {
 	u32	id_ver;
 	u32	soft_reset;
@@ -91,8 +101,31 @@ struct cpsw_ss_regs {
 	u32	rx_en;
 	u32	tx_en;
 	u32	misc_en;
+	u32	__reserved_0[20];
+	u32	rx_imax;
+	u32	tx_imax;
 };
 
+/* int_control fields */
+#define CPSW_INT_PRESCALE_MASK	0xfff
+#define CPSW_INT_RX_PACE_EN	BIT(16)
+#define CPSW_INT_TX_PACE_EN	BIT(17)
+
+/*
+ * Interrupt pacing: the wrapper limits each core's rx and tx interrupts to
+ * imax per millisecond (2..63), counted in 4us prescaler ticks of the bus
+ * clock.  ethtool coalesce usecs are converted to the nearest imax.
+ */
+#define CPSW_PACE_MIN_IMAX	2
+#define CPSW_PACE_MAX_IMAX	63
+#define CPSW_PACE_MAX_USECS	(1000 / CPSW_PACE_MIN_IMAX)
+#define CPSW_PACE_TICK_NS	4000
+#define CPSW_BUS_FREQ_DEFAULT	125000000
+
+/* adaptive pacing: aim for this many frames per interrupt */
+#define CPSW_ADAPT_FRAMES	16
+#define CPSW_ADAPT_WINDOW	(HZ / 10)
+
 struct cpsw_regs {
 	u32	id_ver;
 	u32	control;
@@ -184,14 +217,61 @@ struct cpsw_slave {
 	struct phy_device		*phy;
 };
 
+/*
+ * Receive buffers are whole pages that stay DMA mapped for the life of the
+ * interface.  The head of each frame (all of it, up to CPSW_RX_COPYBREAK)
+ * is copied into a small skb and the rest attached as a page fragment.
+ * Pages lent to the stack that way are parked until the stack drops its
+ * reference, then go back to cpdma without another alloc/map cycle.
+ */
+struct cpsw_rx_buf {
+	struct list_head		list;
+	struct cpsw_priv		*priv;
+	struct page			*page;
+	dma_addr_t			dma;
+	int				queue;	/* rx queue it was queued on */
+};
+
+struct cpsw_rx_pool {
+	spinlock_t			lock;
+	struct list_head		free;	/* mapped, ready for cpdma */
+	struct list_head		parked;	/* page shared with the stack */
+	int				count, max;
+	u32				hits;
+	u32				misses;
+	u32				released;
+};
+
+/*
+ * Queue n is the pair of cpdma tx and rx channels n, with its own NAPI
+ * context.  tx channels run in fixed priority, so higher queues are
+ * served first.
+ */
+struct cpsw_queue {
+	struct napi_struct		napi;
+#define napi_to_queue(napi)	container_of(napi, struct cpsw_queue, napi)
+	struct cpsw_priv		*priv;
+	int				num;
+	struct cpdma_chan		*txch, *rxch;
+};
+
 struct cpsw_priv {
 	spinlock_t			lock;
 	struct platform_device		*pdev;
 	struct net_device		*ndev;
 	struct resource			*cpsw_res;
 	struct resource			*cpsw_ss_res;
-	struct napi_struct		napi;
-#define napi_to_priv(napi)	container_of(napi, struct cpsw_priv, napi)
+	struct cpsw_queue		queues[CPSW_MAX_QUEUES];
+	int				num_queues;
+	u32				napi_active;	/* under lock */
+	u8				prio_map[CPSW_NUM_PRIO];
+	u32				rx_coal_usecs, tx_coal_usecs;
+	bool				coal_adaptive;
+	unsigned long			coal_stamp;	/* adaptive window */
+	u32				coal_frames;
+#define for_each_queue(priv, q)					\
+	for ((q) = (priv)->queues;					\
+	     (q) < (priv)->queues + (priv)->num_queues; (q)++)
 	struct device			*dev;
 	struct cpsw_platform_data	data;
 	struct cpsw_regs __iomem	*regs;
@@ -213,8 +293,8 @@ struct cpsw_priv {
 	} while (0)
 
 	struct cpdma_ctlr		*dma;
-	struct cpdma_chan		*txch, *rxch;
 	struct cpsw_ale			*ale;
+	struct cpsw_rx_pool		rx_pool;
 
 #ifdef CPSW_IRQ_QUIRK
 	/* snapshot of IRQ numbers */
@@ -247,59 +327,365 @@ void cpsw_tx_handler(void *token, int len, int status)
 	struct sk_buff		*skb = token;
 	struct net_device	*ndev = skb->dev;
 	struct cpsw_priv	*priv = netdev_priv(ndev);
+	u16			q = skb_get_queue_mapping(skb);
 
-	if (unlikely(netif_queue_stopped(ndev)))
-		netif_start_queue(ndev);
+	if (unlikely(__netif_subqueue_stopped(ndev, q)))
+		netif_wake_subqueue(ndev, q);
 	priv->stats.tx_packets++;
 	priv->stats.tx_bytes += len;
 	dev_kfree_skb_any(skb);
 }
 
+static void cpsw_rx_pool_init(struct cpsw_priv *priv)
+{
+	struct cpsw_rx_pool *pool = &priv->rx_pool;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->free);
+	INIT_LIST_HEAD(&pool->parked);
+	pool->count = 0;
+	pool->max = 2 * priv->data.rx_descs;
+}
+
+static void __cpsw_rx_buf_release(struct cpsw_priv *priv,
+				  struct cpsw_rx_buf *buf)
+{
+	dma_unmap_page(&priv->pdev->dev, buf->dma, PAGE_SIZE,
+		       DMA_FROM_DEVICE);
+	put_page(buf->page);
+}
+
+/* unmap and drop every pooled page; cpdma must hold none of them */
+static void cpsw_rx_pool_destroy(struct cpsw_priv *priv)
+{
+	struct cpsw_rx_pool *pool = &priv->rx_pool;
+	struct cpsw_rx_buf *buf, *tmp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	list_splice_init(&pool->parked, &pool->free);
+	list_for_each_entry_safe(buf, tmp, &pool->free, list) {
+		list_del(&buf->list);
+		__cpsw_rx_buf_release(priv, buf);
+		kfree(buf);
+		pool->count--;
+	}
+	WARN_ON(pool->count);
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+/* get a mapped buffer for cpdma, reusing pooled pages when possible */
+static struct cpsw_rx_buf *cpsw_rx_pool_get(struct cpsw_priv *priv)
+{
+	struct cpsw_rx_pool *pool = &priv->rx_pool;
+	struct cpsw_rx_buf *buf;
+	struct page *page;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+
+	/* parked pages come back once the stack has let go of them */
+	while (!list_empty(&pool->parked)) {
+		buf = list_first_entry(&pool->parked, struct cpsw_rx_buf, list);
+		if (page_count(buf->page) != 1)
+			break;
+		list_move_tail(&buf->list, &pool->free);
+	}
+
+	if (!list_empty(&pool->free)) {
+		buf = list_first_entry(&pool->free, struct cpsw_rx_buf, list);
+		list_del(&buf->list);
+		pool->hits++;
+		spin_unlock_irqrestore(&pool->lock, flags);
+		return buf;
+	}
+
+	/* at the limit, give up the oldest page still held by the stack */
+	buf = NULL;
+	if (pool->count >= pool->max && !list_empty(&pool->parked)) {
+		buf = list_first_entry(&pool->parked, struct cpsw_rx_buf, list);
+		list_del(&buf->list);
+		__cpsw_rx_buf_release(priv, buf);
+		pool->released++;
+	} else {
+		pool->count++;
+	}
+	pool->misses++;
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	if (!buf) {
+		buf = kmalloc(sizeof(*buf), GFP_ATOMIC);
+		if (!buf)
+			goto fail;
+		buf->priv = priv;
+	}
+
+	page = alloc_page(GFP_ATOMIC);
+	if (!page)
+		goto fail_free;
+
+	buf->page = page;
+	buf->dma = dma_map_page(&priv->pdev->dev, page, 0, PAGE_SIZE,
+				DMA_FROM_DEVICE);
+	if (dma_mapping_error(&priv->pdev->dev, buf->dma)) {
+		__free_page(page);
+		goto fail_free;
+	}
+	return buf;
+
+fail_free:
+	kfree(buf);
+fail:
+	spin_lock_irqsave(&pool->lock, flags);
+	pool->count--;
+	spin_unlock_irqrestore(&pool->lock, flags);
+	return NULL;
+}
+
+/* return a buffer to the pool, parked if the stack still uses its page */
+static void cpsw_rx_pool_put(struct cpsw_priv *priv, struct cpsw_rx_buf *buf,
+			     bool shared)
+{
+	struct cpsw_rx_pool *pool = &priv->rx_pool;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	list_add_tail(&buf->list, shared ? &pool->parked : &pool->free);
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+/* queue pooled buffers to an rx channel, returning leftovers to the pool */
+static int cpsw_rx_submit(struct cpsw_priv *priv, int queue,
+			  struct cpsw_rx_buf **bufs, int num)
+{
+	struct cpdma_buf	dma_bufs[CPDMA_BATCH];
+	int			i, ret;
+
+	for (i = 0; i < num; i++) {
+		bufs[i]->queue		= queue;
+		dma_bufs[i].token	= bufs[i];
+		dma_bufs[i].data	= page_address(bufs[i]->page);
+		dma_bufs[i].dma		= bufs[i]->dma;
+		dma_bufs[i].len		= priv->rx_packet_max;
+	}
+
+	ret = cpdma_chan_submit_bulk(priv->queues[queue].rxch, dma_bufs, num,
+				     GFP_KERNEL);
+	for (i = max(ret, 0); i < num; i++)
+		cpsw_rx_pool_put(priv, bufs[i], false);
+	return ret;
+}
+
+/*
+ * Hand a received frame to the stack.  Returns true when part of the page
+ * went with the skb, i.e. the buffer has to be parked.
+ */
+static bool cpsw_rx_frame(struct cpsw_priv *priv, struct cpsw_rx_buf *buf,
+			  int len)
+{
+	struct net_device	*ndev = priv->ndev;
+	struct sk_buff		*skb;
+	int			hlen = min(len, CPSW_RX_COPYBREAK);
+
+	skb = netdev_alloc_skb_ip_align(ndev, hlen);
+	if (unlikely(!skb)) {
+		priv->stats.rx_dropped++;
+		return false;
+	}
+
+	memcpy(skb_put(skb, hlen), page_address(buf->page), hlen);
+	if (len > hlen) {
+		get_page(buf->page);
+		skb_fill_page_desc(skb, 0, buf->page, hlen, len - hlen);
+		skb->len	+= len - hlen;
+		skb->data_len	+= len - hlen;
+		skb->truesize	+= len - hlen;
+	}
+
+	skb->protocol = eth_type_trans(skb, ndev);
+	netif_receive_skb(skb);
+	priv->stats.rx_bytes += len;
+	priv->stats.rx_packets++;
+
+	return len > hlen;
+}
+
 void cpsw_rx_handler(void *token, int len, int status)
 {
-	struct sk_buff		*skb = token;
+	struct cpsw_rx_buf	*buf = token;
+	struct cpsw_priv	*priv = buf->priv;
+	int			queue = buf->queue;
+	bool			shared = false;
+	int			ret = 0;
+
+	if (likely(status >= 0 && netif_running(priv->ndev)))
+		shared = cpsw_rx_frame(priv, buf, len);
+	cpsw_rx_pool_put(priv, buf, shared);
+
+	if (unlikely(!netif_running(priv->ndev)))
+		return;
+
+	buf = cpsw_rx_pool_get(priv);
+	if (WARN_ON(!buf))
+		return;
+
+	ret = cpsw_rx_submit(priv, queue, &buf, 1);
+	WARN_ON(ret < 0);
+}
+
+void cpsw_tx_batch_handler(struct cpdma_done *done, int num)
+{
+	struct sk_buff		*skb = done[0].token;
 	struct net_device	*ndev = skb->dev;
 	struct cpsw_priv	*priv = netdev_priv(ndev);
-	int			ret = 0;
+	u16			q = skb_get_queue_mapping(skb);
+	int			i;
 
-	if (likely(status >= 0)) {
-		skb_put(skb, len);
-		skb->protocol = eth_type_trans(skb, ndev);
-		netif_receive_skb(skb);
-		priv->stats.rx_bytes += len;
-		priv->stats.rx_packets++;
-		skb = NULL;
+	for (i = 0; i < num; i++) {
+		priv->stats.tx_bytes += done[i].len;
+		dev_kfree_skb_any(done[i].token);
 	}
+	priv->stats.tx_packets += num;
+
+	if (unlikely(__netif_subqueue_stopped(ndev, q)))
+		netif_wake_subqueue(ndev, q);
+}
 
+/*
+ * Batched counterpart of cpsw_rx_handler(): deliver every good frame, then
+ * refill the ring from the pool with one cpdma_chan_submit_bulk() call.
+ */
+void cpsw_rx_batch_handler(struct cpdma_done *done, int num)
+{
+	struct cpsw_rx_buf	*buf = done[0].token;
+	struct cpsw_priv	*priv = buf->priv;
+	int			queue = buf->queue;
+	struct cpsw_rx_buf	*bufs[CPDMA_BATCH];
+	bool			shared;
+	int			i, n;
+
+	for (i = 0; i < num; i++) {
+		buf = done[i].token;
+		shared = false;
+		if (likely(done[i].status >= 0))
+			shared = cpsw_rx_frame(priv, buf, done[i].len);
+		cpsw_rx_pool_put(priv, buf, shared);
+	}
 
-	if (unlikely(!netif_running(ndev))) {
-		if (skb)
-			dev_kfree_skb_any(skb);
+	if (unlikely(!netif_running(priv->ndev)))
 		return;
+
+	for (n = 0; n < num; n++) {
+		bufs[n] = cpsw_rx_pool_get(priv);
+		if (WARN_ON(!bufs[n]))
+			break;
 	}
 
-	if (likely(!skb)) {
-		skb = netdev_alloc_skb_ip_align(ndev, priv->rx_packet_max);
-		if (WARN_ON(!skb)) {
-			return;
-		}
+	if (n)
+		WARN_ON(cpsw_rx_submit(priv, queue, bufs, n) < n);
+}
 
-		ret = cpdma_chan_submit(priv->rxch, skb, skb->data,
-				skb_tailroom(skb), GFP_KERNEL);
+/* program the pacing registers from priv->{rx,tx}_coal_usecs */
+static void cpsw_set_pacing(struct cpsw_priv *priv)
+{
+	unsigned long rate = 0;
+	u32 ctrl, prescale;
+
+	if (!IS_ERR(priv->clk))
+		rate = clk_get_rate(priv->clk);
+	if (!rate)
+		rate = CPSW_BUS_FREQ_DEFAULT;
+	prescale = rate / (NSEC_PER_SEC / CPSW_PACE_TICK_NS);
+
+	ctrl = __raw_readl(&priv->ss_regs->int_control);
+	ctrl &= ~(CPSW_INT_PRESCALE_MASK | CPSW_INT_RX_PACE_EN |
+		  CPSW_INT_TX_PACE_EN);
+	ctrl |= min_t(u32, prescale, CPSW_INT_PRESCALE_MASK);
+
+	if (priv->rx_coal_usecs) {
+		__raw_writel(clamp_t(u32, 1000 / priv->rx_coal_usecs,
+				     CPSW_PACE_MIN_IMAX, CPSW_PACE_MAX_IMAX),
+			     &priv->ss_regs->rx_imax);
+		ctrl |= CPSW_INT_RX_PACE_EN;
+	}
+	if (priv->tx_coal_usecs) {
+		__raw_writel(clamp_t(u32, 1000 / priv->tx_coal_usecs,
+				     CPSW_PACE_MIN_IMAX, CPSW_PACE_MAX_IMAX),
+			     &priv->ss_regs->tx_imax);
+		ctrl |= CPSW_INT_TX_PACE_EN;
 	}
 
-	WARN_ON(ret < 0);
+	__raw_writel(ctrl, &priv->ss_regs->int_control);
+}
+
+/*
+ * Adaptive pacing, run from every queue's cpsw_poll(): over each
+ * CPSW_ADAPT_WINDOW pick an interrupt rate that brings about
+ * CPSW_ADAPT_FRAMES frames per interrupt, at most CPSW_PACE_MAX_IMAX, and
+ * turn pacing off entirely when traffic is light so that latency does not
+ * suffer.  The window is shared by the queues, so priv->lock guards it.
+ */
+static void cpsw_adapt_pacing(struct cpsw_priv *priv, int frames)
+{
+	unsigned long elapsed, flags;
+	u32 per_ms, imax, usecs;
+
+	spin_lock_irqsave(&priv->lock, flags);
+
+	priv->coal_frames += frames;
+	elapsed = jiffies - priv->coal_stamp;
+	if (elapsed < CPSW_ADAPT_WINDOW)
+		goto out;
+
+	per_ms = priv->coal_frames / max(jiffies_to_msecs(elapsed), 1U);
+	priv->coal_frames = 0;
+	priv->coal_stamp = jiffies;
+
+	imax = min_t(u32, per_ms / CPSW_ADAPT_FRAMES, CPSW_PACE_MAX_IMAX);
+	if (imax < CPSW_PACE_MIN_IMAX)
+		usecs = 0;	/* light load, favour latency */
+	else
+		usecs = 1000 / imax;
 
+	if (usecs != priv->rx_coal_usecs || usecs != priv->tx_coal_usecs) {
+		priv->rx_coal_usecs = usecs;
+		priv->tx_coal_usecs = usecs;
+		cpsw_set_pacing(priv);
+	}
+
+out:
+	spin_unlock_irqrestore(&priv->lock, flags);
 }
 
+/*
+ * Schedule the NAPI context of every queue with completions pending,
+ * highest priority first so it is polled first.  Interrupts stay off
+ * until the last of them completes.
+ */
 static irqreturn_t cpsw_interrupt(int irq, void *dev_id)
 {
 	struct cpsw_priv *priv = dev_id;
+	unsigned long flags;
+	u32 pending;
+	int q;
 
 	if (likely(netif_running(priv->ndev))) {
+		pending = cpdma_ctlr_rxstat(priv->dma) |
+			  cpdma_ctlr_txstat(priv->dma);
+		pending &= BIT(priv->num_queues) - 1;
+		if (!pending)
+			pending = BIT(0);
+
 		cpsw_intr_disable(priv);
 		cpsw_disable_irq(priv);
-		napi_schedule(&priv->napi);
+
+		spin_lock_irqsave(&priv->lock, flags);
+		priv->napi_active |= pending;
+		spin_unlock_irqrestore(&priv->lock, flags);
+
+		for (q = priv->num_queues - 1; q >= 0; q--)
+			if (pending & BIT(q))
+				napi_schedule(&priv->queues[q].napi);
 	}
 
 
@@ -308,27 +694,57 @@ static irqreturn_t cpsw_interrupt(int irq, void *dev_id)
 
 static int cpsw_poll(struct napi_struct *napi, int budget)
 {
-	struct cpsw_priv	*priv = napi_to_priv(napi);
+	struct cpsw_queue	*queue = napi_to_queue(napi);
+	struct cpsw_priv	*priv = queue->priv;
+	unsigned long		flags;
 	int			num_tx, num_rx;
+	bool			last;
 
 
-	num_tx = cpdma_chan_process(priv->txch, 128);
-	num_rx = cpdma_chan_process(priv->rxch, budget);
+	num_tx = cpdma_chan_process(queue->txch, 128);
+	num_rx = cpdma_chan_process(queue->rxch, budget);
 
 	if (num_rx || num_tx)
-		msg(dbg, intr, "poll %d rx, %d tx pkts\n", num_rx, num_tx);
+		msg(dbg, intr, "poll q%d %d rx, %d tx pkts\n", queue->num,
+		    num_rx, num_tx);
+
+	if (priv->coal_adaptive)
+		cpsw_adapt_pacing(priv, num_rx + num_tx);
 
 
 	if (num_rx < budget) {
 		napi_complete(napi);
-		cpdma_ctlr_eoi(priv->dma);
-		cpsw_intr_enable(priv);
-		cpsw_enable_irq(priv);
+
+		spin_lock_irqsave(&priv->lock, flags);
+		priv->napi_active &= ~BIT(queue->num);
+		last = !priv->napi_active;
+		spin_unlock_irqrestore(&priv->lock, flags);
+
+		if (last) {
+			cpdma_ctlr_eoi(priv->dma);
+			cpsw_intr_enable(priv);
+			cpsw_enable_irq(priv);
+		}
 	}
 
 	return num_rx;
 }
 
+/* tx queue for a frame: 802.1p priority if tagged, else skb->priority */
+static u16 cpsw_ndo_select_queue(struct net_device *ndev, struct sk_buff *skb)
+{
+	struct cpsw_priv *priv = netdev_priv(ndev);
+	u32 prio = skb->priority;
+
+	if (vlan_tx_tag_present(skb))
+		prio = vlan_tx_tag_get(skb) >> VLAN_PRIO_SHIFT;
+	else if (skb->protocol == htons(ETH_P_8021Q) &&
+		 skb_headlen(skb) >= VLAN_ETH_HLEN)
+		prio = ntohs(vlan_eth_hdr(skb)->h_vlan_TCI) >> VLAN_PRIO_SHIFT;
+
+	return priv->prio_map[min_t(u32, prio, CPSW_NUM_PRIO - 1)];
+}
+
 static inline void soft_reset(const char *module, void __iomem *reg)
 {
 	unsigned long timeout = jiffies + HZ;
@@ -390,10 +806,10 @@ static void cpsw_adjust_link(struct net_device *ndev)
 	if (link) {
 		netif_carrier_on(ndev);
 		if (netif_running(ndev))
-			netif_wake_queue(ndev);
+			netif_tx_wake_all_queues(ndev);
 	} else {
 		netif_carrier_off(ndev);
-		netif_stop_queue(ndev);
+		netif_tx_stop_all_queues(ndev);
 	}
 }
 
@@ -408,6 +824,24 @@ static inline int __show_stat(char *buf, int maxlen, const char* name, u32 val)
 				leader + strlen(name), val);
 }
 
+/* dma statistics summed over the rx or tx channels of all queues */
+static void cpsw_get_dma_stats(struct cpsw_priv *priv, bool rx,
+			       struct cpdma_chan_stats *stats)
+{
+	struct cpdma_chan_stats	chan_stats;
+	struct cpsw_queue	*queue;
+	u32			*sum = (u32 *)stats, *val = (u32 *)&chan_stats;
+	int			i;
+
+	memset(stats, 0, sizeof(*stats));
+	for_each_queue(priv, queue) {
+		cpdma_chan_get_stats(rx ? queue->rxch : queue->txch,
+				     &chan_stats);
+		for (i = 0; i < sizeof(chan_stats) / sizeof(u32); i++)
+			sum[i] += val[i];
+	}
+}
+
 static ssize_t cpsw_hw_stats_show(struct device *dev,
 				     struct device_attribute *attr,
 				     char *buf)
@@ -416,6 +850,8 @@ static ssize_t cpsw_hw_stats_show(struct device *dev,
 	struct cpsw_priv	*priv = netdev_priv(ndev);
 	int			len = 0;
 	struct cpdma_chan_stats	dma_stats;
+	struct cpsw_queue	*queue;
+	char			name[16];
 
 #define show_stat(x) do {						\
 	len += __show_stat(buf + len, SZ_4K - len, #x,			\
@@ -445,7 +881,7 @@ static ssize_t cpsw_hw_stats_show(struct device *dev,
 	show_stat(netoctets);		show_stat(rxsofoverruns);
 	show_stat(rxmofoverruns);	show_stat(rxdmaoverruns);
 
-	cpdma_chan_get_stats(priv->rxch, &dma_stats);
+	cpsw_get_dma_stats(priv, true, &dma_stats);
 	len += snprintf(buf + len, SZ_4K - len, "\nRX DMA Statistics:\n");
 	show_dma_stat(head_enqueue);	show_dma_stat(tail_enqueue);
 	show_dma_stat(pad_enqueue);	show_dma_stat(misqueued);
@@ -454,7 +890,7 @@ static ssize_t cpsw_hw_stats_show(struct device *dev,
 	show_dma_stat(empty_dequeue);	show_dma_stat(busy_dequeue);
 	show_dma_stat(good_dequeue);	show_dma_stat(teardown_dequeue);
 
-	cpdma_chan_get_stats(priv->txch, &dma_stats);
+	cpsw_get_dma_stats(priv, false, &dma_stats);
 	len += snprintf(buf + len, SZ_4K - len, "\nTX DMA Statistics:\n");
 	show_dma_stat(head_enqueue);	show_dma_stat(tail_enqueue);
 	show_dma_stat(pad_enqueue);	show_dma_stat(misqueued);
@@ -463,11 +899,70 @@ static ssize_t cpsw_hw_stats_show(struct device *dev,
 	show_dma_stat(empty_dequeue);	show_dma_stat(busy_dequeue);
 	show_dma_stat(good_dequeue);	show_dma_stat(teardown_dequeue);
 
+	len += snprintf(buf + len, SZ_4K - len, "\nQueue Statistics:\n");
+	for_each_queue(priv, queue) {
+		cpdma_chan_get_stats(queue->rxch, &dma_stats);
+		snprintf(name, sizeof(name), "rx_q%d_frames", queue->num);
+		len += __show_stat(buf + len, SZ_4K - len, name,
+				   dma_stats.good_dequeue);
+		cpdma_chan_get_stats(queue->txch, &dma_stats);
+		snprintf(name, sizeof(name), "tx_q%d_frames", queue->num);
+		len += __show_stat(buf + len, SZ_4K - len, name,
+				   dma_stats.good_dequeue);
+	}
+
+	len += snprintf(buf + len, SZ_4K - len, "\nRX Pool Statistics:\n");
+	len += __show_stat(buf + len, SZ_4K - len, "pool_hits",
+			   priv->rx_pool.hits);
+	len += __show_stat(buf + len, SZ_4K - len, "pool_misses",
+			   priv->rx_pool.misses);
+	len += __show_stat(buf + len, SZ_4K - len, "pool_released",
+			   priv->rx_pool.released);
+
 	return len;
 }
 
 DEVICE_ATTR(hw_stats, S_IRUGO, cpsw_hw_stats_show, NULL);
 
+/* priority (0-7) to tx queue map, as eight space separated queue numbers */
+static ssize_t cpsw_prio_map_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct cpsw_priv	*priv = netdev_priv(to_net_dev(dev));
+	int			i, len = 0;
+
+	for (i = 0; i < CPSW_NUM_PRIO; i++)
+		len += snprintf(buf + len, PAGE_SIZE - len, "%d%c",
+				priv->prio_map[i],
+				i == CPSW_NUM_PRIO - 1 ? '\n' : ' ');
+	return len;
+}
+
+static ssize_t cpsw_prio_map_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct cpsw_priv	*priv = netdev_priv(to_net_dev(dev));
+	int			map[CPSW_NUM_PRIO];
+	int			i;
+
+	if (sscanf(buf, "%d %d %d %d %d %d %d %d", &map[0], &map[1],
+		   &map[2], &map[3], &map[4], &map[5], &map[6],
+		   &map[7]) != CPSW_NUM_PRIO)
+		return -EINVAL;
+
+	for (i = 0; i < CPSW_NUM_PRIO; i++)
+		if (map[i] < 0 || map[i] >= priv->num_queues)
+			return -EINVAL;
+
+	for (i = 0; i < CPSW_NUM_PRIO; i++)
+		priv->prio_map[i] = map[i];
+	return count;
+}
+
+DEVICE_ATTR(prio_map, S_IRUGO | S_IWUSR, cpsw_prio_map_show,
+	    cpsw_prio_map_store);
+
 static inline u32 cpsw_get_slave_port(struct cpsw_priv *priv, u32 slave_num)
 {
 	if (priv->host_port == 0)
@@ -574,6 +1069,25 @@ static void cpsw_slave_open(struct cpsw_slave *slave, struct cpsw_priv *priv)
 	}
 }
 
+/*
+ * Frames to the host are sorted into four switch priorities (from the
+ * 802.1p priority through the host port tx_pri_map); spread those over the
+ * rx channels so the highest priority lands on the highest queue.  Each
+ * slave port has its own 4 x 3 bit field group in cpdma_rx_chan_map.
+ */
+static u32 cpsw_rx_chan_map(struct cpsw_priv *priv)
+{
+	u32 map = 0, chan;
+	int pri;
+
+	for (pri = 0; pri < 4; pri++) {
+		chan = pri * priv->num_queues / 4;
+		map |= chan << (4 * pri);	/* port 1 */
+		map |= chan << (16 + 4 * pri);	/* port 2 */
+	}
+	return map;
+}
+
 static void cpsw_init_host_port(struct cpsw_priv *priv)
 {
 	/* soft reset the controller and initialize ale */
@@ -585,7 +1099,9 @@ static void cpsw_init_host_port(struct cpsw_priv *priv)
 
 	/* setup host port priority mapping */
 	__raw_writel(0x76543210, &priv->host_port_regs->cpdma_tx_pri_map);
-	__raw_writel(0, &priv->host_port_regs->cpdma_rx_chan_map);
+	__raw_writel(0x33221100, &priv->host_port_regs->tx_pri_map);
+	__raw_writel(cpsw_rx_chan_map(priv),
+		     &priv->host_port_regs->cpdma_rx_chan_map);
 
 	cpsw_ale_control_set(priv->ale, priv->host_port,
 			     ALE_PORT_STATE, ALE_PORT_STATE_FORWARD);
@@ -597,10 +1113,37 @@ static void cpsw_init_host_port(struct cpsw_priv *priv)
 			   1 << priv->host_port);
 }
 
+/* queue up to count pooled rx buffers on a queue, returning how many */
+static int cpsw_rx_fill(struct cpsw_priv *priv, int queue, int count)
+{
+	struct cpsw_rx_buf *bufs[CPDMA_BATCH];
+	int i, j, n, ret;
+
+	for (i = 0; i < count; ) {
+		n = min(count - i, CPDMA_BATCH);
+		for (j = 0; j < n; j++) {
+			bufs[j] = cpsw_rx_pool_get(priv);
+			if (!bufs[j])
+				break;
+		}
+		if (!j)
+			break;
+
+		ret = cpsw_rx_submit(priv, queue, bufs, j);
+		if (WARN_ON(ret < j))
+			return i + max(ret, 0);
+		i += j;
+		if (j < n)
+			break;
+	}
+	return i;
+}
+
 static int cpsw_ndo_open(struct net_device *ndev)
 {
 	struct cpsw_priv *priv = netdev_priv(ndev);
-	int i, ret;
+	struct cpsw_queue *queue;
+	int i, q, ret;
 	u32 reg;
 
 	cpsw_intr_disable(priv);
@@ -618,6 +1161,13 @@ static int cpsw_ndo_open(struct net_device *ndev)
 		return ret;
 	}
 
+	ret = device_create_file(&ndev->dev, &dev_attr_prio_map);
+	if (ret < 0) {
+		dev_err(priv->dev, "unable to add device attr\n");
+		device_remove_file(&ndev->dev, &dev_attr_hw_stats);
+		return ret;
+	}
+
 	if (priv->data.phy_control)
 		(*priv->data.phy_control)(true);
 
@@ -634,6 +1184,10 @@ static int cpsw_ndo_open(struct net_device *ndev)
 	cpdma_control_set(priv->dma, CPDMA_TX_PRIO_FIXED, 1);
 	cpdma_control_set(priv->dma, CPDMA_RX_BUFFER_OFFSET, 0);
 
+	priv->coal_stamp = jiffies;
+	priv->coal_frames = 0;
+	cpsw_set_pacing(priv);
+
 	/* disable priority elevation and enable statistics on all ports */
 	__raw_writel(0, &priv->regs->ptype);
 
@@ -644,25 +1198,26 @@ static int cpsw_ndo_open(struct net_device *ndev)
 	if (WARN_ON(!priv->data.rx_descs))
 		priv->data.rx_descs = 128;
 
-	for (i = 0; i < priv->data.rx_descs; i++) {
-		struct sk_buff *skb;
-
-		ret = -ENOMEM;
-		skb = netdev_alloc_skb_ip_align(priv->ndev,
-						priv->rx_packet_max);
-		if (!skb)
-			break;
-		ret = cpdma_chan_submit(priv->rxch, skb, skb->data,
-					skb_tailroom(skb), GFP_KERNEL);
-		if (WARN_ON(ret < 0))
-			break;
+	/*
+	 * Half of the receive descriptors go to queue 0, which carries the
+	 * bulk of the traffic, the rest is shared by the priority queues.
+	 */
+	cpsw_rx_pool_init(priv);
+	for (i = 0, q = 0; q < priv->num_queues; q++) {
+		int descs = priv->data.rx_descs;
+
+		if (priv->num_queues > 1)
+			descs = q ? descs / 2 / (priv->num_queues - 1) :
+				descs - descs / 2;
+		i += cpsw_rx_fill(priv, q, descs);
 	}
 	/* continue even if we didn't manage to submit all receive descs */
 	msg(info, ifup, "submitted %d rx descriptors\n", i);
 
 	cpdma_ctlr_start(priv->dma);
 	cpsw_intr_enable(priv);
-	napi_enable(&priv->napi);
+	for_each_queue(priv, queue)
+		napi_enable(&queue->napi);
 	cpdma_ctlr_eoi(priv->dma);
 
 	return 0;
@@ -680,15 +1235,19 @@ static void cpsw_slave_stop(struct cpsw_slave *slave, struct cpsw_priv *priv)
 static int cpsw_ndo_stop(struct net_device *ndev)
 {
 	struct cpsw_priv *priv = netdev_priv(ndev);
+	struct cpsw_queue *queue;
 
 	msg(info, ifdown, "shutting down cpsw device\n");
 	cpsw_intr_disable(priv);
 	cpdma_ctlr_int_ctrl(priv->dma, false);
 	cpdma_ctlr_stop(priv->dma);
-	netif_stop_queue(priv->ndev);
-	napi_disable(&priv->napi);
+	netif_tx_stop_all_queues(priv->ndev);
+	for_each_queue(priv, queue)
+		napi_disable(&queue->napi);
+	cpsw_rx_pool_destroy(priv);
 	netif_carrier_off(priv->ndev);
 	cpsw_ale_stop(priv->ale);
+	device_remove_file(&ndev->dev, &dev_attr_prio_map);
 	device_remove_file(&ndev->dev, &dev_attr_hw_stats);
 	for_each_slave(priv, cpsw_slave_stop, priv);
 	if (priv->data.phy_control)
@@ -701,6 +1260,7 @@ static netdev_tx_t cpsw_ndo_start_xmit(struct sk_buff *skb,
 				       struct net_device *ndev)
 {
 	struct cpsw_priv *priv = netdev_priv(ndev);
+	u16 q = skb_get_queue_mapping(skb);
 	int ret;
 
 	ndev->trans_start = jiffies;
@@ -711,7 +1271,7 @@ static netdev_tx_t cpsw_ndo_start_xmit(struct sk_buff *skb,
 		goto fail;
 	}
 
-	ret = cpdma_chan_submit(priv->txch, skb, skb->data,
+	ret = cpdma_chan_submit(priv->queues[q].txch, skb, skb->data,
 				skb->len, GFP_KERNEL);
 	if (unlikely(ret != 0)) {
 		msg(err, tx_err, "desc submit failed");
@@ -721,7 +1281,7 @@ static netdev_tx_t cpsw_ndo_start_xmit(struct sk_buff *skb,
 	return NETDEV_TX_OK;
 fail:
 	priv->stats.tx_dropped++;
-	netif_stop_queue(ndev);
+	netif_stop_subqueue(ndev, q);
 	return NETDEV_TX_BUSY;
 }
 
@@ -764,13 +1324,16 @@ static int cpsw_ndo_set_mac_address(struct net_device *ndev, void *addr)
 static void cpsw_ndo_tx_timeout(struct net_device *ndev)
 {
 	struct cpsw_priv *priv = netdev_priv(ndev);
+	struct cpsw_queue *queue;
 
 	msg(err, tx_err, "transmit timeout, restarting dma");
 	priv->stats.tx_errors++;
 	cpsw_intr_disable(priv);
 	cpdma_ctlr_int_ctrl(priv->dma, false);
-	cpdma_chan_stop(priv->txch);
-	cpdma_chan_start(priv->txch);
+	for_each_queue(priv, queue) {
+		cpdma_chan_stop(queue->txch);
+		cpdma_chan_start(queue->txch);
+	}
 	cpdma_ctlr_int_ctrl(priv->dma, true);
 	cpsw_intr_enable(priv);
 	cpdma_ctlr_eoi(priv->dma);
@@ -800,6 +1363,7 @@ static const struct net_device_ops cpsw_netdev_ops = {
 	.ndo_open		= cpsw_ndo_open,
 	.ndo_stop		= cpsw_ndo_stop,
 	.ndo_start_xmit		= cpsw_ndo_start_xmit,
+	.ndo_select_queue	= cpsw_ndo_select_queue,
 	.ndo_change_rx_flags	= cpsw_ndo_change_rx_flags,
 	.ndo_set_mac_address	= cpsw_ndo_set_mac_address,
 	.ndo_validate_addr	= eth_validate_addr,
@@ -831,11 +1395,55 @@ static void cpsw_set_msglevel(struct net_device *ndev, u32 value)
 	priv->msg_enable = value;
 }
 
+static int cpsw_get_coalesce(struct net_device *ndev,
+			     struct ethtool_coalesce *coal)
+{
+	struct cpsw_priv *priv = netdev_priv(ndev);
+
+	coal->rx_coalesce_usecs = priv->rx_coal_usecs;
+	coal->tx_coalesce_usecs = priv->tx_coal_usecs;
+	coal->use_adaptive_rx_coalesce = priv->coal_adaptive;
+	coal->use_adaptive_tx_coalesce = priv->coal_adaptive;
+	return 0;
+}
+
+static int cpsw_set_coalesce(struct net_device *ndev,
+			     struct ethtool_coalesce *coal)
+{
+	struct cpsw_priv *priv = netdev_priv(ndev);
+	unsigned long flags;
+
+	/* pacing covers at most 2 interrupts per millisecond */
+	if (coal->rx_coalesce_usecs > CPSW_PACE_MAX_USECS ||
+	    coal->tx_coalesce_usecs > CPSW_PACE_MAX_USECS)
+		return -EINVAL;
+
+	/* rx and tx share the adaptive logic */
+	if (coal->use_adaptive_rx_coalesce != coal->use_adaptive_tx_coalesce)
+		return -EINVAL;
+
+	/* cpsw_adapt_pacing() may be running on another queue */
+	spin_lock_irqsave(&priv->lock, flags);
+	priv->rx_coal_usecs = coal->rx_coalesce_usecs;
+	priv->tx_coal_usecs = coal->tx_coalesce_usecs;
+	priv->coal_adaptive = coal->use_adaptive_rx_coalesce;
+	priv->coal_stamp = jiffies;
+	priv->coal_frames = 0;
+
+	/* registers are only clocked while the interface is up */
+	if (netif_running(ndev))
+		cpsw_set_pacing(priv);
+	spin_unlock_irqrestore(&priv->lock, flags);
+	return 0;
+}
+
 static const struct ethtool_ops cpsw_ethtool_ops = {
 	.get_drvinfo	= cpsw_get_drvinfo,
 	.get_msglevel	= cpsw_get_msglevel,
 	.set_msglevel	= cpsw_set_msglevel,
 	.get_link	= ethtool_op_get_link,
+	.get_coalesce	= cpsw_get_coalesce,
+	.set_coalesce	= cpsw_set_coalesce,
 };
 
 static void cpsw_slave_init(struct cpsw_slave *slave, struct cpsw_priv *priv)
@@ -849,6 +1457,25 @@ static void cpsw_slave_init(struct cpsw_slave *slave, struct cpsw_priv *priv)
 	slave->sliver	= regs + data->sliver_reg_ofs;
 }
 
+/*
+ * Tear down the queue channels before the controller: cpdma_ctlr_destroy()
+ * holds the controller lock and cannot destroy them itself.  Channels that
+ * were never (or only partially) created are skipped.
+ */
+static void cpsw_destroy_channels(struct cpsw_priv *priv)
+{
+	struct cpsw_queue *queue;
+
+	for_each_queue(priv, queue) {
+		if (!IS_ERR_OR_NULL(queue->txch))
+			cpdma_chan_destroy(queue->txch);
+		if (!IS_ERR_OR_NULL(queue->rxch))
+			cpdma_chan_destroy(queue->rxch);
+		queue->txch = NULL;
+		queue->rxch = NULL;
+	}
+}
+
 static int __devinit cpsw_probe(struct platform_device *pdev)
 {
 	struct cpsw_platform_data	*data = pdev->dev.platform_data;
@@ -865,7 +1492,7 @@ static int __devinit cpsw_probe(struct platform_device *pdev)
 		return -ENODEV;
 	}
 
-	ndev = alloc_etherdev(sizeof(struct cpsw_priv));
+	ndev = alloc_etherdev_mq(sizeof(struct cpsw_priv), CPSW_MAX_QUEUES);
 	if (!ndev) {
 		pr_err("cpsw: error allocating net_device\n");
 		return -ENOMEM;
@@ -879,7 +1506,13 @@ static int __devinit cpsw_probe(struct platform_device *pdev)
 	priv->ndev = ndev;
 	priv->dev  = &ndev->dev;
 	priv->msg_enable = netif_msg_init(debug_level, CPSW_DEBUG);
-	priv->rx_packet_max = max(rx_packet_max, 128);
+	priv->rx_packet_max = clamp_t(int, rx_packet_max, 128, PAGE_SIZE);
+	priv->num_queues = clamp_t(int, queues, 1,
+				   min(data->channels, CPSW_MAX_QUEUES));
+
+	/* spread the eight priorities evenly, highest to the last queue */
+	for (i = 0; i < CPSW_NUM_PRIO; i++)
+		priv->prio_map[i] = i * priv->num_queues / CPSW_NUM_PRIO;
 
 	if (is_valid_ether_addr(data->mac_addr))
 		memcpy(priv->mac_addr, data->mac_addr, ETH_ALEN);
@@ -988,15 +1621,28 @@ static int __devinit cpsw_probe(struct platform_device *pdev)
 		goto clean_iomap_ret;
 	}
 
-	priv->txch = cpdma_chan_create(priv->dma, tx_chan_num(0),
-				       cpsw_tx_handler);
-	priv->rxch = cpdma_chan_create(priv->dma, rx_chan_num(0),
-				       cpsw_rx_handler);
+	for (i = 0; i < priv->num_queues; i++) {
+		struct cpsw_queue *queue = &priv->queues[i];
+
+		queue->priv = priv;
+		queue->num = i;
+		queue->txch = cpdma_chan_create(priv->dma, tx_chan_num(i),
+						cpsw_tx_handler);
+		queue->rxch = cpdma_chan_create(priv->dma, rx_chan_num(i),
+						cpsw_rx_handler);
+
+		if (WARN_ON(IS_ERR_OR_NULL(queue->txch) ||
+			    IS_ERR_OR_NULL(queue->rxch))) {
+			dev_err(priv->dev, "error initializing dma channels\n");
+			ret = -ENOMEM;
+			goto clean_dma_ret;
+		}
 
-	if (WARN_ON(!priv->txch || !priv->rxch)) {
-		dev_err(priv->dev, "error initializing dma channels\n");
-		ret = -ENOMEM;
-		goto clean_dma_ret;
+		/* reclaim completions in bulk from cpsw_poll() */
+		cpdma_chan_set_batch_handler(queue->txch,
+					     cpsw_tx_batch_handler);
+		cpdma_chan_set_batch_handler(queue->rxch,
+					     cpsw_rx_batch_handler);
 	}
 
 	memset(&ale_params, 0, sizeof(ale_params));
@@ -1039,7 +1685,11 @@ static int __devinit cpsw_probe(struct platform_device *pdev)
 
 	ndev->netdev_ops = &cpsw_netdev_ops;
 	SET_ETHTOOL_OPS(ndev, &cpsw_ethtool_ops);
-	netif_napi_add(ndev, &priv->napi, cpsw_poll, CPSW_POLL_WEIGHT);
+	for (i = 0; i < priv->num_queues; i++)
+		netif_napi_add(ndev, &priv->queues[i].napi, cpsw_poll,
+			       CPSW_POLL_WEIGHT);
+	netif_set_real_num_tx_queues(ndev, priv->num_queues);
+	netif_set_real_num_rx_queues(ndev, priv->num_queues);
 
 	/* register the network device */
 	SET_NETDEV_DEV(ndev, &pdev->dev);
@@ -1050,8 +1700,8 @@ static int __devinit cpsw_probe(struct platform_device *pdev)
 		goto clean_irq_ret;
 	}
 
-	msg(notice, probe, "initialized device (regs %x, irq %d)\n",
-	    priv->cpsw_res->start, ndev->irq);
+	msg(notice, probe, "initialized device (regs %x, irq %d, %d queues)\n",
+	    priv->cpsw_res->start, ndev->irq, priv->num_queues);
 
 	return 0;
 
@@ -1060,8 +1710,7 @@ clean_irq_ret:
 clean_ale_ret:
 	cpsw_ale_destroy(priv->ale);
 clean_dma_ret:
-	cpdma_chan_destroy(priv->txch);
-	cpdma_chan_destroy(priv->rxch);
+	cpsw_destroy_channels(priv);
 	cpdma_ctlr_destroy(priv->dma);
 clean_iomap_ret:
 	iounmap(priv->regs);
@@ -1089,8 +1738,7 @@ static int __devexit cpsw_remove(struct platform_device *pdev)
 
 	free_irq(ndev->irq, priv);
 	cpsw_ale_destroy(priv->ale);
-	cpdma_chan_destroy(priv->txch);
-	cpdma_chan_destroy(priv->rxch);
+	cpsw_destroy_channels(priv);
 	cpdma_ctlr_destroy(priv->dma);
 	iounmap(priv->regs);
 	release_mem_region(priv->cpsw_res->start, resource_size(priv->cpsw_res));
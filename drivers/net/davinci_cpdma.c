@@ -60,6 +60,9 @@
 #define CPDMA_DESC_TD_COMPLETE	BIT(27)
 #define CPDMA_DESC_PASS_CRC	BIT(26)
 
+/* software only: sw_len flag for buffers mapped by the submitter */
+#define CPDMA_DESC_SW_MAPPED	BIT(31)
+
 #define CPDMA_TEARDOWN_VALUE	0xfffffffc
 
 struct cpdma_desc {
@@ -114,6 +117,7 @@ struct cpdma_chan {
 	int				count;
 	u32				mask;
 	cpdma_handler_fn		handler;
+	cpdma_batch_handler_fn		batch_handler;
 	enum dma_data_direction		dir;
 	struct cpdma_chan_stats		stats;
 	/* offsets into dmaregs */
@@ -500,6 +504,24 @@ void cpdma_ctlr_eoi(struct cpdma_ctlr *ctlr)
 }
 EXPORT_SYMBOL(cpdma_ctlr_eoi);
 
+/*
+ * Bitmask of rx channels with an unmasked completion interrupt pending.
+ * Bits 7:0 hold the per channel completion status, the bits above are
+ * threshold interrupts.
+ */
+u32 cpdma_ctlr_rxstat(struct cpdma_ctlr *ctlr)
+{
+	return dma_reg_read(ctlr, CPDMA_RXINTSTATMASKED) & 0xff;
+}
+EXPORT_SYMBOL(cpdma_ctlr_rxstat);
+
+/* bitmask of tx channels with an unmasked interrupt pending */
+u32 cpdma_ctlr_txstat(struct cpdma_ctlr *ctlr)
+{
+	return dma_reg_read(ctlr, CPDMA_TXINTSTATMASKED) & 0xff;
+}
+EXPORT_SYMBOL(cpdma_ctlr_txstat);
+
 struct cpdma_chan *cpdma_chan_create(struct cpdma_ctlr *ctlr, int chan_num,
 				     cpdma_handler_fn handler)
 {
@@ -588,6 +610,25 @@ int cpdma_chan_get_stats(struct cpdma_chan *chan,
 }
 EXPORT_SYMBOL(cpdma_chan_get_stats);
 
+/*
+ * With a batch handler installed, cpdma_chan_process() reclaims up to
+ * CPDMA_BATCH descriptors per chan->lock round trip and hands them over
+ * in one call.  The per-buffer handler is still used on teardown.
+ */
+int cpdma_chan_set_batch_handler(struct cpdma_chan *chan,
+				 cpdma_batch_handler_fn handler)
+{
+	unsigned long flags;
+
+	if (!chan)
+		return -EINVAL;
+	spin_lock_irqsave(&chan->lock, flags);
+	chan->batch_handler = handler;
+	spin_unlock_irqrestore(&chan->lock, flags);
+	return 0;
+}
+EXPORT_SYMBOL(cpdma_chan_set_batch_handler);
+
 int cpdma_chan_dump(struct cpdma_chan *chan)
 {
 	unsigned long flags;
@@ -636,8 +677,10 @@ int cpdma_chan_dump(struct cpdma_chan *chan)
 	return 0;
 }
 
+/* queue the chain desc..last, already linked through hw_next/sw_next */
 static void __cpdma_chan_submit(struct cpdma_chan *chan,
-				struct cpdma_desc __iomem *desc)
+				struct cpdma_desc __iomem *desc,
+				struct cpdma_desc __iomem *last)
 {
 	struct cpdma_ctlr		*ctlr = chan->ctlr;
 	struct cpdma_desc __iomem	*prev = chan->tail;
@@ -651,7 +694,7 @@ static void __cpdma_chan_submit(struct cpdma_chan *chan,
 	if (!chan->head) {
 		chan->stats.head_enqueue++;
 		chan->head = desc;
-		chan->tail = desc;
+		chan->tail = last;
 		if (chan->state == CPDMA_STATE_ACTIVE)
 			chan_write(chan, hdp, desc_dma);
 		return;
@@ -660,7 +703,7 @@ static void __cpdma_chan_submit(struct cpdma_chan *chan,
 	/* first chain the descriptor at the tail of the list */
 	desc_write(prev, hw_next, desc_dma);
 	desc_write(prev, sw_next,desc_dma);
-	chan->tail = desc;
+	chan->tail = last;
 	chan->stats.tail_enqueue++;
 
 	/* next check if EOQ has been triggered already */
@@ -673,15 +716,23 @@ static void __cpdma_chan_submit(struct cpdma_chan *chan,
 	}
 }
 
-int cpdma_chan_submit(struct cpdma_chan *chan, void *token, void *data,
-		      int len, gfp_t gfp_mask)
+/*
+ * Queue up to num buffers with a single chan->lock round trip.  The
+ * descriptors are chained among themselves first and then appended to the
+ * channel, so the head descriptor pointer (and rx free count) is written
+ * at most once for the whole batch.  Returns the number of buffers queued,
+ * which may be short of num when descriptors run out.
+ */
+int cpdma_chan_submit_bulk(struct cpdma_chan *chan, struct cpdma_buf *bufs,
+			   int num, gfp_t gfp_mask)
 {
 	struct cpdma_ctlr		*ctlr = chan->ctlr;
-	struct cpdma_desc __iomem	*desc;
-	dma_addr_t			buffer;
+	struct cpdma_desc_pool		*pool = ctlr->pool;
+	struct cpdma_desc __iomem	*desc, *first = NULL, *last = NULL;
+	dma_addr_t			buffer, desc_dma;
 	unsigned long			flags;
-	u32				mode;
-	int				ret = 0;
+	u32				mode, sw_len;
+	int				i, len, ret = 0;
 	bool                            is_rx;
 
 	spin_lock_irqsave(&chan->lock, flags);
@@ -692,59 +743,117 @@ int cpdma_chan_submit(struct cpdma_chan *chan, void *token, void *data,
 	}
 
 	is_rx = (chan->rxfree != 0);
-	desc = cpdma_desc_alloc(ctlr->pool, 1, is_rx);
-	if (!desc) {
-		chan->stats.desc_alloc_fail++;
-		ret = -ENOMEM;
-		goto unlock_ret;
-	}
+	mode = CPDMA_DESC_OWNER | CPDMA_DESC_SOP | CPDMA_DESC_EOP;
 
-	if (len < ctlr->params.min_packet_size) {
-		len = ctlr->params.min_packet_size;
-		chan->stats.runt_transmit_buff++;
-	}
+	for (i = 0; i < num; i++) {
+		desc = cpdma_desc_alloc(pool, 1, is_rx);
+		if (!desc) {
+			chan->stats.desc_alloc_fail++;
+			break;
+		}
 
-	buffer = dma_map_single(ctlr->dev, data, len, chan->dir);
-	mode = CPDMA_DESC_OWNER | CPDMA_DESC_SOP | CPDMA_DESC_EOP;
+		len = bufs[i].len;
+		if (len < ctlr->params.min_packet_size) {
+			len = ctlr->params.min_packet_size;
+			chan->stats.runt_transmit_buff++;
+		}
+
+		if (bufs[i].dma) {
+			buffer = bufs[i].dma;
+			dma_sync_single_for_device(ctlr->dev, buffer, len,
+						   chan->dir);
+			sw_len = len | CPDMA_DESC_SW_MAPPED;
+		} else {
+			buffer = dma_map_single(ctlr->dev, bufs[i].data, len,
+						chan->dir);
+			sw_len = len;
+		}
+
+		desc_write(desc, hw_next,   0);
+		desc_write(desc, sw_next,   0);
+		desc_write(desc, hw_buffer, buffer);
+		desc_write(desc, hw_len,    len);
+		desc_write(desc, hw_mode,   mode | len);
+		desc_write(desc, sw_token,  bufs[i].token);
+		desc_write(desc, sw_buffer, buffer);
+		desc_write(desc, sw_len,    sw_len);
+
+		if (last) {
+			desc_dma = desc_phys(pool, desc);
+			desc_write(last, hw_next, desc_dma);
+			desc_write(last, sw_next, desc_dma);
+		} else {
+			first = desc;
+		}
+		last = desc;
+	}
 
-	desc_write(desc, hw_next,   0);
-	desc_write(desc, sw_next,   0);
-	desc_write(desc, hw_buffer, buffer);
-	desc_write(desc, hw_len,    len);
-	desc_write(desc, hw_mode,   mode | len);
-	desc_write(desc, sw_token,  token);
-	desc_write(desc, sw_buffer, buffer);
-	desc_write(desc, sw_len,    len);
+	if (!first) {
+		ret = -ENOMEM;
+		goto unlock_ret;
+	}
 
-	__cpdma_chan_submit(chan, desc);
+	__cpdma_chan_submit(chan, first, last);
 
 	if (chan->state == CPDMA_STATE_ACTIVE && chan->rxfree)
-		chan_write(chan, rxfree, 1);
+		chan_write(chan, rxfree, i);
 
-	chan->count++;
+	chan->count += i;
+	ret = i;
 
 unlock_ret:
 	spin_unlock_irqrestore(&chan->lock, flags);
 	return ret;
 }
+EXPORT_SYMBOL(cpdma_chan_submit_bulk);
+
+int cpdma_chan_submit(struct cpdma_chan *chan, void *token, void *data,
+		      int len, gfp_t gfp_mask)
+{
+	struct cpdma_buf buf = {
+		.token	= token,
+		.data	= data,
+		.dma	= 0,
+		.len	= len,
+	};
+	int ret;
+
+	ret = cpdma_chan_submit_bulk(chan, &buf, 1, gfp_mask);
+	return ret < 0 ? ret : 0;
+}
 EXPORT_SYMBOL(cpdma_chan_submit);
 
-static void __cpdma_chan_free(struct cpdma_chan *chan,
-			      struct cpdma_desc __iomem *desc,
-			      int outlen, int status)
+/* unmap the buffer and release the descriptor, returning its token */
+static void *__cpdma_chan_release(struct cpdma_chan *chan,
+				  struct cpdma_desc __iomem *desc)
 {
 	struct cpdma_ctlr		*ctlr = chan->ctlr;
 	struct cpdma_desc_pool		*pool = ctlr->pool;
 	dma_addr_t			buff_dma;
-	int				origlen;
+	u32				origlen;
 	void				*token;
 
 	token      = (void *)desc_read(desc, sw_token);
 	buff_dma   = desc_read(desc, sw_buffer);
 	origlen    = desc_read(desc, sw_len);
 
-	dma_unmap_single(ctlr->dev, buff_dma, origlen, chan->dir);
+	if (origlen & CPDMA_DESC_SW_MAPPED)
+		dma_sync_single_for_cpu(ctlr->dev, buff_dma,
+					origlen & ~CPDMA_DESC_SW_MAPPED,
+					chan->dir);
+	else
+		dma_unmap_single(ctlr->dev, buff_dma, origlen, chan->dir);
 	cpdma_desc_free(pool, desc, 1);
+	return token;
+}
+
+static void __cpdma_chan_free(struct cpdma_chan *chan,
+			      struct cpdma_desc __iomem *desc,
+			      int outlen, int status)
+{
+	void				*token;
+
+	token = __cpdma_chan_release(chan, desc);
 	(*chan->handler)(token, outlen, status);
 }
 
@@ -796,6 +905,75 @@ unlock_ret:
 	return status;
 }
 
+/*
+ * Reclaim up to min(quota, CPDMA_BATCH) completed descriptors under one
+ * chan->lock hold, acknowledging the last one only, then release them and
+ * pass the lot to the batch handler.  Returns the number reclaimed.
+ */
+static int __cpdma_chan_process_bulk(struct cpdma_chan *chan, int quota)
+{
+	struct cpdma_ctlr		*ctlr = chan->ctlr;
+	struct cpdma_desc_pool		*pool = ctlr->pool;
+	struct cpdma_desc __iomem	*descs[CPDMA_BATCH];
+	struct cpdma_done		done[CPDMA_BATCH];
+	struct cpdma_desc __iomem	*desc;
+	dma_addr_t			desc_dma = 0;
+	unsigned long			flags;
+	u32				status;
+	int				i, num;
+
+	if (quota > CPDMA_BATCH)
+		quota = CPDMA_BATCH;
+
+	spin_lock_irqsave(&chan->lock, flags);
+
+	for (num = 0; num < quota; num++) {
+		desc = chan->head;
+		if (!desc) {
+			chan->stats.empty_dequeue++;
+			break;
+		}
+
+		status = __raw_readl(&desc->hw_mode);
+		if (status & CPDMA_DESC_OWNER) {
+			chan->stats.busy_dequeue++;
+			break;
+		}
+		desc_dma = desc_phys(pool, desc);
+
+		done[num].len	 = status & 0x7ff;
+		status		 = status & (CPDMA_DESC_EOQ |
+					     CPDMA_DESC_TD_COMPLETE);
+		done[num].status = status;
+		descs[num]	 = desc;
+
+		chan->head = desc_from_phys(pool, desc_read(desc, sw_next));
+
+		if ((status & CPDMA_DESC_EOQ) && (chan->head) &&
+		    (!(status & CPDMA_DESC_TD_COMPLETE))) {
+			chan->stats.requeue++;
+			chan_write(chan, hdp, desc_phys(pool, chan->head));
+		}
+	}
+
+	if (num) {
+		chan_write(chan, cp, desc_dma);
+		chan->count -= num;
+		chan->stats.good_dequeue += num;
+	}
+
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	if (!num)
+		return 0;
+
+	for (i = 0; i < num; i++)
+		done[i].token = __cpdma_chan_release(chan, descs[i]);
+	(*chan->batch_handler)(done, num);
+
+	return num;
+}
+
 int cpdma_chan_process(struct cpdma_chan *chan, int quota)
 {
 	int used = 0, ret = 0;
@@ -803,6 +981,14 @@ int cpdma_chan_process(struct cpdma_chan *chan, int quota)
 	if (chan->state != CPDMA_STATE_ACTIVE)
 		return -EINVAL;
 
+	while (chan->batch_handler && used < quota) {
+		ret = __cpdma_chan_process_bulk(chan, quota - used);
+		used += ret;
+		/* a short batch means the channel ran dry */
+		if (ret < CPDMA_BATCH)
+			return used;
+	}
+
 	while (used < quota) {
 		ret = __cpdma_chan_process(chan);
 		if (ret < 0)
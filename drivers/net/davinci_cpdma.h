@@ -61,10 +61,33 @@ struct cpdma_chan_stats {
 	u32			teardown_dequeue;
 };
 
+/* largest number of buffers handed to a batch handler in one call */
+#define CPDMA_BATCH		16
+
+/*
+ * A buffer queued through cpdma_chan_submit_bulk().  Callers that keep
+ * their buffers DMA mapped across submissions pass the mapping in dma;
+ * cpdma then only syncs it instead of mapping and unmapping data.
+ */
+struct cpdma_buf {
+	void			*token;
+	void			*data;
+	dma_addr_t		dma;
+	int			len;
+};
+
+/* a completed buffer handed to a cpdma_batch_handler_fn */
+struct cpdma_done {
+	void			*token;
+	int			len;
+	int			status;
+};
+
 struct cpdma_ctlr;
 struct cpdma_chan;
 
 typedef void (*cpdma_handler_fn)(void *token, int len, int status);
+typedef void (*cpdma_batch_handler_fn)(struct cpdma_done *done, int num);
 
 struct cpdma_ctlr *cpdma_ctlr_create(struct cpdma_params *params);
 int cpdma_ctlr_destroy(struct cpdma_ctlr *ctlr);
@@ -78,15 +101,21 @@ int cpdma_chan_destroy(struct cpdma_chan *chan);
 int cpdma_chan_start(struct cpdma_chan *chan);
 int cpdma_chan_stop(struct cpdma_chan *chan);
 int cpdma_chan_dump(struct cpdma_chan *chan);
+int cpdma_chan_set_batch_handler(struct cpdma_chan *chan,
+				 cpdma_batch_handler_fn handler);
 
 int cpdma_chan_get_stats(struct cpdma_chan *chan,
 			 struct cpdma_chan_stats *stats);
 int cpdma_chan_submit(struct cpdma_chan *chan, void *token, void *data,
 		      int len, gfp_t gfp_mask);
+int cpdma_chan_submit_bulk(struct cpdma_chan *chan, struct cpdma_buf *bufs,
+			   int num, gfp_t gfp_mask);
 int cpdma_chan_process(struct cpdma_chan *chan, int quota);
 
 int cpdma_ctlr_int_ctrl(struct cpdma_ctlr *ctlr, bool enable);
 void cpdma_ctlr_eoi(struct cpdma_ctlr *ctlr);
+u32 cpdma_ctlr_rxstat(struct cpdma_ctlr *ctlr);
+u32 cpdma_ctlr_txstat(struct cpdma_ctlr *ctlr);
 int cpdma_chan_int_ctrl(struct cpdma_chan *chan, bool enable);
 
 enum cpdma_control {
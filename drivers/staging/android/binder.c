@@ -19,25 +19,56 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
+#include <linux/mman.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/nsproxy.h>
 #include <linux/poll.h>
 #include <linux/debugfs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+/*
+ * Locking
+ *
+ * binder_procs_lock is held shared by every ioctl and poll, and exclusively
+ * by anything that frees a proc or a thread, sets the context manager or
+ * walks all procs (deferred work, BINDER_THREAD_EXIT, debugfs).  While it
+ * is held shared, procs, threads and binder_context_mgr_node stay put and
+ * node->proc does not change.
+ *
+ * proc->lock protects the state owned by a proc: its threads and their
+ * transaction stacks, its nodes tree and node userspace state, its refs,
+ * its buffers and its statistics.  A transaction holds the locks of the
+ * sending and the target proc; two proc locks are always taken in address
+ * order, see binder_lock_target().
+ *
+ * node->lock protects the reference counts of a node and its refs list,
+ * which refs held by any proc update.
+ *
+ * proc->inner_lock protects the todo lists of a proc and of its threads,
+ * the delivered_death list and the linkage of every binder_work queued on
+ * them, since dropping the last reference to a node queues its work to
+ * the owner from whatever proc dropped it.
+ *
+ * Lock order: binder_procs_lock, proc->lock (by address), node->lock,
+ * proc->inner_lock, binder_dead_nodes_lock.
+ */
+static DECLARE_RWSEM(binder_procs_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DEFINE_SPINLOCK(binder_dead_nodes_lock);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
@@ -47,7 +78,7 @@ static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_DEBUG_ENTRY(name) \
@@ -146,22 +177,44 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
+/*
+ * Buffer allocation latency histogram: bucket 0 counts allocations under
+ * 1us, bucket i those taking [2^(i-1), 2^i) us, the last one everything
+ * slower.
+ */
+#define BINDER_ALLOC_LAT_BUCKETS	12
+
+struct binder_alloc_stats {
+	int allocs;
+	int failures;
+	int pages;		/* pages currently populated */
+	int reserve_hits;	/* pages taken from the reserve */
+	int reserve_misses;	/* pages allocated under proc->lock */
+	int latency[BINDER_ALLOC_LAT_BUCKETS];
+};
+
+/*
+ * Upper bound on the pages a proc keeps allocated ahead of time so that
+ * page allocation for its incoming buffers happens outside its lock.
+ */
+#define BINDER_PAGE_RESERVE_MAX		32
+
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
 struct binder_transaction_log_entry {
@@ -183,11 +236,14 @@ struct binder_transaction_log {
 };
 static struct binder_transaction_log binder_transaction_log;
 static struct binder_transaction_log binder_transaction_log_failed;
+static DEFINE_SPINLOCK(binder_transaction_log_lock);
 
 static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
+
+	spin_lock(&binder_transaction_log_lock);
 	e = &log->entry[log->next];
 	memset(e, 0, sizeof(*e));
 	log->next++;
@@ -195,6 +251,7 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 		log->next = 0;
 		log->full = 1;
 	}
+	spin_unlock(&binder_transaction_log_lock);
 	return e;
 }
 
@@ -212,6 +269,7 @@ struct binder_work {
 
 struct binder_node {
 	int debug_id;
+	spinlock_t lock;
 	struct binder_work work;
 	union {
 		struct rb_node rb_node;
@@ -281,6 +339,8 @@ enum binder_deferred_state {
 
 struct binder_proc {
 	struct hlist_node proc_node;
+	struct mutex lock;
+	spinlock_t inner_lock;
 	struct rb_root threads;
 	struct rb_root nodes;
 	struct rb_root refs_by_desc;
@@ -302,6 +362,11 @@ struct binder_proc {
 	struct page **pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	spinlock_t page_reserve_lock;
+	struct list_head page_reserve;	/* zeroed or recycled pages */
+	int page_reserve_count;
+	int page_reserve_want;
+	struct binder_alloc_stats alloc_stats;
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
@@ -607,15 +672,109 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+/*
+ * Take a page for the buffer area.  Called under proc->lock, so prefer the
+ * reserve filled by binder_refill_page_reserve() and only fall back to the
+ * page allocator when it has run dry.
+ */
+static struct page *binder_get_page(struct binder_proc *proc)
+{
+	struct page *page = NULL;
+
+	spin_lock(&proc->page_reserve_lock);
+	if (!list_empty(&proc->page_reserve)) {
+		page = list_first_entry(&proc->page_reserve, struct page, lru);
+		list_del(&page->lru);
+		proc->page_reserve_count--;
+	}
+	spin_unlock(&proc->page_reserve_lock);
+
+	if (page) {
+		proc->alloc_stats.reserve_hits++;
+		return page;
+	}
+	proc->alloc_stats.reserve_misses++;
+	return alloc_page(GFP_KERNEL | __GFP_ZERO);
+}
+
+/*
+ * Give a page back from the buffer area.  It only ever held data of buffers
+ * delivered to this proc, so it can be recycled without clearing it - but
+ * only if nobody else still holds a reference (get_user_pages(), a pending
+ * direct I/O, ...).  Such a page is dropped instead of being handed out
+ * again while someone may still read or write it.
+ */
+static void binder_put_page(struct binder_proc *proc, struct page *page)
+{
+	spin_lock(&proc->page_reserve_lock);
+	if (page_count(page) == 1 &&
+	    proc->page_reserve_count < proc->page_reserve_want) {
+		list_add(&page->lru, &proc->page_reserve);
+		proc->page_reserve_count++;
+		page = NULL;
+	}
+	spin_unlock(&proc->page_reserve_lock);
+
+	if (page)
+		__free_page(page);
+}
+
+/*
+ * Top up the page reserve to the size of the largest recent allocation.
+ * Runs from binder_ioctl() before any binder lock is taken, so the looper
+ * threads of a proc receiving large parcels pay for zeroing its pages
+ * without stalling every other transaction in the system.
+ */
+static void binder_refill_page_reserve(struct binder_proc *proc)
+{
+	struct page *page;
+
+	while (proc->page_reserve_count < proc->page_reserve_want) {
+		page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (page == NULL)
+			return;
+
+		spin_lock(&proc->page_reserve_lock);
+		if (proc->page_reserve_count < proc->page_reserve_want) {
+			list_add(&page->lru, &proc->page_reserve);
+			proc->page_reserve_count++;
+			page = NULL;
+		}
+		spin_unlock(&proc->page_reserve_lock);
+
+		/* another thread of the proc got there first */
+		if (page) {
+			__free_page(page);
+			return;
+		}
+	}
+}
+
+static void binder_drain_page_reserve(struct binder_proc *proc)
+{
+	struct page *page, *tmp;
+
+	spin_lock(&proc->page_reserve_lock);
+	proc->page_reserve_want = 0;
+	list_for_each_entry_safe(page, tmp, &proc->page_reserve, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+	proc->page_reserve_count = 0;
+	spin_unlock(&proc->page_reserve_lock);
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
 {
-	void *page_addr;
-	unsigned long user_page_addr;
+	unsigned long user_start;
 	struct vm_struct tmp_area;
-	struct page **page;
+	struct page **pages;
+	struct page **page_array_ptr;
 	struct mm_struct *mm;
+	int nr_pages, i, mapped;
+	int ret;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -624,6 +783,10 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	nr_pages = (end - start) / PAGE_SIZE;
+	pages = &proc->pages[(start - proc->buffer) / PAGE_SIZE];
+	user_start = (uintptr_t)start + proc->user_buffer_offset;
+
 	if (vma)
 		mm = NULL;
 	else
@@ -643,39 +806,45 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		goto err_no_vma;
 	}
 
-	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
-		int ret;
-		struct page **page_array_ptr;
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+	if (nr_pages > proc->page_reserve_want)
+		proc->page_reserve_want = min(nr_pages,
+					      BINDER_PAGE_RESERVE_MAX);
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+	for (i = 0; i < nr_pages; i++) {
+		BUG_ON(pages[i]);
+		pages[i] = binder_get_page(proc);
+		if (pages[i] == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "for page at %p\n", proc->pid, page_addr);
+			       "for page at %p\n", proc->pid,
+			       start + i * PAGE_SIZE);
 			goto err_alloc_page_failed;
 		}
-		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
-		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
-			       proc->pid, page_addr);
-			goto err_map_kernel_failed;
-		}
-		user_page_addr =
-			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+	}
+
+	/* one kernel mapping for the whole range */
+	tmp_area.addr = start;
+	tmp_area.size = end - start + PAGE_SIZE /* guard page? */;
+	page_array_ptr = pages;
+	ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
+	if (ret) {
+		printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
+		       "to map pages at %p in kernel\n",
+		       proc->pid, start);
+		goto err_map_kernel_failed;
+	}
+
+	for (mapped = 0; mapped < nr_pages; mapped++) {
+		ret = vm_insert_page(vma, user_start + mapped * PAGE_SIZE,
+				     pages[mapped]);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
-			       proc->pid, user_page_addr);
+			       proc->pid, user_start + mapped * PAGE_SIZE);
 			goto err_vm_insert_page_failed;
 		}
 		/* vm_insert_page does not seem to increment the refcount */
 	}
+	proc->alloc_stats.pages += nr_pages;
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
@@ -683,19 +852,19 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	return 0;
 
 free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
+	proc->alloc_stats.pages -= nr_pages;
+	mapped = nr_pages;
+	i = nr_pages;
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	if (vma && mapped)
+		zap_page_range(vma, user_start, mapped * PAGE_SIZE, NULL);
+	unmap_kernel_range((unsigned long)start, end - start);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	i = nr_pages;
 err_alloc_page_failed:
-		;
+	while (i--) {
+		binder_put_page(proc, pages[i]);
+		pages[i] = NULL;
 	}
 err_no_vma:
 	if (mm) {
@@ -705,9 +874,10 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -811,6 +981,27 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_alloc_stats *stats = &proc->alloc_stats;
+	struct binder_buffer *buffer;
+	ktime_t start;
+	s64 usecs;
+
+	start = ktime_get();
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+	usecs = ktime_us_delta(ktime_get(), start);
+
+	stats->allocs++;
+	if (buffer == NULL)
+		stats->failures++;
+	stats->latency[min_t(int, fls64(usecs), BINDER_ALLOC_LAT_BUCKETS - 1)]++;
+
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -923,6 +1114,64 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_enqueue_work(struct binder_proc *proc,
+				struct binder_work *work,
+				struct list_head *target_list)
+{
+	spin_lock(&proc->inner_lock);
+	list_add_tail(&work->entry, target_list);
+	spin_unlock(&proc->inner_lock);
+}
+
+static void binder_dequeue_work(struct binder_proc *proc,
+				struct binder_work *work)
+{
+	spin_lock(&proc->inner_lock);
+	list_del_init(&work->entry);
+	spin_unlock(&proc->inner_lock);
+}
+
+static struct binder_work *binder_peek_work(struct binder_proc *proc,
+					    struct list_head *list)
+{
+	struct binder_work *w = NULL;
+
+	spin_lock(&proc->inner_lock);
+	if (!list_empty(list))
+		w = list_first_entry(list, struct binder_work, entry);
+	spin_unlock(&proc->inner_lock);
+	return w;
+}
+
+/*
+ * Take target->lock for a transaction from proc, whose lock the caller
+ * holds.  Proc locks nest in address order, so when target sorts first
+ * proc->lock is dropped and retaken around it: anything the caller looked
+ * up under proc->lock and still needs afterwards must be pinned first.
+ */
+static void binder_lock_target(struct binder_proc *proc,
+			       struct binder_proc *target)
+{
+	if (target == proc)
+		return;
+	if (target > proc) {
+		mutex_lock_nested(&target->lock, SINGLE_DEPTH_NESTING);
+		return;
+	}
+	if (mutex_trylock(&target->lock))
+		return;
+	mutex_unlock(&proc->lock);
+	mutex_lock(&target->lock);
+	mutex_lock_nested(&proc->lock, SINGLE_DEPTH_NESTING);
+}
+
+static void binder_unlock_target(struct binder_proc *proc,
+				 struct binder_proc *target)
+{
+	if (target != proc)
+		mutex_unlock(&target->lock);
+}
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -966,9 +1215,10 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	if (node == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_NODE);
+	spin_lock_init(&node->lock);
 	rb_link_node(&node->rb_node, parent, p);
 	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
@@ -982,9 +1232,16 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
+/*
+ * A non-NULL target_list is always a todo list of node->proc, which the
+ * caller has locked.
+ */
 static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			   struct list_head *target_list)
 {
+	int ret = 0;
+
+	spin_lock(&node->lock);
 	if (strong) {
 		if (internal) {
 			if (target_list == NULL &&
@@ -993,70 +1250,111 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			    node->has_strong_ref)) {
 				printk(KERN_ERR "binder: invalid inc strong "
 					"node for %d\n", node->debug_id);
-				return -EINVAL;
+				ret = -EINVAL;
+				goto out;
 			}
 			node->internal_strong_refs++;
 		} else
 			node->local_strong_refs++;
 		if (!node->has_strong_ref && target_list) {
+			spin_lock(&node->proc->inner_lock);
 			list_del_init(&node->work.entry);
 			list_add_tail(&node->work.entry, target_list);
+			spin_unlock(&node->proc->inner_lock);
 		}
 	} else {
 		if (!internal)
 			node->local_weak_refs++;
-		if (!node->has_weak_ref && list_empty(&node->work.entry)) {
-			if (target_list == NULL) {
-				printk(KERN_ERR "binder: invalid inc weak node "
-					"for %d\n", node->debug_id);
-				return -EINVAL;
+		if (!node->has_weak_ref && node->proc) {
+			spin_lock(&node->proc->inner_lock);
+			if (list_empty(&node->work.entry)) {
+				if (target_list)
+					list_add_tail(&node->work.entry,
+						      target_list);
+				else
+					ret = -EINVAL;
 			}
-			list_add_tail(&node->work.entry, target_list);
+			spin_unlock(&node->proc->inner_lock);
+		} else if (!node->has_weak_ref) {
+			ret = -EINVAL;
 		}
+		if (ret)
+			printk(KERN_ERR "binder: invalid inc weak node "
+				"for %d\n", node->debug_id);
 	}
-	return 0;
+out:
+	spin_unlock(&node->lock);
+	return ret;
 }
 
-static int binder_dec_node(struct binder_node *node, int strong, int internal)
+/*
+ * Drop a reference with node->lock held.  A node whose owner is alive is
+ * only ever removed from the owner's tree by the owner, so here its work
+ * is queued for binder_thread_read() to report the change or delete it.
+ * Returns true if the node is dead and unreferenced, in which case the
+ * caller frees it after dropping the lock.
+ */
+static bool binder_dec_node_locked(struct binder_node *node, int strong,
+				   int internal)
 {
+	struct binder_proc *proc = node->proc;
+	bool unused;
+
 	if (strong) {
 		if (internal)
 			node->internal_strong_refs--;
 		else
 			node->local_strong_refs--;
 		if (node->local_strong_refs || node->internal_strong_refs)
-			return 0;
+			return false;
 	} else {
 		if (!internal)
 			node->local_weak_refs--;
 		if (node->local_weak_refs || !hlist_empty(&node->refs))
-			return 0;
+			return false;
 	}
-	if (node->proc && (node->has_strong_ref || node->has_weak_ref)) {
+	unused = hlist_empty(&node->refs) && !node->local_strong_refs &&
+		 !node->local_weak_refs;
+
+	if (proc) {
+		if (!node->has_strong_ref && !node->has_weak_ref && !unused)
+			return false;
+		spin_lock(&proc->inner_lock);
 		if (list_empty(&node->work.entry)) {
-			list_add_tail(&node->work.entry, &node->proc->todo);
-			wake_up_interruptible(&node->proc->wait);
-		}
-	} else {
-		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
-		    !node->local_weak_refs) {
-			list_del_init(&node->work.entry);
-			if (node->proc) {
-				rb_erase(&node->rb_node, &node->proc->nodes);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: refless node %d deleted\n",
-					     node->debug_id);
-			} else {
-				hlist_del(&node->dead_node);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: dead node %d deleted\n",
-					     node->debug_id);
-			}
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
+			list_add_tail(&node->work.entry, &proc->todo);
+			wake_up_interruptible(&proc->wait);
 		}
+		spin_unlock(&proc->inner_lock);
+		return false;
 	}
 
+	if (!unused)
+		return false;
+	spin_lock(&binder_dead_nodes_lock);
+	hlist_del(&node->dead_node);
+	spin_unlock(&binder_dead_nodes_lock);
+	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+		     "binder: dead node %d deleted\n",
+		     node->debug_id);
+	return true;
+}
+
+static void binder_free_node(struct binder_node *node)
+{
+	kfree(node);
+	binder_stats_deleted(BINDER_STAT_NODE);
+}
+
+static int binder_dec_node(struct binder_node *node, int strong, int internal)
+{
+	bool free_node;
+
+	spin_lock(&node->lock);
+	free_node = binder_dec_node_locked(node, strong, internal);
+	spin_unlock(&node->lock);
+	if (free_node)
+		binder_free_node(node);
+
 	return 0;
 }
 
@@ -1103,7 +1401,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1132,7 +1430,9 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	rb_link_node(&new_ref->rb_node_desc, parent, p);
 	rb_insert_color(&new_ref->rb_node_desc, &proc->refs_by_desc);
 	if (node) {
+		spin_lock(&node->lock);
 		hlist_add_head(&new_ref->node_entry, &node->refs);
+		spin_unlock(&node->lock);
 
 		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 			     "binder: %d new ref %d desc %d for "
@@ -1149,23 +1449,30 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 
 static void binder_delete_ref(struct binder_ref *ref)
 {
+	struct binder_node *node = ref->node;
+	bool free_node;
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d delete ref %d desc %d for "
 		     "node %d\n", ref->proc->pid, ref->debug_id,
-		     ref->desc, ref->node->debug_id);
+		     ref->desc, node->debug_id);
 
 	rb_erase(&ref->rb_node_desc, &ref->proc->refs_by_desc);
 	rb_erase(&ref->rb_node_node, &ref->proc->refs_by_node);
+	spin_lock(&node->lock);
 	if (ref->strong)
-		binder_dec_node(ref->node, 1, 1);
+		binder_dec_node_locked(node, 1, 1);
 	hlist_del(&ref->node_entry);
-	binder_dec_node(ref->node, 0, 1);
+	free_node = binder_dec_node_locked(node, 0, 1);
+	spin_unlock(&node->lock);
+	if (free_node)
+		binder_free_node(node);
 	if (ref->death) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
-		list_del(&ref->death->work.entry);
+		binder_dequeue_work(ref->proc, &ref->death->work);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1300,6 +1607,25 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	}
 }
 
+/*
+ * Fail t, whose sender is gone, from a context holding proc->lock but not
+ * the lock of any other proc.  The error has to travel up the chain of
+ * callers, which may span any number of procs, so it is passed on with
+ * binder_procs_lock held exclusively.  t is already off the stack of the
+ * replying thread and only reachable through that chain.
+ */
+static void binder_send_dead_reply(struct binder_proc *proc,
+				   struct binder_transaction *t,
+				   uint32_t error_code)
+{
+	mutex_unlock(&proc->lock);
+	up_read(&binder_procs_lock);
+	down_write(&binder_procs_lock);
+	binder_send_failed_reply(t, error_code);
+	downgrade_write(&binder_procs_lock);
+	mutex_lock(&proc->lock);
+}
+
 static void binder_transaction_buffer_release(struct binder_proc *proc,
 					      struct binder_buffer *buffer,
 					      size_t *failed_at)
@@ -1361,6 +1687,7 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 		} break;
 
 		case BINDER_TYPE_FD:
+		case BINDER_TYPE_FD_REGION:
 			binder_debug(BINDER_DEBUG_TRANSACTION,
 				     "        fd %ld\n", fp->handle);
 			if (failed_at)
@@ -1375,6 +1702,51 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+/*
+ * Map the fd regions of a buffer into the receiving process.  Runs in the
+ * receiver's context from binder_thread_read, so the fds translated by
+ * binder_transaction are already in current->files.  Regions that cannot
+ * be mapped are left with a NULL buffer for userspace to map by hand.
+ */
+static void binder_map_fd_regions(struct binder_proc *proc,
+				  struct binder_buffer *buffer)
+{
+	size_t *offp, *off_end;
+
+	offp = (size_t *)(buffer->data + ALIGN(buffer->data_size, sizeof(void *)));
+	off_end = (void *)offp + buffer->offsets_size;
+	for (; offp < off_end; offp++) {
+		struct binder_fd_region_object *rp;
+		struct file *file;
+		unsigned long addr;
+
+		rp = (struct binder_fd_region_object *)(buffer->data + *offp);
+		if (rp->hdr.type != BINDER_TYPE_FD_REGION || rp->buffer)
+			continue;
+
+		file = fget(rp->hdr.handle);
+		if (file == NULL)
+			continue;
+		down_write(&current->mm->mmap_sem);
+		addr = do_mmap(file, 0, rp->length, PROT_READ, MAP_SHARED,
+			       rp->offset);
+		up_write(&current->mm->mmap_sem);
+		fput(file);
+
+		if (IS_ERR_VALUE(addr)) {
+			binder_debug(BINDER_DEBUG_TRANSACTION,
+				     "binder: %d: fd region %ld map failed %ld\n",
+				     proc->pid, rp->hdr.handle, (long)addr);
+			continue;
+		}
+		binder_debug(BINDER_DEBUG_TRANSACTION,
+			     "binder: %d: fd region %ld %zd-%zd at %lx\n",
+			     proc->pid, rp->hdr.handle, rp->offset,
+			     rp->length, addr);
+		rp->buffer = (void *)addr;
+	}
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
@@ -1390,6 +1762,7 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
 	uint32_t return_error;
+	bool target_locked = false;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
@@ -1428,6 +1801,9 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		target_proc = target_thread->proc;
+		binder_lock_target(proc, target_proc);
+		target_locked = true;
 		if (target_thread->transaction_stack != in_reply_to) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad target transaction stack %d, "
@@ -1441,7 +1817,6 @@ static void binder_transaction(struct binder_proc *proc,
 			target_thread = NULL;
 			goto err_dead_binder;
 		}
-		target_proc = target_thread->proc;
 	} else {
 		if (tr->target.handle) {
 			struct binder_ref *ref;
@@ -1462,11 +1837,15 @@ static void binder_transaction(struct binder_proc *proc,
 			}
 		}
 		e->to_node = target_node->debug_id;
+		/* keep the node around while proc->lock may be dropped */
+		binder_inc_node(target_node, 1, 0, NULL);
 		target_proc = target_node->proc;
 		if (target_proc == NULL) {
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		binder_lock_target(proc, target_proc);
+		target_locked = true;
 		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
 			struct binder_transaction *tmp;
 			tmp = thread->transaction_stack;
@@ -1513,7 +1892,7 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1669,6 +2048,22 @@ static void binder_transaction(struct binder_proc *proc,
 			}
 		} break;
 
+		case BINDER_TYPE_FD_REGION: {
+			struct binder_fd_region_object *rp = (void *)fp;
+
+			if (*offp > t->buffer->data_size - sizeof(*rp) ||
+			    t->buffer->data_size < sizeof(*rp) ||
+			    (rp->offset & ~PAGE_MASK) || rp->length == 0 ||
+			    rp->offset + rp->length < rp->offset) {
+				binder_user_error("binder: %d:%d got transaction with invalid fd region, %zd\n",
+					proc->pid, thread->pid, *offp);
+				return_error = BR_FAILED_REPLY;
+				goto err_bad_offset;
+			}
+			/* filled in by the receiver's binder_thread_read */
+			rp->buffer = NULL;
+		}
+			/* the fd itself is translated like any other */
 		case BINDER_TYPE_FD: {
 			int target_fd;
 			struct file *file;
@@ -1694,6 +2089,14 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_fget_failed;
 			}
+			if (fp->type == BINDER_TYPE_FD_REGION &&
+			    (file->f_op == NULL || file->f_op->mmap == NULL)) {
+				binder_user_error("binder: %d:%d got transaction with unmappable fd region, %ld\n",
+					proc->pid, thread->pid, fp->handle);
+				fput(file);
+				return_error = BR_FAILED_REPLY;
+				goto err_fget_failed;
+			}
 			target_fd = task_get_unused_fd_flags(target_proc, O_CLOEXEC);
 			if (target_fd < 0) {
 				fput(file);
@@ -1733,11 +2136,14 @@ static void binder_transaction(struct binder_proc *proc,
 			target_node->has_async_transaction = 1;
 	}
 	t->work.type = BINDER_WORK_TRANSACTION;
-	list_add_tail(&t->work.entry, target_list);
+	binder_enqueue_work(target_proc, &t->work, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
-	list_add_tail(&tcomplete->entry, &thread->todo);
+	binder_enqueue_work(proc, tcomplete, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	binder_unlock_target(proc, target_proc);
+	if (target_node)
+		binder_dec_node(target_node, 1, 0);
 	return;
 
 err_get_unused_fd_failed:
@@ -1778,9 +2184,17 @@ err_no_context_mgr_node:
 	BUG_ON(thread->return_error != BR_OK);
 	if (in_reply_to) {
 		thread->return_error = BR_TRANSACTION_COMPLETE;
-		binder_send_failed_reply(in_reply_to, return_error);
+		if (target_locked)
+			binder_send_failed_reply(in_reply_to, return_error);
+		else
+			binder_send_dead_reply(proc, in_reply_to,
+					       return_error);
 	} else
 		thread->return_error = return_error;
+	if (target_locked)
+		binder_unlock_target(proc, target_proc);
+	if (target_node)
+		binder_dec_node(target_node, 1, 0);
 }
 
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
@@ -1795,9 +2209,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1889,8 +2303,11 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					cookie, node->cookie);
 				break;
 			}
+			/* the pending bits share a word with has_*_ref */
+			spin_lock(&node->lock);
 			if (cmd == BC_ACQUIRE_DONE) {
 				if (node->pending_strong_ref == 0) {
+					spin_unlock(&node->lock);
 					binder_user_error("binder: %d:%d "
 						"BC_ACQUIRE_DONE node %d has "
 						"no pending acquire request\n",
@@ -1901,6 +2318,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				node->pending_strong_ref = 0;
 			} else {
 				if (node->pending_weak_ref == 0) {
+					spin_unlock(&node->lock);
 					binder_user_error("binder: %d:%d "
 						"BC_INCREFS_DONE node %d has "
 						"no pending increfs request\n",
@@ -1910,7 +2328,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				}
 				node->pending_weak_ref = 0;
 			}
-			binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
+			/* a live node is only freed by its owner's thread_read */
+			binder_dec_node_locked(node, cmd == BC_ACQUIRE_DONE, 0);
+			spin_unlock(&node->lock);
 			binder_debug(BINDER_DEBUG_USER_REFS,
 				     "binder: %d:%d %s node %d ls %d lw %d\n",
 				     proc->pid, thread->pid,
@@ -1958,10 +2378,12 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			}
 			if (buffer->async_transaction && buffer->target_node) {
 				BUG_ON(!buffer->target_node->has_async_transaction);
+				spin_lock(&proc->inner_lock);
 				if (list_empty(&buffer->target_node->async_todo))
 					buffer->target_node->has_async_transaction = 0;
 				else
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
+				spin_unlock(&proc->inner_lock);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
@@ -2080,9 +2502,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				if (ref->node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
-						list_add_tail(&ref->death->work.entry, &thread->todo);
+						binder_enqueue_work(proc, &ref->death->work, &thread->todo);
 					} else {
-						list_add_tail(&ref->death->work.entry, &proc->todo);
+						binder_enqueue_work(proc, &ref->death->work, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
 				}
@@ -2107,6 +2529,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					break;
 				}
 				ref->death = NULL;
+				spin_lock(&proc->inner_lock);
 				if (list_empty(&death->work.entry)) {
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
@@ -2119,6 +2542,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
 				}
+				spin_unlock(&proc->inner_lock);
 			}
 		} break;
 		case BC_DEAD_BINDER_DONE: {
@@ -2129,6 +2553,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 
 			ptr += sizeof(void *);
+			spin_lock(&proc->inner_lock);
 			list_for_each_entry(w, &proc->delivered_death, entry) {
 				struct binder_ref_death *tmp_death = container_of(w, struct binder_ref_death, work);
 				if (tmp_death->cookie == cookie) {
@@ -2140,6 +2565,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d BC_DEAD_BINDER_DONE %p found %p\n",
 				     proc->pid, thread->pid, cookie, death);
 			if (death == NULL) {
+				spin_unlock(&proc->inner_lock);
 				binder_user_error("binder: %d:%d BC_DEAD"
 					"_BINDER_DONE %p not found\n",
 					proc->pid, thread->pid, cookie);
@@ -2156,6 +2582,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					wake_up_interruptible(&proc->wait);
 				}
 			}
+			spin_unlock(&proc->inner_lock);
 		} break;
 
 		default:
@@ -2172,9 +2599,9 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
@@ -2232,7 +2659,8 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	up_read(&binder_procs_lock);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2256,7 +2684,8 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	down_read(&binder_procs_lock);
+	mutex_lock(&proc->lock);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2270,11 +2699,10 @@ retry:
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
 
-		if (!list_empty(&thread->todo))
-			w = list_first_entry(&thread->todo, struct binder_work, entry);
-		else if (!list_empty(&proc->todo) && wait_for_proc_work)
-			w = list_first_entry(&proc->todo, struct binder_work, entry);
-		else {
+		w = binder_peek_work(proc, &thread->todo);
+		if (w == NULL && wait_for_proc_work)
+			w = binder_peek_work(proc, &proc->todo);
+		if (w == NULL) {
 			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
 				goto retry;
 			break;
@@ -2298,7 +2726,7 @@ retry:
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
 
-			list_del(&w->entry);
+			binder_dequeue_work(proc, w);
 			kfree(w);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
@@ -2306,8 +2734,11 @@ retry:
 			struct binder_node *node = container_of(w, struct binder_node, work);
 			uint32_t cmd = BR_NOOP;
 			const char *cmd_name;
-			int strong = node->internal_strong_refs || node->local_strong_refs;
-			int weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
+			int strong, weak;
+
+			spin_lock(&node->lock);
+			strong = node->internal_strong_refs || node->local_strong_refs;
+			weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
 			if (weak && !node->has_weak_ref) {
 				cmd = BR_INCREFS;
 				cmd_name = "BR_INCREFS";
@@ -2329,6 +2760,10 @@ retry:
 				cmd_name = "BR_DECREFS";
 				node->has_weak_ref = 0;
 			}
+			if (cmd == BR_NOOP)
+				binder_dequeue_work(proc, w);
+			spin_unlock(&node->lock);
+
 			if (cmd != BR_NOOP) {
 				if (put_user(cmd, (uint32_t __user *)ptr))
 					return -EFAULT;
@@ -2345,7 +2780,6 @@ retry:
 					     "binder: %d:%d %s %d u%p c%p\n",
 					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
 			} else {
-				list_del_init(&w->entry);
 				if (!weak && !strong) {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p deleted\n",
@@ -2388,11 +2822,14 @@ retry:
 				      death->cookie);
 
 			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
-				list_del(&w->entry);
+				binder_dequeue_work(proc, w);
 				kfree(death);
 				binder_stats_deleted(BINDER_STAT_DEATH);
-			} else
+			} else {
+				spin_lock(&proc->inner_lock);
 				list_move(&w->entry, &proc->delivered_death);
+				spin_unlock(&proc->inner_lock);
+			}
 			if (cmd == BR_DEAD_BINDER)
 				goto done; /* DEAD_BINDER notifications can cause transactions */
 		} break;
@@ -2431,6 +2868,9 @@ retry:
 			tr.sender_pid = 0;
 		}
 
+		if (t->buffer->offsets_size)
+			binder_map_fd_regions(proc, t->buffer);
+
 		tr.data_size = t->buffer->data_size;
 		tr.offsets_size = t->buffer->offsets_size;
 		tr.data.ptr.buffer = (void *)t->buffer->data +
@@ -2458,7 +2898,7 @@ retry:
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
 
-		list_del(&t->work.entry);
+		binder_dequeue_work(proc, &t->work);
 		t->buffer->allow_user_free = 1;
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
 			t->to_parent = thread->transaction_stack;
@@ -2598,12 +3038,19 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	down_read(&binder_procs_lock);
+	mutex_lock(&proc->lock);
 	thread = binder_get_thread(proc);
+	if (thread == NULL) {
+		mutex_unlock(&proc->lock);
+		up_read(&binder_procs_lock);
+		return POLLERR;
+	}
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	up_read(&binder_procs_lock);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2628,6 +3075,8 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	struct binder_thread *thread;
 	unsigned int size = _IOC_SIZE(cmd);
 	void __user *ubuf = (void __user *)arg;
+	/* these free a thread or change global state */
+	bool excl = cmd == BINDER_SET_CONTEXT_MGR || cmd == BINDER_THREAD_EXIT;
 
 	/*printk(KERN_INFO "binder_ioctl: %d:%d %x %lx\n", proc->pid, current->pid, cmd, arg);*/
 
@@ -2635,7 +3084,13 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	binder_refill_page_reserve(proc);
+
+	if (excl)
+		down_write(&binder_procs_lock);
+	else
+		down_read(&binder_procs_lock);
+	mutex_lock(&proc->lock);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2744,7 +3199,11 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	if (excl)
+		up_write(&binder_procs_lock);
+	else
+		up_read(&binder_procs_lock);
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2882,16 +3341,20 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	mutex_init(&proc->lock);
+	spin_lock_init(&proc->inner_lock);
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	spin_lock_init(&proc->page_reserve_lock);
+	INIT_LIST_HEAD(&proc->page_reserve);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	down_write(&binder_procs_lock);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	up_write(&binder_procs_lock);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2983,7 +3446,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 			node->proc = NULL;
 			node->local_strong_refs = 0;
 			node->local_weak_refs = 0;
+			spin_lock(&binder_dead_nodes_lock);
 			hlist_add_head(&node->dead_node, &binder_dead_nodes);
+			spin_unlock(&binder_dead_nodes_lock);
 
 			hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
 				incoming_refs++;
@@ -3051,6 +3516,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
+	binder_drain_page_reserve(proc);
 
 	put_task_struct(proc->tsk);
 
@@ -3071,7 +3537,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		down_write(&binder_procs_lock);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3098,7 +3564,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		up_write(&binder_procs_lock);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3252,6 +3718,40 @@ static void print_binder_ref(struct seq_file *m, struct binder_ref *ref)
 		   ref->node->debug_id, ref->strong, ref->weak, ref->death);
 }
 
+static void print_binder_alloc_stats(struct seq_file *m,
+				     struct binder_proc *proc)
+{
+	struct binder_alloc_stats *stats = &proc->alloc_stats;
+	struct binder_buffer *buffer;
+	struct rb_node *n;
+	size_t free_size = 0, largest = 0;
+	int count = 0;
+	int i;
+
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		buffer = rb_entry(n, struct binder_buffer, rb_node);
+		free_size += binder_buffer_size(proc, buffer);
+		count++;
+	}
+	n = rb_last(&proc->free_buffers);
+	if (n)
+		largest = binder_buffer_size(proc,
+			rb_entry(n, struct binder_buffer, rb_node));
+
+	seq_printf(m, "  free buffers: %d size %zd largest %zd "
+		   "fragmentation %zd%%\n", count, free_size, largest,
+		   free_size ? 100 - largest * 100 / free_size : 0);
+	seq_printf(m, "  allocs: %d failed %d pages %d "
+		   "reserve %d/%d hit %d miss %d\n",
+		   stats->allocs, stats->failures, stats->pages,
+		   proc->page_reserve_count, proc->page_reserve_want,
+		   stats->reserve_hits, stats->reserve_misses);
+	seq_puts(m, "  alloc latency:");
+	for (i = 0; i < BINDER_ALLOC_LAT_BUCKETS - 1; i++)
+		seq_printf(m, " <%dus:%d", 1 << i, stats->latency[i]);
+	seq_printf(m, " >=%dus:%d\n", 1 << (i - 1), stats->latency[i]);
+}
+
 static void print_binder_proc(struct seq_file *m,
 			      struct binder_proc *proc, int print_all)
 {
@@ -3282,6 +3782,8 @@ static void print_binder_proc(struct seq_file *m,
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	if (print_all)
+		print_binder_alloc_stats(m, proc);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3351,17 +3853,21 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int count = atomic_read(&stats->bc[i]);
+
+		if (count)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], count);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int count = atomic_read(&stats->br[i]);
+
+		if (count)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], count);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3369,11 +3875,13 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
 }
 
@@ -3414,6 +3922,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
+	print_binder_alloc_stats(m, proc);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3439,7 +3948,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_procs_lock);
 
 	seq_puts(m, "binder state:\n");
 
@@ -3451,7 +3960,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_procs_lock);
 	return 0;
 }
 
@@ -3462,7 +3971,7 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_procs_lock);
 
 	seq_puts(m, "binder stats:\n");
 
@@ -3471,7 +3980,7 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_procs_lock);
 	return 0;
 }
 
@@ -3482,13 +3991,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_procs_lock);
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_procs_lock);
 	return 0;
 }
 
@@ -3498,11 +4007,11 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_procs_lock);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_procs_lock);
 	return 0;
 }
 
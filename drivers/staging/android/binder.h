@@ -32,6 +32,7 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_FD_REGION	= B_PACK_CHARS('f', 'r', '*', B_TYPE_LARGE),
 };
 
 enum {
@@ -61,6 +62,26 @@ struct flat_binder_object {
 	void			*cookie;
 };
 
+/*
+ * A region of a mappable file (ashmem, tmpfs, ...) passed by reference
+ * instead of being copied into the transaction buffer.  The fd in
+ * hdr.handle is translated exactly like BINDER_TYPE_FD, so the receiver
+ * owns a new descriptor for the file.  When the receiver reads the
+ * transaction the driver maps [offset, offset + length) of the file
+ * read-only and shared into its address space and stores the address in
+ * buffer, or leaves it NULL if the mapping failed and the receiver has to
+ * mmap the fd itself.  The mapping and the fd belong to the receiver and
+ * must be released with munmap() and close().  offset must be page
+ * aligned.  A transaction may carry several regions, giving a
+ * scatter-gather list of large payloads that are never copied.
+ */
+struct binder_fd_region_object {
+	struct flat_binder_object	hdr;
+	size_t				offset;
+	size_t				length;
+	void				*buffer;
+};
+
 /*
  * On 64-bit platforms where user code may run in 32-bits the driver must
  * translate the buffer (and local binder) addresses apropriately.
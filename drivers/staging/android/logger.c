@@ -23,18 +23,66 @@
 #include <linux/miscdevice.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
+#include <linux/percpu.h>
 #include <linux/slab.h>
 #include <linux/time.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * struct logger_stage - a per-cpu staging ring for lock-free writes
+ *
+ * Writers reserve space by advancing 'head' with cmpxchg, copy their entry
+ * in without holding any lock and then mark the record committed, all with
+ * preemption disabled so no record stays uncommitted for long. Records
+ * are moved into the shared log, in write order, by logger_flush_stages()
+ * under log->mutex, which zeroes them and advances 'tail'. Both counters
+ * run freely and are masked with LOGGER_STAGE_SIZE - 1.
+ */
+struct logger_stage {
+	unsigned char		*buffer;/* LOGGER_STAGE_SIZE bytes, zeroed */
+	atomic_t		head;	/* reserved up to here */
+	atomic_t		tail;	/* merged up to here */
+};
+
+/*
+ * struct logger_rec - header of each record in a staging ring
+ *
+ * A logger_entry follows, unless the record is a discard, which pads the
+ * end of the ring.
+ */
+struct logger_rec {
+	__u16			len;	/* whole record, this header included */
+	__u16			flags;	/* LOGGER_REC_* */
+	__u32			seq;	/* write order across cpus, never 0 */
+};
+
+#define LOGGER_REC_COMMITTED	0x1	/* contents are valid */
+#define LOGGER_REC_DISCARD	0x2	/* skip while merging */
+
+/* must be a power of two holding a few LOGGER_ENTRY_MAX_LEN entries */
+#define LOGGER_STAGE_SIZE	(16*1024)
+
+/*
+ * struct logger_index_ent - a sample of the timestamp index: the entry
+ * starting at 'off' was stamped 'sec'.'nsec'
+ */
+struct logger_index_ent {
+	size_t			off;
+	__s32			sec;
+	__s32			nsec;
+};
+
+/* the index samples at most one entry per this many bytes of log */
+#define LOGGER_INDEX_STRIDE	1024
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * mutex 'mutex', except for the staging rings, which writers fill locklessly.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
@@ -45,6 +93,12 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_stage __percpu *stage; /* NULL if allocation failed */
+	atomic_t		seq;	/* last sequence number handed out */
+	struct logger_index_ent	*index;	/* sparse, in write order */
+	unsigned int		index_size; /* slots in 'index' */
+	unsigned int		index_first; /* oldest sample */
+	unsigned int		index_count; /* live samples */
 };
 
 /*
@@ -57,6 +111,7 @@ struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	struct logger_filter	filter;	/* entries to skip on read */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -107,6 +162,64 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 	return sizeof(struct logger_entry) + val;
 }
 
+/*
+ * get_entry_header - copies the header of the entry starting at 'off' into
+ * 'entry'.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void get_entry_header(struct logger_log *log, size_t off,
+			     struct logger_entry *entry)
+{
+	size_t len = min(sizeof(struct logger_entry), log->size - off);
+
+	memcpy(entry, log->buffer + off, len);
+	if (len != sizeof(struct logger_entry))
+		memcpy((char *) entry + len, log->buffer,
+		       sizeof(struct logger_entry) - len);
+}
+
+/*
+ * entry_filtered - does 'reader' want to skip the entry starting at 'off'?
+ *
+ * Caller needs to hold log->mutex.
+ */
+static int entry_filtered(struct logger_log *log, struct logger_reader *reader,
+			  size_t off)
+{
+	struct logger_entry entry;
+	unsigned char prio;
+
+	if (!reader->filter.pid && !reader->filter.min_prio)
+		return 0;
+
+	get_entry_header(log, off, &entry);
+	if (reader->filter.pid && entry.pid != reader->filter.pid)
+		return 1;
+	if (reader->filter.min_prio) {
+		if (!entry.len)
+			return 1;
+		prio = log->buffer[logger_offset(off + sizeof(entry))];
+		if (prio < reader->filter.min_prio)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * skip_filtered - advance 'reader' past the entries its filter rejects.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void skip_filtered(struct logger_log *log, struct logger_reader *reader)
+{
+	while (reader->r_off != log->w_off &&
+	       entry_filtered(log, reader, reader->r_off))
+		reader->r_off = logger_offset(reader->r_off +
+					      get_entry_len(log, reader->r_off));
+}
+
 /*
  * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
  * user-space buffer 'buf'. Returns 'count' on success.
@@ -142,6 +255,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	return count;
 }
 
+static void logger_flush_stages(struct logger_log *log, __u32 upto);
+
 /*
  * logger_read - our log's read() method
  *
@@ -167,6 +282,8 @@ start:
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&log->mutex);
+		logger_flush_stages(log, 0);
+		skip_filtered(log, reader);
 		ret = (log->w_off == reader->r_off);
 		mutex_unlock(&log->mutex);
 		if (!ret)
@@ -192,6 +309,7 @@ start:
 	mutex_lock(&log->mutex);
 
 	/* is there still something to read or did we race? */
+	skip_filtered(log, reader);
 	if (unlikely(log->w_off == reader->r_off)) {
 		mutex_unlock(&log->mutex);
 		goto start;
@@ -266,11 +384,103 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 	if (clock_interval(old, new, log->head))
 		log->head = get_next_entry(log, log->head, len);
 
+	/* drop the index samples that are about to be overwritten */
+	while (log->index_count &&
+	       clock_interval(old, new, log->index[log->index_first].off)) {
+		log->index_first = (log->index_first + 1) % log->index_size;
+		log->index_count--;
+	}
+
 	list_for_each_entry(reader, &log->readers, list)
 		if (clock_interval(old, new, reader->r_off))
 			reader->r_off = get_next_entry(log, reader->r_off, len);
 }
 
+/*
+ * index_entry - note the entry 'entry' written at 'off' in the timestamp
+ * index, if the last sample is at least LOGGER_INDEX_STRIDE bytes back.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void index_entry(struct logger_log *log, size_t off,
+			const struct logger_entry *entry)
+{
+	struct logger_index_ent *ent;
+	unsigned int last;
+
+	if (!log->index)
+		return;
+
+	if (log->index_count) {
+		last = (log->index_first + log->index_count - 1) %
+			log->index_size;
+		if (logger_offset(off - log->index[last].off) <
+		    LOGGER_INDEX_STRIDE)
+			return;
+	}
+
+	/* cannot happen given the stride, but never overrun the array */
+	if (log->index_count == log->index_size) {
+		log->index_first = (log->index_first + 1) % log->index_size;
+		log->index_count--;
+	}
+
+	ent = &log->index[(log->index_first + log->index_count) %
+			  log->index_size];
+	ent->off = off;
+	ent->sec = entry->sec;
+	ent->nsec = entry->nsec;
+	log->index_count++;
+}
+
+static inline int logger_entry_before(struct logger_entry *a,
+				      struct logger_entry *b)
+{
+	return a->sec < b->sec || (a->sec == b->sec && a->nsec < b->nsec);
+}
+
+/*
+ * seek_time - return the offset of the first entry stamped at or after
+ * 'when'. The index narrows the search to one stride, which is then
+ * scanned. Entries are only nearly sorted, as each is stamped before it
+ * reaches the log, so this is the first such entry after the last sample
+ * older than 'when'.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static size_t seek_time(struct logger_log *log, struct logger_entry *when)
+{
+	struct logger_entry entry;
+	unsigned int lo = 0, hi = log->index_count;
+	size_t off = log->head;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		struct logger_index_ent *ent;
+
+		ent = &log->index[(log->index_first + mid) % log->index_size];
+		entry.sec = ent->sec;
+		entry.nsec = ent->nsec;
+		if (logger_entry_before(&entry, when))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo)
+		off = log->index[(log->index_first + lo - 1) %
+				 log->index_size].off;
+
+	while (off != log->w_off) {
+		get_entry_header(log, off, &entry);
+		if (!logger_entry_before(&entry, when))
+			break;
+		off = logger_offset(off + sizeof(struct logger_entry) +
+				    entry.len);
+	}
+
+	return off;
+}
+
 /*
  * do_write_log - writes 'len' bytes from 'buf' to 'log'
  *
@@ -316,6 +526,268 @@ static ssize_t do_write_log_from_user(struct logger_log *log,
 	return count;
 }
 
+/*
+ * logger_stage_reserve - reserve room for a 'len' byte entry in 'st'
+ *
+ * Returns the record header, or NULL if the ring is full. Safe against
+ * concurrent writers and against the merge; needs no locks.
+ */
+static struct logger_rec *logger_stage_reserve(struct logger_stage *st,
+					       size_t len)
+{
+	struct logger_rec *rec;
+	unsigned int head, off, pad;
+
+	len = ALIGN(sizeof(struct logger_rec) + len, sizeof(struct logger_rec));
+
+	do {
+		head = atomic_read(&st->head);
+		off = head & (LOGGER_STAGE_SIZE - 1);
+
+		/* records never wrap, pad out the end of the ring instead */
+		pad = 0;
+		if (off + len > LOGGER_STAGE_SIZE)
+			pad = LOGGER_STAGE_SIZE - off;
+
+		if (head + pad + len - (unsigned int) atomic_read(&st->tail) >
+		    LOGGER_STAGE_SIZE)
+			return NULL;
+	} while (atomic_cmpxchg(&st->head, head, head + pad + len) != head);
+
+	if (pad) {
+		rec = (struct logger_rec *) (st->buffer + off);
+		rec->len = pad;
+		smp_wmb();
+		rec->flags = LOGGER_REC_COMMITTED | LOGGER_REC_DISCARD;
+		off = 0;
+	}
+
+	rec = (struct logger_rec *) (st->buffer + off);
+	rec->len = len;
+
+	return rec;
+}
+
+/*
+ * logger_stage_commit - publish a reserved record to the merge
+ */
+static inline void logger_stage_commit(struct logger_rec *rec, __u16 flags)
+{
+	smp_wmb();
+	rec->flags = LOGGER_REC_COMMITTED | flags;
+}
+
+/*
+ * logger_stage_consume - release the oldest record of 'st' for reuse
+ *
+ * The record is zeroed so that no later record header can find stale
+ * flags in its place. Caller must hold log->mutex.
+ */
+static void logger_stage_consume(struct logger_stage *st,
+				 struct logger_rec *rec)
+{
+	unsigned int len = rec->len;
+
+	memset(rec, 0, len);
+	smp_mb();
+	atomic_add(len, &st->tail);
+}
+
+/*
+ * logger_stage_peek - return the oldest record of 'st' that holds an entry,
+ * or NULL if it is empty. Sets '*committed' if the entry may be merged;
+ * otherwise it is still being written. Discarded records are consumed on
+ * the way.
+ *
+ * Caller must hold log->mutex.
+ */
+static struct logger_rec *logger_stage_peek(struct logger_stage *st,
+					    int *committed)
+{
+	struct logger_rec *rec;
+	unsigned int tail;
+	__u16 flags;
+
+	while ((tail = atomic_read(&st->tail)) != atomic_read(&st->head)) {
+		rec = (struct logger_rec *)
+			(st->buffer + (tail & (LOGGER_STAGE_SIZE - 1)));
+		flags = ACCESS_ONCE(rec->flags);
+		*committed = flags & LOGGER_REC_COMMITTED;
+		if (!*committed)
+			return rec;
+		smp_rmb();
+		if (!(flags & LOGGER_REC_DISCARD))
+			return rec;
+		logger_stage_consume(st, rec);
+	}
+
+	return NULL;
+}
+
+/* sequence numbers wrap, so compare them as a distance */
+static inline int logger_seq_before(__u32 a, __u32 b)
+{
+	return (__s32) (a - b) < 0;
+}
+
+/*
+ * logger_next_seq - hand out the next sequence number, skipping 0, which
+ * marks a record whose number is not stored yet
+ */
+static inline __u32 logger_next_seq(struct logger_log *log)
+{
+	__u32 seq;
+
+	do {
+		seq = atomic_inc_return(&log->seq);
+	} while (!seq);
+
+	return seq;
+}
+
+/*
+ * logger_flush_stages - merge staged entries into the log in the order
+ * they were written across cpus, fixing up readers as do_write_log does.
+ *
+ * An entry that is still being copied in holds back every later one, so
+ * merging stops there. If 'upto' is not 0, every entry numbered before
+ * 'upto' is merged instead; the locked write path uses this to stay behind
+ * all earlier writes. Entries are filled in with preemption disabled and
+ * from kernel memory, so waiting for one is a short spin that never
+ * depends on a writer sleeping while we hold the mutex.
+ *
+ * Caller must hold log->mutex.
+ */
+static void logger_flush_stages(struct logger_log *log, __u32 upto)
+{
+	int cpu;
+
+	if (!log->stage)
+		return;
+
+	while (1) {
+		struct logger_stage *best_st = NULL;
+		struct logger_rec *best = NULL;
+		struct logger_entry *entry;
+		__u32 busy_seq = 0, best_seq = 0;
+		int busy = 0, committed;
+		size_t len;
+
+		for_each_possible_cpu(cpu) {
+			struct logger_stage *st = per_cpu_ptr(log->stage, cpu);
+			struct logger_rec *rec = logger_stage_peek(st,
+								   &committed);
+			__u32 seq;
+
+			if (!rec)
+				continue;
+
+			seq = ACCESS_ONCE(rec->seq);
+			if (!committed) {
+				/* 0 is not numbered yet, so may be oldest */
+				if (!busy || !seq || (busy_seq &&
+				    logger_seq_before(seq, busy_seq)))
+					busy_seq = seq;
+				busy = 1;
+			} else if (!best || logger_seq_before(seq, best_seq)) {
+				best = rec;
+				best_st = st;
+				best_seq = seq;
+			}
+		}
+
+		if (busy && (!best || !busy_seq ||
+			     logger_seq_before(busy_seq, best_seq))) {
+			if (!upto || (busy_seq &&
+				      !logger_seq_before(busy_seq, upto)))
+				break;
+			/* its writer is running on another cpu right now */
+			cpu_relax();
+			continue;
+		}
+		if (!best || (upto && !logger_seq_before(best_seq, upto)))
+			break;
+
+		entry = (struct logger_entry *) (best + 1);
+		len = sizeof(struct logger_entry) + entry->len;
+		fix_up_readers(log, len);
+		index_entry(log, log->w_off, entry);
+		do_write_log(log, entry, len);
+		logger_stage_consume(best_st, best);
+	}
+}
+
+/*
+ * logger_stage_write - the lock-free write path: stage the entry in this
+ * cpu's ring. Returns -ENOSPC if the ring is full or no bounce buffer can
+ * be had, in which case the caller falls back to writing under log->mutex.
+ */
+static ssize_t logger_stage_write(struct logger_log *log,
+				  struct logger_entry *header,
+				  const struct iovec *iov,
+				  unsigned long nr_segs)
+{
+	struct logger_stage *st;
+	struct logger_rec *rec;
+	unsigned char *payload;
+	unsigned int used;
+	size_t count = 0;
+
+	/*
+	 * Copy the payload in before reserving: copy_from_user() may sleep,
+	 * and a record left uncommitted would hold up every later entry and
+	 * the locked write path waiting for it.
+	 */
+	payload = kmalloc(header->len, GFP_KERNEL);
+	if (!payload)
+		return -ENOSPC;
+
+	while (nr_segs-- > 0 && count < header->len) {
+		size_t len = min_t(size_t, iov->iov_len, header->len - count);
+
+		if (len && copy_from_user(payload + count, iov->iov_base, len)) {
+			kfree(payload);
+			return -EFAULT;
+		}
+
+		iov++;
+		count += len;
+	}
+
+	/*
+	 * Numbered with preemption off, so that the records of each ring are
+	 * in the order of their numbers.
+	 */
+	st = per_cpu_ptr(log->stage, get_cpu());
+	rec = logger_stage_reserve(st, sizeof(struct logger_entry) +
+				   header->len);
+	if (rec) {
+		rec->seq = logger_next_seq(log);
+		memcpy(rec + 1, header, sizeof(struct logger_entry));
+		memcpy((unsigned char *) (rec + 1) +
+		       sizeof(struct logger_entry), payload, header->len);
+		logger_stage_commit(rec, 0);
+	}
+	put_cpu();
+	kfree(payload);
+	if (!rec)
+		return -ENOSPC;
+
+	/* keep the ring from filling up if nobody is reading */
+	used = atomic_read(&st->head) - atomic_read(&st->tail);
+	if (used > LOGGER_STAGE_SIZE / 2 && mutex_trylock(&log->mutex)) {
+		logger_flush_stages(log, 0);
+		mutex_unlock(&log->mutex);
+	}
+
+	/* pairs with prepare_to_wait() in logger_read() */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
+
+	return count;
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
@@ -325,10 +797,11 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
+	size_t orig;
+	__u32 seq;
 
 	now = current_kernel_time();
 
@@ -342,8 +815,20 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
+	if (log->stage) {
+		ret = logger_stage_write(log, &header, iov, nr_segs);
+		if (ret != -ENOSPC)
+			return ret;
+		ret = 0;
+	}
+
+	seq = logger_next_seq(log);
 	mutex_lock(&log->mutex);
 
+	/* keep every entry written before this one ahead of it */
+	logger_flush_stages(log, seq);
+	orig = log->w_off;
+
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
 	 * entry after (what will be) the new write offset. We do this now
@@ -373,6 +858,8 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		ret += nr;
 	}
 
+	index_entry(log, orig, &header);
+
 	mutex_unlock(&log->mutex);
 
 	/* wake up any blocked readers */
@@ -409,6 +896,7 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
+		memset(&reader->filter, 0, sizeof(reader->filter));
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
@@ -463,6 +951,8 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
+	logger_flush_stages(log, 0);
+	skip_filtered(log, reader);
 	if (log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
@@ -474,9 +964,25 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_filter filter;
+	struct logger_entry when;
+	struct logger_time time;
 	long ret = -ENOTTY;
 
+	switch (cmd) {
+	case LOGGER_SET_READ_TIME:
+		if (copy_from_user(&time, (void __user *) arg, sizeof(time)))
+			return -EFAULT;
+		break;
+	case LOGGER_SET_FILTER:
+		if (copy_from_user(&filter, (void __user *) arg,
+				   sizeof(filter)))
+			return -EFAULT;
+		break;
+	}
+
 	mutex_lock(&log->mutex);
+	logger_flush_stages(log, 0);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -499,6 +1005,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
+		skip_filtered(log, reader);
 		if (log->w_off != reader->r_off)
 			ret = get_entry_len(log, reader->r_off);
 		else
@@ -512,6 +1019,31 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		list_for_each_entry(reader, &log->readers, list)
 			reader->r_off = log->w_off;
 		log->head = log->w_off;
+		log->index_count = 0;
+		ret = 0;
+		break;
+	case LOGGER_SET_READ_TIME:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		if (time.nsec < 0 || time.nsec >= NSEC_PER_SEC) {
+			ret = -EINVAL;
+			break;
+		}
+		reader = file->private_data;
+		when.sec = time.sec;
+		when.nsec = time.nsec;
+		reader->r_off = seek_time(log, &when);
+		ret = 0;
+		break;
+	case LOGGER_SET_FILTER:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->filter = filter;
 		ret = 0;
 		break;
 	}
@@ -573,10 +1105,49 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+static int __init init_log_stages(struct logger_log *log)
+{
+	int cpu;
+
+	log->stage = alloc_percpu(struct logger_stage);
+	if (!log->stage)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct logger_stage *st = per_cpu_ptr(log->stage, cpu);
+
+		st->buffer = kzalloc(LOGGER_STAGE_SIZE, GFP_KERNEL);
+		if (!st->buffer)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(log->stage, cpu)->buffer);
+	free_percpu(log->stage);
+	log->stage = NULL;
+	return -ENOMEM;
+}
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	/* without staging rings every write simply takes log->mutex */
+	if (init_log_stages(log))
+		printk(KERN_WARNING "logger: no staging rings for log '%s'\n",
+		       log->misc.name);
+
+	/* without an index, seeks scan from the head */
+	log->index_size = log->size / LOGGER_INDEX_STRIDE + 1;
+	log->index = kcalloc(log->index_size, sizeof(struct logger_index_ent),
+			     GFP_KERNEL);
+	if (!log->index)
+		printk(KERN_WARNING "logger: no timestamp index for log '%s'\n",
+		       log->misc.name);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
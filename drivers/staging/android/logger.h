@@ -39,11 +39,28 @@ struct logger_entry {
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
 
+/* argument of LOGGER_SET_READ_TIME, in the units of struct logger_entry */
+struct logger_time {
+	__s32		sec;
+	__s32		nsec;
+};
+
+/*
+ * argument of LOGGER_SET_FILTER; a zero field matches everything. The
+ * priority is the first payload byte, as written by liblog.
+ */
+struct logger_filter {
+	__s32		pid;		/* only entries from this tgid */
+	__u32		min_prio;	/* only entries at or above this */
+};
+
 #define __LOGGERIO	0xAE
 
 #define LOGGER_GET_LOG_BUF_SIZE		_IO(__LOGGERIO, 1) /* size of log */
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_TIME		_IOW(__LOGGERIO, 5, struct logger_time) /* seek to time */
+#define LOGGER_SET_FILTER		_IOW(__LOGGERIO, 6, struct logger_filter) /* filter reads */
 
 #endif /* _LINUX_LOGGER_H */
@@ -16,6 +16,17 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * With /sys/module/lowmemorykiller/parameters/pressure_mode set, the cutoff
+ * is instead picked from the reclaim efficiency reported by vmscan: when
+ * at least pressure[i] percent of the scanned pages could not be reclaimed,
+ * processes with an oom_adj of adj[i] or higher get killed. The current
+ * level, the number of pressure thresholds crossed, can be read and
+ * poll()ed in /sys/module/lowmemorykiller/parameters/pressure_level.
+ *
+ * Processes are kept in one list per oom_adj value, updated on fork, exit
+ * and oom_adj writes, so picking a victim only looks at the highest
+ * populated oom_adj instead of walking every task in the system.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +46,12 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/sysfs.h>
+
+#define CREATE_TRACE_POINTS
+#include "lowmemorykiller_trace.h"
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -51,16 +68,110 @@ static size_t lowmem_minfree[6] = {
 	16 * 1024,	/* 64MB */
 };
 static int lowmem_minfree_size = 4;
+static int lowmem_pressure[6] = {
+	95,
+	90,
+	80,
+	60,
+};
+static int lowmem_pressure_size = 4;
+static int lowmem_pressure_mode;
+
+static int lowmem_pressure_level;
+static unsigned long lowmem_pressure_stamp;
+static struct sysfs_dirent *lowmem_pressure_sd;
 
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+/*
+ * Thread group leaders, one list per oom_adj value. Entries are removed
+ * in release_task() under tasklist_lock, so holding tasklist_lock for
+ * reading keeps every indexed task alive.
+ */
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static struct list_head lowmem_index[OOM_ADJUST_MAX - OOM_DISABLE + 1];
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
+static struct list_head *lowmem_bucket(struct task_struct *p)
+{
+	return &lowmem_index[p->signal->oom_adj - OOM_DISABLE];
+}
+
+static int
+lowmem_fork_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *p = data;
+
+	if (!thread_group_leader(p))
+		return NOTIFY_OK;
+
+	spin_lock(&lowmem_index_lock);
+	if (list_empty(&p->lowmem_list))
+		list_add_tail(&p->lowmem_list, lowmem_bucket(p));
+	spin_unlock(&lowmem_index_lock);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_fork_nb = {
+	.notifier_call	= lowmem_fork_func,
+};
+
+/*
+ * When a non-leader thread execs, de_thread() makes it the new leader
+ * before the old one is released, so the entry moves over to it.
+ */
+static int
+lowmem_release_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *p = data;
+	struct task_struct *leader = p->group_leader;
+
+	spin_lock(&lowmem_index_lock);
+	if (!list_empty(&p->lowmem_list)) {
+		if (leader != p && list_empty(&leader->lowmem_list))
+			list_replace_init(&p->lowmem_list,
+					  &leader->lowmem_list);
+		else
+			list_del_init(&p->lowmem_list);
+	}
+	spin_unlock(&lowmem_index_lock);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_release_nb = {
+	.notifier_call	= lowmem_release_func,
+};
+
+static int
+lowmem_oom_adj_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+	struct task_struct *leader;
+
+	/* The leader's task_struct is freed by RCU after release_task() */
+	rcu_read_lock();
+	spin_lock(&lowmem_index_lock);
+	leader = task->group_leader;
+	if (!list_empty(&leader->lowmem_list))
+		list_move_tail(&leader->lowmem_list, lowmem_bucket(leader));
+	spin_unlock(&lowmem_index_lock);
+	rcu_read_unlock();
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_oom_adj_nb = {
+	.notifier_call	= lowmem_oom_adj_func,
+};
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -79,6 +190,68 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
+/* Only reclaim that happened within the last second says anything */
+static int lowmem_get_pressure_level(void)
+{
+	if (time_after(jiffies, lowmem_pressure_stamp + HZ))
+		return 0;
+	return lowmem_pressure_level;
+}
+
+static int
+lowmem_vmpressure_func(struct notifier_block *self, unsigned long pressure,
+		       void *data)
+{
+	int array_size = ARRAY_SIZE(lowmem_pressure);
+	int level = 0;
+	int old_level = lowmem_get_pressure_level();
+	int i;
+
+	if (lowmem_pressure_size < array_size)
+		array_size = lowmem_pressure_size;
+	for (i = 0; i < array_size; i++) {
+		if (pressure >= lowmem_pressure[i]) {
+			level = array_size - i;
+			break;
+		}
+	}
+
+	lowmem_pressure_level = level;
+	lowmem_pressure_stamp = jiffies;
+	if (level != old_level && lowmem_pressure_sd)
+		sysfs_notify_dirent(lowmem_pressure_sd);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_vmpressure_nb = {
+	.notifier_call	= lowmem_vmpressure_func,
+};
+
+/*
+ * Map the pressure level back to the oom_adj cutoff it was derived from:
+ * the level counts back from the end of the pressure array, which may be
+ * longer or shorter than the adj array.
+ */
+static int lowmem_pressure_min_adj(void)
+{
+	int pressure_size = ARRAY_SIZE(lowmem_pressure);
+	int adj_size = ARRAY_SIZE(lowmem_adj);
+	int level = lowmem_get_pressure_level();
+	int i;
+
+	if (lowmem_pressure_size < pressure_size)
+		pressure_size = lowmem_pressure_size;
+	if (lowmem_adj_size < adj_size)
+		adj_size = lowmem_adj_size;
+	if (!level || level > pressure_size)
+		return OOM_ADJUST_MAX + 1;
+	i = pressure_size - level;
+	if (i >= adj_size)
+		return OOM_ADJUST_MAX + 1;
+	return lowmem_adj[i];
+}
+
 static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
@@ -86,6 +259,7 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	int rem = 0;
 	int tasksize;
 	int i;
+	int oom_adj;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
@@ -105,15 +279,19 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	    time_before_eq(jiffies, lowmem_deathpending_timeout))
 		return 0;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
+	if (lowmem_pressure_mode) {
+		min_adj = lowmem_pressure_min_adj();
+	} else {
+		if (lowmem_adj_size < array_size)
+			array_size = lowmem_adj_size;
+		if (lowmem_minfree_size < array_size)
+			array_size = lowmem_minfree_size;
+		for (i = 0; i < array_size; i++) {
+			if (other_free < lowmem_minfree[i] &&
+			    other_file < lowmem_minfree[i]) {
+				min_adj = lowmem_adj[i];
+				break;
+			}
 		}
 	}
 	if (nr_to_scan > 0)
@@ -132,48 +310,46 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	selected_oom_adj = min_adj;
 
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+	spin_lock(&lowmem_index_lock);
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj; oom_adj--) {
+		list_for_each_entry(p, &lowmem_index[oom_adj - OOM_DISABLE],
+				    lowmem_list) {
+			struct mm_struct *mm;
+
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, oom_adj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
+		/* Anything at a higher oom_adj goes first, whatever its size */
+		if (selected)
+			break;
 	}
+	spin_unlock(&lowmem_index_lock);
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
+		trace_lowmem_kill(selected, selected_oom_adj,
+				  selected_tasksize, min_adj,
+				  other_free, other_file);
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
 		rem -= selected_tasksize;
+	} else {
+		trace_lowmem_no_victim(min_adj, other_free, other_file);
 	}
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
@@ -186,24 +362,94 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static struct sysfs_dirent * __init lowmem_get_param_dirent(const char *name)
+{
+	struct kobject *kobj;
+	struct sysfs_dirent *dir_sd, *sd = NULL;
+
+	kobj = kset_find_obj(module_kset, KBUILD_MODNAME);
+	if (!kobj)
+		return NULL;
+	dir_sd = sysfs_get_dirent(kobj->sd, NULL, "parameters");
+	if (dir_sd) {
+		sd = sysfs_get_dirent(dir_sd, NULL, name);
+		sysfs_put(dir_sd);
+	}
+	kobject_put(kobj);
+
+	return sd;
+}
+
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lowmem_index); i++)
+		INIT_LIST_HEAD(&lowmem_index[i]);
+
 	task_free_register(&task_nb);
+	task_fork_register(&lowmem_fork_nb);
+	task_release_register(&lowmem_release_nb);
+	register_oom_adj_notifier(&lowmem_oom_adj_nb);
+	register_vmpressure_notifier(&lowmem_vmpressure_nb);
+
+	/* Index whatever was forked before the fork notifier went in */
+	read_lock(&tasklist_lock);
+	spin_lock(&lowmem_index_lock);
+	for_each_process(p)
+		if (list_empty(&p->lowmem_list))
+			list_add_tail(&p->lowmem_list, lowmem_bucket(p));
+	spin_unlock(&lowmem_index_lock);
+	read_unlock(&tasklist_lock);
+
+	lowmem_pressure_sd = lowmem_get_param_dirent("pressure_level");
+
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct task_struct *p, *n;
+	int i;
+
 	unregister_shrinker(&lowmem_shrinker);
+	unregister_vmpressure_notifier(&lowmem_vmpressure_nb);
+	if (lowmem_pressure_sd)
+		sysfs_put(lowmem_pressure_sd);
+	unregister_oom_adj_notifier(&lowmem_oom_adj_nb);
+	task_release_unregister(&lowmem_release_nb);
+	task_fork_unregister(&lowmem_fork_nb);
 	task_free_unregister(&task_nb);
+
+	spin_lock(&lowmem_index_lock);
+	for (i = 0; i < ARRAY_SIZE(lowmem_index); i++)
+		list_for_each_entry_safe(p, n, &lowmem_index[i], lowmem_list)
+			list_del_init(&p->lowmem_list);
+	spin_unlock(&lowmem_index_lock);
+}
+
+static int lowmem_pressure_level_get(char *buffer,
+				     const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%d", lowmem_get_pressure_level());
 }
 
+static struct kernel_param_ops lowmem_pressure_level_ops = {
+	.get = lowmem_pressure_level_get,
+};
+
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
 module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 			 S_IRUGO | S_IWUSR);
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
+module_param_array_named(pressure, lowmem_pressure, int,
+			 &lowmem_pressure_size, S_IRUGO | S_IWUSR);
+module_param_named(pressure_mode, lowmem_pressure_mode, int,
+		   S_IRUGO | S_IWUSR);
+module_param_cb(pressure_level, &lowmem_pressure_level_ops, NULL, S_IRUGO);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
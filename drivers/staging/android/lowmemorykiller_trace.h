@@ -0,0 +1,72 @@
+#if !defined(_LOWMEMORYKILLER_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOWMEMORYKILLER_TRACE_H_
+
+#include <linux/sched.h>
+#include <linux/tracepoint.h>
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+#define TRACE_INCLUDE_FILE lowmemorykiller_trace
+
+TRACE_EVENT(lowmem_kill,
+
+	    TP_PROTO(struct task_struct *p, int oom_adj, int tasksize,
+		     int min_adj, int other_free, int other_file),
+
+	    TP_ARGS(p, oom_adj, tasksize, min_adj, other_free, other_file),
+
+	    TP_STRUCT__entry(
+			     __array(char, comm, TASK_COMM_LEN)
+			     __field(pid_t, pid)
+			     __field(int, oom_adj)
+			     __field(int, tasksize)
+			     __field(int, min_adj)
+			     __field(int, other_free)
+			     __field(int, other_file)
+			     ),
+
+	    TP_fast_assign(
+			   memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+			   __entry->pid = p->pid;
+			   __entry->oom_adj = oom_adj;
+			   __entry->tasksize = tasksize;
+			   __entry->min_adj = min_adj;
+			   __entry->other_free = other_free;
+			   __entry->other_file = other_file;
+			   ),
+
+	    TP_printk("pid=%d comm=%s adj=%d size=%d min_adj=%d free=%d file=%d",
+		      __entry->pid, __entry->comm, __entry->oom_adj,
+		      __entry->tasksize, __entry->min_adj,
+		      __entry->other_free, __entry->other_file)
+);
+
+TRACE_EVENT(lowmem_no_victim,
+
+	    TP_PROTO(int min_adj, int other_free, int other_file),
+
+	    TP_ARGS(min_adj, other_free, other_file),
+
+	    TP_STRUCT__entry(
+			     __field(int, min_adj)
+			     __field(int, other_free)
+			     __field(int, other_file)
+			     ),
+
+	    TP_fast_assign(
+			   __entry->min_adj = min_adj;
+			   __entry->other_free = other_free;
+			   __entry->other_file = other_file;
+			   ),
+
+	    TP_printk("min_adj=%d free=%d file=%d",
+		      __entry->min_adj, __entry->other_free,
+		      __entry->other_file)
+);
+
+#endif /* _LOWMEMORYKILLER_TRACE_H_ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#include <trace/define_trace.h>
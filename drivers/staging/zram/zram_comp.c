@@ -0,0 +1,169 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com/
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/crypto.h>
+#include <linux/err.h>
+#include <linux/lzo.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zram_drv.h"
+
+/*
+ * LZO: fast, moderate ratio. Calls into lib/lzo directly; decompression
+ * needs no state.
+ */
+static void *zram_lzo_create(void)
+{
+	return kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+}
+
+static void zram_lzo_destroy(void *private)
+{
+	kfree(private);
+}
+
+static int zram_lzo_compress(const unsigned char *src, unsigned char *dst,
+			     size_t *dst_len, void *private)
+{
+	int ret;
+
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, private);
+
+	return ret == LZO_E_OK ? 0 : -EIO;
+}
+
+static int zram_lzo_decompress(const unsigned char *src, size_t src_len,
+			       unsigned char *dst, void *private)
+{
+	int ret;
+	size_t dst_len = PAGE_SIZE;
+
+	ret = lzo1x_decompress_safe(src, src_len, dst, &dst_len);
+
+	return ret == LZO_E_OK && dst_len == PAGE_SIZE ? 0 : -EIO;
+}
+
+static const struct zram_backend zram_lzo_backend = {
+	.name		= "lzo",
+	.create		= zram_lzo_create,
+	.destroy	= zram_lzo_destroy,
+	.compress	= zram_lzo_compress,
+	.decompress	= zram_lzo_decompress,
+};
+
+#ifdef CONFIG_ZRAM_DEFLATE
+/*
+ * deflate: slower, better ratio. Uses the crypto API deflate transform
+ * (crypto/deflate.c), which keeps both zlib streams in the tfm, so each
+ * compression stream owns one and decompression needs a stream too.
+ */
+static void *zram_deflate_create(void)
+{
+	struct crypto_comp *tfm;
+
+	tfm = crypto_alloc_comp("deflate", 0, 0);
+	if (IS_ERR(tfm))
+		return NULL;
+
+	return tfm;
+}
+
+static void zram_deflate_destroy(void *private)
+{
+	crypto_free_comp(private);
+}
+
+static int zram_deflate_compress(const unsigned char *src, unsigned char *dst,
+				 size_t *dst_len, void *private)
+{
+	int ret;
+	unsigned int len = *dst_len;
+
+	ret = crypto_comp_compress(private, src, PAGE_SIZE, dst, &len);
+	*dst_len = len;
+
+	return ret;
+}
+
+static int zram_deflate_decompress(const unsigned char *src, size_t src_len,
+				   unsigned char *dst, void *private)
+{
+	int ret;
+	unsigned int dst_len = PAGE_SIZE;
+
+	ret = crypto_comp_decompress(private, src, src_len, dst, &dst_len);
+	if (!ret && dst_len != PAGE_SIZE)
+		ret = -EIO;
+
+	return ret;
+}
+
+static const struct zram_backend zram_deflate_backend = {
+	.name		= "deflate",
+	.create		= zram_deflate_create,
+	.destroy	= zram_deflate_destroy,
+	.compress	= zram_deflate_compress,
+	.decompress	= zram_deflate_decompress,
+	.decompress_needs_stream = 1,
+};
+#endif
+
+/* The first entry is the default for new devices */
+static const struct zram_backend *zram_backends[] = {
+	&zram_lzo_backend,
+#ifdef CONFIG_ZRAM_DEFLATE
+	&zram_deflate_backend,
+#endif
+	NULL
+};
+
+const struct zram_backend *zram_default_backend(void)
+{
+	return zram_backends[0];
+}
+
+const struct zram_backend *zram_backend_find(const char *name)
+{
+	int i;
+
+	for (i = 0; zram_backends[i]; i++)
+		if (sysfs_streq(name, zram_backends[i]->name))
+			return zram_backends[i];
+
+	return NULL;
+}
+
+/* List all backends into 'buf', the one in use in brackets */
+ssize_t zram_backend_list(const struct zram_backend *cur, char *buf)
+{
+	int i;
+	ssize_t len = 0;
+
+	for (i = 0; zram_backends[i]; i++) {
+		if (zram_backends[i] == cur)
+			len += sprintf(buf + len, "[%s] ",
+				       zram_backends[i]->name);
+		else
+			len += sprintf(buf + len, "%s ",
+				       zram_backends[i]->name);
+	}
+	len += sprintf(buf + len, "\n");
+
+	return len;
+}
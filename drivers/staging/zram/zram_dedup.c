@@ -0,0 +1,169 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com/
+ */
+
+/*
+ * Same-page deduplication. Every compressed object is indexed by a hash
+ * of its compressed bytes; a page that compresses to exactly the same
+ * bytes as a stored object shares that object instead of allocating a
+ * new one. Compressors are deterministic, so identical pages always
+ * produce identical output, and comparing the compressed bytes rules out
+ * hash collisions cheaply.
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* One per compressed object, shared by 'refcount' table entries */
+struct zram_dedup_node {
+	struct hlist_node hlist;
+	unsigned long handle;
+	u16 size;
+	u32 hash;
+	u32 refcount;
+};
+
+u32 zram_dedup_hash(const void *data, size_t len)
+{
+	return jhash(data, len, 0);
+}
+
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 hash)
+{
+	return &zram->dedup_table[hash & zram->dedup_mask];
+}
+
+/*
+ * Look for a stored object with the same compressed bytes. On a hit the
+ * object gains a reference and 'entry' points at it.
+ */
+int zram_dedup_find(struct zram *zram, u32 hash, const void *data,
+		    size_t len, struct table *entry)
+{
+	struct zram_dedup_node *node;
+	struct hlist_node *pos;
+	unsigned char *obj;
+	int found = 0;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(node, pos, zram_dedup_bucket(zram, hash), hlist) {
+		if (node->hash != hash || node->size != len)
+			continue;
+
+		obj = zs_map_object(zram->mem_pool, node->handle, KM_USER0);
+		found = !memcmp(obj + sizeof(struct zobj_header), data, len);
+		zs_unmap_object(zram->mem_pool, obj, KM_USER0);
+
+		if (found) {
+			node->refcount++;
+			entry->handle = node->handle;
+			entry->size = node->size;
+			break;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return found;
+}
+
+/*
+ * Index a newly stored object. If no memory is available the object is
+ * simply not shared; zram_dedup_put() will not find it and lets the
+ * caller free it.
+ */
+void zram_dedup_insert(struct zram *zram, u32 hash, struct table *entry)
+{
+	struct zram_dedup_node *node;
+
+	node = kmalloc(sizeof(*node), GFP_NOIO);
+	if (!node)
+		return;
+
+	node->handle = entry->handle;
+	node->size = entry->size;
+	node->hash = hash;
+	node->refcount = 1;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&node->hlist, zram_dedup_bucket(zram, hash));
+	spin_unlock(&zram->dedup_lock);
+}
+
+/*
+ * Drop a reference to the object behind 'entry'. Returns the number of
+ * references left; on zero the caller frees the object.
+ */
+u32 zram_dedup_put(struct zram *zram, u32 hash, struct table *entry)
+{
+	struct zram_dedup_node *node;
+	struct hlist_node *pos;
+	u32 refcount = 0;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(node, pos, zram_dedup_bucket(zram, hash), hlist) {
+		if (node->handle != entry->handle)
+			continue;
+
+		refcount = --node->refcount;
+		if (!refcount) {
+			hlist_del(&node->hlist);
+			kfree(node);
+		}
+		break;
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return refcount;
+}
+
+/* About one bucket per four disk pages */
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	unsigned long buckets;
+
+	buckets = roundup_pow_of_two(max_t(size_t, num_pages / 4, 256));
+	zram->dedup_table = vzalloc(buckets * sizeof(*zram->dedup_table));
+	if (!zram->dedup_table)
+		return -ENOMEM;
+	zram->dedup_mask = buckets - 1;
+
+	return 0;
+}
+
+void zram_dedup_destroy(struct zram *zram)
+{
+	struct zram_dedup_node *node;
+	struct hlist_node *pos, *n;
+	unsigned long i;
+
+	if (!zram->dedup_table)
+		return;
+
+	for (i = 0; i <= zram->dedup_mask; i++)
+		hlist_for_each_entry_safe(node, pos, n,
+					  &zram->dedup_table[i], hlist)
+			kfree(node);
+
+	vfree(zram->dedup_table);
+	zram->dedup_table = NULL;
+	zram->dedup_mask = 0;
+}
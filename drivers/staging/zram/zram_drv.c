@@ -24,8 +24,8 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/ktime.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -38,14 +38,18 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(struct zram *zram, u32 *v)
 {
+	spin_lock(&zram->stat64_lock);
 	*v = *v + 1;
+	spin_unlock(&zram->stat64_lock);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(struct zram *zram, u32 *v)
 {
+	spin_lock(&zram->stat64_lock);
 	*v = *v - 1;
+	spin_unlock(&zram->stat64_lock);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -67,22 +71,19 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	zram_stat64_add(zram, v, 1);
 }
 
-static int zram_test_flag(struct zram *zram, u32 index,
-			enum zram_pageflags flag)
+static int zram_test_flag(struct table *entry, enum zram_pageflags flag)
 {
-	return zram->table[index].flags & BIT(flag);
+	return entry->flags & BIT(flag);
 }
 
-static void zram_set_flag(struct zram *zram, u32 index,
-			enum zram_pageflags flag)
+static void zram_set_flag(struct table *entry, enum zram_pageflags flag)
 {
-	zram->table[index].flags |= BIT(flag);
+	entry->flags |= BIT(flag);
 }
 
-static void zram_clear_flag(struct zram *zram, u32 index,
-			enum zram_pageflags flag)
+static void zram_clear_flag(struct table *entry, enum zram_pageflags flag)
 {
-	zram->table[index].flags &= ~BIT(flag);
+	entry->flags &= ~BIT(flag);
 }
 
 static int page_zero_filled(void *ptr)
@@ -129,48 +130,82 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
-static void zram_free_page(struct zram *zram, size_t index)
+/*
+ * Release the memory behind a table entry that has already been unhooked
+ * from the table, so no reader can be looking at it any more.
+ */
+static void zram_free_entry(struct zram *zram, struct table *entry)
 {
-	u32 clen;
+	u32 clen, hash;
 	void *obj;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
-
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
-		}
+	if (unlikely(!entry->handle)) {
+		/* No memory is allocated for zero filled pages */
+		if (zram_test_flag(entry, ZRAM_ZERO))
+			zram_stat_dec(zram, &zram->stats.pages_zero);
 		return;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+	if (unlikely(zram_test_flag(entry, ZRAM_WB))) {
+		zram_wb_free_block(zram, entry->handle);
+		zram_stat_dec(zram, &zram->stats.pages_wb);
+		zram_stat_dec(zram, &zram->stats.pages_stored);
+		return;
+	}
+
+	if (unlikely(zram_test_flag(entry, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+		__free_page(entry->page);
+		zram_stat_dec(zram, &zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	clen = entry->size;
+	obj = zs_map_object(zram->mem_pool, entry->handle, KM_USER0);
+	hash = ((struct zobj_header *)obj)->hash;
+	zs_unmap_object(zram->mem_pool, obj, KM_USER0);
 
-	xv_free(zram->mem_pool, page, offset);
 	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+		zram_stat_dec(zram, &zram->stats.good_compress);
+
+	/* Other pages still share this object */
+	if (zram_dedup_put(zram, hash, entry)) {
+		zram_stat_dec(zram, &zram->stats.pages_dedup);
+		zram_stat64_sub(zram, &zram->stats.dedup_saved, clen);
+		zram_stat_dec(zram, &zram->stats.pages_stored);
+		return;
+	}
+
+	zs_free(zram->mem_pool, entry->handle);
 
 out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+	zram_stat_dec(zram, &zram->stats.pages_stored);
+}
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+/*
+ * Install 'entry' at 'index' and free whatever was stored there before.
+ * Only the swap itself is done under table_lock.
+ */
+static void zram_replace_entry(struct zram *zram, u32 index,
+			       struct table *entry)
+{
+	struct table old;
+
+	write_lock(&zram->table_lock);
+	old = zram->table[index];
+	zram->table[index] = *entry;
+	write_unlock(&zram->table_lock);
+
+	zram_free_entry(zram, &old);
+}
+
+static void zram_free_page(struct zram *zram, size_t index)
+{
+	struct table empty;
+
+	memset(&empty, 0, sizeof(empty));
+	zram_replace_entry(zram, index, &empty);
 }
 
 static void handle_zero_page(struct page *page)
@@ -185,219 +220,544 @@ static void handle_zero_page(struct page *page)
 }
 
 static void handle_uncompressed_page(struct zram *zram,
-				struct page *page, u32 index)
+				struct page *page, struct table *entry)
 {
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic(entry->page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
-	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
+	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
 }
 
-static int zram_read(struct zram *zram, struct bio *bio)
+/*
+ * Take an idle compression stream, sleeping until one is released if all
+ * of them are busy.
+ */
+static struct zram_stream *zram_stream_get(struct zram *zram)
 {
+	struct zram_stream_pool *pool = &zram->streams;
+	struct zram_stream *zstrm;
+
+	spin_lock(&pool->lock);
+	while (list_empty(&pool->idle)) {
+		spin_unlock(&pool->lock);
+		wait_event(pool->wait, !list_empty(&pool->idle));
+		spin_lock(&pool->lock);
+	}
+	zstrm = list_first_entry(&pool->idle, struct zram_stream, list);
+	list_del(&zstrm->list);
+	spin_unlock(&pool->lock);
 
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	return zstrm;
+}
 
-	if (unlikely(!zram->init_done)) {
-		set_bit(BIO_UPTODATE, &bio->bi_flags);
-		bio_endio(bio, 0);
-		return 0;
-	}
+static void zram_stream_put(struct zram *zram, struct zram_stream *zstrm)
+{
+	struct zram_stream_pool *pool = &zram->streams;
 
-	zram_stat64_inc(zram, &zram->stats.num_reads);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	spin_lock(&pool->lock);
+	list_add(&zstrm->list, &pool->idle);
+	spin_unlock(&pool->lock);
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+	wake_up(&pool->wait);
+}
 
-		page = bvec->bv_page;
+static void zram_destroy_streams(struct zram *zram)
+{
+	struct zram_stream_pool *pool = &zram->streams;
+	unsigned int i;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			continue;
-		}
+	if (!pool->streams)
+		return;
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			/* Do nothing */
-			continue;
-		}
+	for (i = 0; i < pool->count; i++) {
+		if (pool->streams[i].private)
+			zram->backend->destroy(pool->streams[i].private);
+		free_pages((unsigned long)pool->streams[i].buffer, 1);
+	}
+	kfree(pool->streams);
+	pool->streams = NULL;
+	pool->count = 0;
+	INIT_LIST_HEAD(&pool->idle);
+}
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			continue;
+static int zram_create_streams(struct zram *zram, unsigned int count)
+{
+	struct zram_stream_pool *pool = &zram->streams;
+	unsigned int i;
+
+	pool->streams = kcalloc(count, sizeof(*pool->streams), GFP_KERNEL);
+	if (!pool->streams)
+		return -ENOMEM;
+	pool->count = count;
+
+	for (i = 0; i < count; i++) {
+		struct zram_stream *zstrm = &pool->streams[i];
+
+		zstrm->private = zram->backend->create();
+		zstrm->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!zstrm->private || !zstrm->buffer) {
+			zram_destroy_streams(zram);
+			return -ENOMEM;
 		}
+		list_add_tail(&zstrm->list, &pool->idle);
+	}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * Decompress the page at 'index' into 'page'. The entry cannot be freed
+ * under us while table_lock is held for reading.
+ *
+ * Pages on the backing device are read synchronously, which is only
+ * allowed with 'may_block'; otherwise -EAGAIN is returned.
+ */
+static int zram_read_page(struct zram *zram, struct page *page, u32 index,
+			  int may_block)
+{
+	int ret;
+	ktime_t start;
+	struct table *entry;
+	struct zobj_header *zheader;
+	struct zram_stream *zstrm = NULL;
+	unsigned char *user_mem, *cmem;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	/* may sleep, so it has to come before table_lock */
+	if (zram->backend->decompress_needs_stream)
+		zstrm = zram_stream_get(zram);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+again:
+	read_lock(&zram->table_lock);
+	entry = &zram->table[index];
+	entry->age = 0;
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+	if (zram_test_flag(entry, ZRAM_ZERO)) {
+		read_unlock(&zram->table_lock);
+		handle_zero_page(page);
+		ret = 0;
+		goto out;
+	}
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
+	/* Requested page is not present in compressed area */
+	if (unlikely(!entry->handle)) {
+		read_unlock(&zram->table_lock);
+		pr_debug("Read before write: page=%u\n", index);
+		/* Do nothing */
+		ret = 0;
+		goto out;
+	}
+
+	/* Page was written back */
+	if (unlikely(zram_test_flag(entry, ZRAM_WB))) {
+		unsigned long blk = entry->handle;
+
+		read_unlock(&zram->table_lock);
+		if (!may_block) {
+			ret = -EAGAIN;
+			goto out;
+		}
+
+		ret = zram_wb_rw(zram, READ_SYNC, page, blk);
+		if (unlikely(ret)) {
+			pr_err("Backing device read failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
+			ret = -EIO;
 			goto out;
 		}
 
+		/* The block may have been freed and reused meanwhile */
+		read_lock(&zram->table_lock);
+		if (!zram_test_flag(entry, ZRAM_WB) || entry->handle != blk) {
+			read_unlock(&zram->table_lock);
+			goto again;
+		}
+		read_unlock(&zram->table_lock);
+
+		zram_stat64_inc(zram, &zram->stats.wb_reads);
 		flush_dcache_page(page);
-		index++;
+		goto out;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return 0;
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(entry, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, entry);
+		read_unlock(&zram->table_lock);
+		ret = 0;
+		goto out;
+	}
+
+	start = ktime_get();
+	cmem = zs_map_object(zram->mem_pool, entry->handle, KM_USER0);
+	user_mem = kmap_atomic(page, KM_USER1);
+
+	ret = zram->backend->decompress(cmem + sizeof(*zheader), entry->size,
+		user_mem, zstrm ? zstrm->private : NULL);
+
+	kunmap_atomic(user_mem, KM_USER1);
+	zs_unmap_object(zram->mem_pool, cmem, KM_USER0);
+	read_unlock(&zram->table_lock);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		ret = -EIO;
+		goto out;
+	}
+
+	zram_stat64_inc(zram, &zram->stats.decomp_pages);
+	zram_stat64_add(zram, &zram->stats.decomp_ns,
+		ktime_to_ns(ktime_sub(ktime_get(), start)));
+	flush_dcache_page(page);
 
 out:
-	bio_io_error(bio);
-	return 0;
+	if (zstrm)
+		zram_stream_put(zram, zstrm);
+	return ret;
 }
 
-static int zram_write(struct zram *zram, struct bio *bio)
+/*
+ * Bios needing the backing device are handed to wb_read_work, since
+ * zram_make_request() cannot wait for I/O it submits itself.
+ */
+static void zram_defer_read(struct zram *zram, struct bio *bio)
 {
+	spin_lock(&zram->wb_lock);
+	bio_list_add(&zram->wb_bios, bio);
+	spin_unlock(&zram->wb_lock);
+
+	queue_work(zram->wb_wq, &zram->wb_read_work);
+}
+
+static int zram_read(struct zram *zram, struct bio *bio, int may_block)
+{
+
 	int i, ret;
 	u32 index;
 	struct bio_vec *bvec;
 
 	if (unlikely(!zram->init_done)) {
-		ret = zram_init_device(zram);
-		if (ret)
-			goto out;
+		set_bit(BIO_UPTODATE, &bio->bi_flags);
+		bio_endio(bio, 0);
+		return 0;
 	}
 
-	zram_stat64_inc(zram, &zram->stats.num_writes);
+	/* Deferred bios were counted the first time round */
+	if (!may_block)
+		zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
-
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
-
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
-
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			continue;
+		ret = zram_read_page(zram, bvec->bv_page, index, may_block);
+		if (ret == -EAGAIN) {
+			zram_defer_read(zram, bio);
+			return 0;
 		}
+		if (ret)
+			goto out;
+		index++;
+	}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return 0;
 
+out:
+	bio_io_error(bio);
+	return 0;
+}
+
+/*
+ * Compress and store one page at 'index'. Compression runs on a private
+ * stream, so several writers proceed in parallel; only the final table
+ * update is serialized.
+ */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	u32 hash;
+	size_t clen;
+	ktime_t start;
+	s64 elapsed;
+	struct table entry;
+	struct zobj_header *zheader;
+	struct zram_stream *zstrm;
+	unsigned char *user_mem, *cmem, *src;
+
+	memset(&entry, 0, sizeof(entry));
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(user_mem)) {
 		kunmap_atomic(user_mem, KM_USER0);
+		zram_set_flag(&entry, ZRAM_ZERO);
+		zram_replace_entry(zram, index, &entry);
+		zram_stat_inc(zram, &zram->stats.pages_zero);
+		return 0;
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	zstrm = zram_stream_get(zram);
+	src = zstrm->buffer;
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+	start = ktime_get();
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = 2 * PAGE_SIZE;
+	ret = zram->backend->compress(user_mem, src, &clen, zstrm->private);
+	kunmap_atomic(user_mem, KM_USER0);
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	zstrm->busy_ns += elapsed;
+	zstrm->pages++;
+
+	if (unlikely(ret)) {
+		zram_stream_put(zram, zstrm);
+		pr_err("Compression failed! err=%d\n", ret);
+		return -EIO;
+	}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+	zram_stat64_inc(zram, &zram->stats.comp_pages);
+	zram_stat64_add(zram, &zram->stats.comp_bytes, clen);
+	zram_stat64_add(zram, &zram->stats.comp_ns, elapsed);
+
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		zram_stream_put(zram, zstrm);
+
+		clen = PAGE_SIZE;
+		entry.page = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!entry.page)) {
+			pr_info("Error allocating memory for "
+				"incompressible page: %u\n", index);
+			return -ENOMEM;
 		}
 
+		zram_set_flag(&entry, ZRAM_UNCOMPRESSED);
+		src = kmap_atomic(page, KM_USER0);
+		cmem = kmap_atomic(entry.page, KM_USER1);
+		memcpy(cmem, src, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+		goto memstore;
+	}
+
+	/* Identical data already stored? Share it. */
+	hash = zram_dedup_hash(src, clen);
+	if (zram_dedup_find(zram, hash, src, clen, &entry)) {
+		zram_stream_put(zram, zstrm);
+		zram_replace_entry(zram, index, &entry);
+
+		zram_stat_inc(zram, &zram->stats.pages_stored);
+		if (clen <= PAGE_SIZE / 2)
+			zram_stat_inc(zram, &zram->stats.good_compress);
+		zram_stat64_inc(zram, &zram->stats.dedup_hits);
+		zram_stat64_add(zram, &zram->stats.dedup_saved, clen);
+		zram_stat_inc(zram, &zram->stats.pages_dedup);
+		return 0;
+	}
+
+	entry.handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader),
+				 GFP_NOIO | __GFP_HIGHMEM);
+	if (!entry.handle) {
+		zram_stream_put(zram, zstrm);
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%zu\n", index, clen);
+		return -ENOMEM;
+	}
+	entry.size = clen;
+
+	cmem = zs_map_object(zram->mem_pool, entry.handle, KM_USER1);
+	zheader = (struct zobj_header *)cmem;
+	zheader->hash = hash;
+	memcpy(cmem + sizeof(*zheader), src, clen);
+	zs_unmap_object(zram->mem_pool, cmem, KM_USER1);
+
+	zram_stream_put(zram, zstrm);
+	zram_dedup_insert(zram, hash, &entry);
+
 memstore:
-		zram->table[index].offset = offset;
+	zram_replace_entry(zram, index, &entry);
+
+	/* Update stats */
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	zram_stat_inc(zram, &zram->stats.pages_stored);
+	if (zram_test_flag(&entry, ZRAM_UNCOMPRESSED))
+		zram_stat_inc(zram, &zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(zram, &zram->stats.good_compress);
+
+	/* Incompressible pages are not worth their memory */
+	if (zram_test_flag(&entry, ZRAM_UNCOMPRESSED) && zram->wb_bdev)
+		queue_work(zram->wb_wq, &zram->wb_work);
+
+	return 0;
+}
+
+/*
+ * Move the page at 'index' to block 'blk' of the backing device, using
+ * 'page' as a bounce buffer. The entry is flagged ZRAM_UNDER_WB first; a
+ * write replacing it meanwhile drops the flag, and the copy on the
+ * backing device is then thrown away.
+ */
+static int zram_writeback_page(struct zram *zram, u32 index,
+			       struct page *page, unsigned long blk)
+{
+	int ret;
+	struct table *entry, old;
+
+	write_lock(&zram->table_lock);
+	entry = &zram->table[index];
+	if (!entry->handle || zram_test_flag(entry, ZRAM_WB)) {
+		write_unlock(&zram->table_lock);
+		return -EBUSY;
+	}
+	zram_set_flag(entry, ZRAM_UNDER_WB);
+	write_unlock(&zram->table_lock);
+
+	ret = zram_read_page(zram, page, index, 0);
+	if (!ret)
+		ret = zram_wb_rw(zram, WRITE_SYNC, page, blk);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	write_lock(&zram->table_lock);
+	if (!zram_test_flag(entry, ZRAM_UNDER_WB)) {
+		write_unlock(&zram->table_lock);
+		return -EBUSY;
+	}
+	if (ret) {
+		zram_clear_flag(entry, ZRAM_UNDER_WB);
+		write_unlock(&zram->table_lock);
+		return ret;
+	}
+	old = *entry;
+	memset(entry, 0, sizeof(*entry));
+	entry->handle = blk;
+	zram_set_flag(entry, ZRAM_WB);
+	write_unlock(&zram->table_lock);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
+	zram_free_entry(zram, &old);
+
+	zram_stat_inc(zram, &zram->stats.pages_stored);
+	zram_stat_inc(zram, &zram->stats.pages_wb);
+	zram_stat64_inc(zram, &zram->stats.wb_writes);
+
+	return 0;
+}
+
+/**
+ * zram_writeback - Move pages out to the backing device.
+ * @zram: device with a backing device
+ * @aging: also age all pages by one wb_age_interval
+ *
+ * Writes back incompressible pages, and pages that were not accessed
+ * for wb_idle_age seconds, until the backing device is full. Sleeps.
+ */
+void zram_writeback(struct zram *zram, int aging)
+{
+	int eligible;
+	size_t index;
+	unsigned int idle_age = 0;
+	unsigned long blk = 0;
+	struct table *entry;
+	struct page *page;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return;
+
+	if (zram->wb_idle_age)
+		idle_age = min_t(unsigned int, (u8)~0,
+			DIV_ROUND_UP(zram->wb_idle_age, wb_age_interval));
+
+	mutex_lock(&zram->wb_mutex);
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		eligible = 0;
+
+		read_lock(&zram->table_lock);
+		entry = &zram->table[index];
+		if (entry->handle && !zram_test_flag(entry, ZRAM_WB)) {
+			/* Readers reset it without the write lock */
+			if (aging && entry->age != (u8)~0)
+				entry->age++;
+			eligible = zram_test_flag(entry, ZRAM_UNCOMPRESSED) ||
+				(idle_age && entry->age >= idle_age);
 		}
-#endif
+		read_unlock(&zram->table_lock);
 
-		memcpy(cmem, src, clen);
+		if (eligible && !blk)
+			blk = zram_wb_alloc_block(zram);
+		if (eligible && blk &&
+		    !zram_writeback_page(zram, index, page, blk))
+			blk = 0;
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+		cond_resched();
+	}
+	if (blk)
+		zram_wb_free_block(zram, blk);
+	mutex_unlock(&zram->wb_mutex);
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	__free_page(page);
+}
+
+static void zram_wb_read_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, wb_read_work);
+	struct bio_list bios;
+	struct bio *bio;
+
+	spin_lock(&zram->wb_lock);
+	bios = zram->wb_bios;
+	bio_list_init(&zram->wb_bios);
+	spin_unlock(&zram->wb_lock);
+
+	while ((bio = bio_list_pop(&bios)))
+		zram_read(zram, bio, 1);
+}
+
+static void zram_wb_work(struct work_struct *work)
+{
+	zram_writeback(container_of(work, struct zram, wb_work), 0);
+}
+
+static void zram_wb_age_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram,
+					 wb_age_work.work);
+
+	zram_writeback(zram, 1);
+	queue_delayed_work(zram->wb_wq, &zram->wb_age_work,
+			   wb_age_interval * HZ);
+}
+
+static int zram_write(struct zram *zram, struct bio *bio)
+{
+	int i, ret;
+	u32 index;
+	struct bio_vec *bvec;
 
-		mutex_unlock(&zram->lock);
+	if (unlikely(!zram->init_done)) {
+		ret = zram_init_device(zram);
+		if (ret)
+			goto out;
+	}
+
+	zram_stat64_inc(zram, &zram->stats.num_writes);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_write_page(zram, bvec->bv_page, index)) {
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			goto out;
+		}
 		index++;
 	}
 
@@ -443,7 +803,7 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 
 	switch (bio_data_dir(bio)) {
 	case READ:
-		ret = zram_read(zram, bio);
+		ret = zram_read(zram, bio, 0);
 		break;
 
 	case WRITE:
@@ -461,34 +821,35 @@ void zram_reset_device(struct zram *zram)
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	/* Stop writeback before the table goes away */
+	if (zram->wb_bdev) {
+		cancel_delayed_work_sync(&zram->wb_age_work);
+		cancel_work_sync(&zram->wb_work);
+		flush_workqueue(zram->wb_wq);
+	}
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free various per-device buffers */
+	zram_destroy_streams(zram);
 
-	/* Free all pages that are still in this zram device */
+	/*
+	 * Free all pages that are still in this zram device, going through
+	 * zram_free_entry() so that shared objects are freed only once.
+	 */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+		if (!zram->table[index].handle)
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		zram_free_entry(zram, &zram->table[index]);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	zram_dedup_destroy(zram);
+	zram_wb_close(zram);
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -512,17 +873,14 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	if (!zram->max_streams)
+		zram->max_streams = num_online_cpus();
+	if (!zram->backend)
+		zram->backend = zram_default_backend();
+	ret = zram_create_streams(zram, zram->max_streams);
+	if (ret) {
+		pr_err("Error allocating %u compression streams\n",
+			zram->max_streams);
 		goto fail;
 	}
 
@@ -542,13 +900,23 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	ret = zram_dedup_init(zram, num_pages);
+	if (ret) {
+		pr_err("Error allocating dedup table\n");
+		goto fail;
+	}
+
+	zram->mem_pool = zs_create_pool();
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
+	if (zram->wb_bdev)
+		queue_delayed_work(zram->wb_wq, &zram->wb_age_work,
+				   wb_age_interval * HZ);
+
 	zram->init_done = 1;
 	mutex_unlock(&zram->init_lock);
 
@@ -581,9 +949,20 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	rwlock_init(&zram->table_lock);
+	spin_lock_init(&zram->dedup_lock);
+	spin_lock_init(&zram->wb_lock);
+	bio_list_init(&zram->wb_bios);
+	mutex_init(&zram->wb_mutex);
+	INIT_WORK(&zram->wb_read_work, zram_wb_read_work);
+	INIT_WORK(&zram->wb_work, zram_wb_work);
+	INIT_DELAYED_WORK(&zram->wb_age_work, zram_wb_age_work);
+	zram->backend = zram_default_backend();
+	spin_lock_init(&zram->streams.lock);
+	INIT_LIST_HEAD(&zram->streams.idle);
+	init_waitqueue_head(&zram->streams.wait);
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -718,6 +1097,7 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_wb_close(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
@@ -15,10 +15,13 @@
 #ifndef _ZRAM_DRV_H_
 #define _ZRAM_DRV_H_
 
+#include <linux/bio.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -29,13 +32,11 @@ static const unsigned max_num_devices = 32;
 /*
  * Stored at beginning of each compressed object.
  *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
+ * No back-reference to the table entry is needed for defragmentation:
+ * zsmalloc moves objects by updating their handles.
  */
 struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
+	u32 hash;	/* of the compressed data, see zram_dedup.c */
 };
 
 /*-- Configurable parameters */
@@ -49,10 +50,16 @@ static const unsigned default_disksize_perc_ram = 25;
  */
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
+/*
+ * With a backing device, pages are aged once per this many seconds to
+ * find the idle ones to write back. See zram_writeback().
+ */
+static const unsigned wb_age_interval = 30;
+
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -70,6 +77,12 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page is on the backing device; handle is its block number */
+	ZRAM_WB,
+
+	/* Page is being written back; cleared if the entry is replaced */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -77,9 +90,12 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	union {
+		unsigned long handle;	/* compressed object in mem_pool */
+		struct page *page;	/* if ZRAM_UNCOMPRESSED */
+	};
+	u16 size;	/* compressed size, zobj_header excluded */
+	u8 age;		/* wb_age_interval periods since last access */
 	u8 flags;
 } __attribute__((aligned(4)));
 
@@ -95,16 +111,85 @@ struct zram_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	/* backend performance, counting every page ever compressed */
+	u64 comp_pages;		/* pages run through the compressor */
+	u64 comp_bytes;		/* total compressed output */
+	u64 comp_ns;		/* total compression time */
+	u64 decomp_pages;	/* pages decompressed */
+	u64 decomp_ns;		/* total decompression time */
+	u64 dedup_hits;		/* writes that shared a stored object */
+	u64 dedup_saved;	/* bytes not stored thanks to sharing */
+	u32 pages_dedup;	/* pages currently sharing an object */
+	u32 pages_wb;		/* pages on the backing device */
+	u64 wb_reads;		/* pages read from the backing device */
+	u64 wb_writes;		/* pages written to the backing device */
+};
+
+/*
+ * A compression backend. Each stream gets its own private state from
+ * create(); compress() gets the page in 'src' and the capacity of 'dst'
+ * in *dst_len, and returns 0 with the compressed length in *dst_len.
+ */
+struct zram_backend {
+	const char *name;
+	void *(*create)(void);
+	void (*destroy)(void *private);
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private);
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			  unsigned char *dst, void *private);
+	unsigned decompress_needs_stream:1; /* else 'private' is NULL */
+};
+
+/*
+ * A compression stream: private buffers for one compression in flight.
+ * Writers take an idle stream from the pool, so up to 'count' pages are
+ * compressed in parallel.
+ */
+struct zram_stream {
+	struct list_head list;	/* on pool->idle when not in use */
+	void *private;		/* backend state */
+	void *buffer;		/* compressed output, two pages */
+	u64 pages;		/* pages compressed by this stream */
+	u64 busy_ns;		/* time spent compressing */
+};
+
+struct zram_stream_pool {
+	spinlock_t lock;	/* protect idle list */
+	struct list_head idle;
+	wait_queue_head_t wait;	/* writers waiting for an idle stream */
+	struct zram_stream *streams;
+	unsigned int count;
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	const struct zram_backend *backend; /* set before init */
+	struct zram_stream_pool streams;
+	unsigned int max_streams;	/* streams to create at init */
 	struct table *table;
-	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t table_lock;	/* protect table entries: readers hold it
+				 * while decompressing, writers only to swap
+				 * entries */
+	struct hlist_head *dedup_table;	/* compressed objects by hash */
+	unsigned long dedup_mask;
+	spinlock_t dedup_lock;	/* protect dedup_table and refcounts */
+	spinlock_t stat64_lock;	/* protect stats */
+
+	/* Optional backing device, see zram_wb.c */
+	struct block_device *wb_bdev;
+	char *wb_path;
+	unsigned long *wb_bitmap;	/* blocks in use */
+	unsigned long wb_nr_blocks;
+	spinlock_t wb_lock;	/* protect wb_bitmap and wb_bios */
+	struct bio_list wb_bios;	/* reads waiting for wb_read_work */
+	struct workqueue_struct *wb_wq;
+	struct work_struct wb_read_work;
+	struct work_struct wb_work;	/* write back incompressible pages */
+	struct delayed_work wb_age_work; /* ... and age idle ones */
+	struct mutex wb_mutex;	/* serialize writeback passes */
+	unsigned int wb_idle_age;	/* seconds, 0 to keep idle pages */
+
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -125,6 +210,27 @@ extern unsigned int num_devices;
 extern struct attribute_group zram_disk_attr_group;
 #endif
 
+extern const struct zram_backend *zram_default_backend(void);
+extern const struct zram_backend *zram_backend_find(const char *name);
+extern ssize_t zram_backend_list(const struct zram_backend *cur, char *buf);
+
+extern u32 zram_dedup_hash(const void *data, size_t len);
+extern int zram_dedup_find(struct zram *zram, u32 hash, const void *data,
+			   size_t len, struct table *entry);
+extern void zram_dedup_insert(struct zram *zram, u32 hash,
+			      struct table *entry);
+extern u32 zram_dedup_put(struct zram *zram, u32 hash, struct table *entry);
+extern int zram_dedup_init(struct zram *zram, size_t num_pages);
+extern void zram_dedup_destroy(struct zram *zram);
+
+extern int zram_wb_open(struct zram *zram, const char *path);
+extern void zram_wb_close(struct zram *zram);
+extern unsigned long zram_wb_alloc_block(struct zram *zram);
+extern void zram_wb_free_block(struct zram *zram, unsigned long blk);
+extern int zram_wb_rw(struct zram *zram, int rw, struct page *page,
+		      unsigned long blk);
+extern void zram_writeback(struct zram *zram, int aging);
+
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
 
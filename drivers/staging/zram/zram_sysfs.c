@@ -14,6 +14,9 @@
 
 #include <linux/device.h>
 #include <linux/genhd.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/string.h>
 
 #include "zram_drv.h"
 
@@ -113,6 +116,122 @@ static ssize_t reset_store(struct device *dev,
 	return len;
 }
 
+static ssize_t max_comp_streams_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->init_done ?
+		zram->streams.count : zram->max_streams);
+}
+
+static ssize_t max_comp_streams_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long num;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done) {
+		pr_info("Cannot change max_comp_streams for initialized "
+			"device\n");
+		return -EBUSY;
+	}
+
+	ret = strict_strtoul(buf, 10, &num);
+	if (ret)
+		return ret;
+
+	if (!num)
+		return -EINVAL;
+
+	zram->max_streams = num;
+
+	return len;
+}
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return zram_backend_list(zram->backend, buf);
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	const struct zram_backend *backend;
+	struct zram *zram = dev_to_zram(dev);
+
+	backend = zram_backend_find(buf);
+	if (!backend)
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		pr_info("Cannot change comp_algorithm for initialized "
+			"device\n");
+		return -EBUSY;
+	}
+	zram->backend = backend;
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static u64 zram_div_or_zero(u64 n, u64 d)
+{
+	return d ? div64_u64(n, d) : 0;
+}
+
+/*
+ * Backend performance since init: pages compressed, compressed size as
+ * a percentage of the input, average compression and decompression
+ * time per page in ns.
+ */
+static ssize_t comp_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 pages, bytes, comp_ns, decomp_pages, decomp_ns;
+
+	spin_lock(&zram->stat64_lock);
+	pages = zram->stats.comp_pages;
+	bytes = zram->stats.comp_bytes;
+	comp_ns = zram->stats.comp_ns;
+	decomp_pages = zram->stats.decomp_pages;
+	decomp_ns = zram->stats.decomp_ns;
+	spin_unlock(&zram->stat64_lock);
+
+	return sprintf(buf, "%s %llu %llu %llu %llu\n", zram->backend->name,
+		pages, zram_div_or_zero(bytes * 100, pages << PAGE_SHIFT),
+		zram_div_or_zero(comp_ns, pages),
+		zram_div_or_zero(decomp_ns, decomp_pages));
+}
+
+/* one line per stream: pages compressed and time spent compressing */
+static ssize_t comp_streams_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	unsigned int i;
+	ssize_t len = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	for (i = 0; i < zram->streams.count; i++) {
+		struct zram_stream *zstrm = &zram->streams.streams[i];
+
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+			"%u %llu %llu\n", i, zstrm->pages,
+			div_u64(zstrm->busy_ns, NSEC_PER_USEC));
+	}
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
 static ssize_t num_reads_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -175,6 +294,186 @@ static ssize_t compr_data_size_show(struct device *dev,
 		zram_stat64_read(zram, &zram->stats.compr_size));
 }
 
+static ssize_t dedup_hits_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_hits));
+}
+
+static ssize_t dedup_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->stats.pages_dedup);
+}
+
+static ssize_t dedup_saved_size_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_saved));
+}
+
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	ssize_t ret;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	ret = sprintf(buf, "%s\n", zram->wb_path ? zram->wb_path : "none");
+	mutex_unlock(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret = 0;
+	char *path;
+	struct zram *zram = dev_to_zram(dev);
+
+	path = kstrdup(buf, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change backing_dev for initialized device\n");
+		ret = -EBUSY;
+		goto out;
+	}
+
+	zram_wb_close(zram);
+	if (strcmp(strim(path), "none"))
+		ret = zram_wb_open(zram, strim(path));
+
+out:
+	mutex_unlock(&zram->init_lock);
+	kfree(path);
+
+	return ret ? ret : len;
+}
+
+static ssize_t writeback_idle_age_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->wb_idle_age);
+}
+
+static ssize_t writeback_idle_age_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long secs;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &secs);
+	if (ret)
+		return ret;
+
+	zram->wb_idle_age = secs;
+
+	return len;
+}
+
+/* Write back now instead of waiting for the next aging pass */
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret = len;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done && zram->wb_bdev)
+		zram_writeback(zram, 0);
+	else
+		ret = -EINVAL;
+	mutex_unlock(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t wb_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", zram->stats.pages_wb);
+}
+
+static ssize_t wb_reads_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.wb_reads));
+}
+
+static ssize_t wb_writes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.wb_writes));
+}
+
+/* Move objects around to give fragmented pages back to the system */
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		return -EINVAL;
+	}
+	zs_compact(zram->mem_pool);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t pages_compacted_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 pages = 0, objs = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		zs_get_compact_stats(zram->mem_pool, &pages, &objs);
+	mutex_unlock(&zram->init_lock);
+
+	return sprintf(buf, "%llu\n", pages);
+}
+
+static ssize_t objs_migrated_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 pages = 0, objs = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		zs_get_compact_stats(zram->mem_pool, &pages, &objs);
+	mutex_unlock(&zram->init_lock);
+
+	return sprintf(buf, "%llu\n", objs);
+}
+
 static ssize_t mem_used_total_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -182,7 +481,7 @@ static ssize_t mem_used_total_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	if (zram->init_done) {
-		val = xv_get_total_size_bytes(zram->mem_pool) +
+		val = zs_get_total_size_bytes(zram->mem_pool) +
 			((u64)(zram->stats.pages_expand) << PAGE_SHIFT);
 	}
 
@@ -192,6 +491,12 @@ static ssize_t mem_used_total_show(struct device *dev,
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
 		disksize_show, disksize_store);
 static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
+static DEVICE_ATTR(max_comp_streams, S_IRUGO | S_IWUSR,
+		max_comp_streams_show, max_comp_streams_store);
+static DEVICE_ATTR(comp_streams, S_IRUGO, comp_streams_show, NULL);
+static DEVICE_ATTR(comp_algorithm, S_IRUGO | S_IWUSR,
+		comp_algorithm_show, comp_algorithm_store);
+static DEVICE_ATTR(comp_stats, S_IRUGO, comp_stats_show, NULL);
 static DEVICE_ATTR(reset, S_IWUSR, NULL, reset_store);
 static DEVICE_ATTR(num_reads, S_IRUGO, num_reads_show, NULL);
 static DEVICE_ATTR(num_writes, S_IRUGO, num_writes_show, NULL);
@@ -200,11 +505,29 @@ static DEVICE_ATTR(notify_free, S_IRUGO, notify_free_show, NULL);
 static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
+static DEVICE_ATTR(dedup_hits, S_IRUGO, dedup_hits_show, NULL);
+static DEVICE_ATTR(dedup_pages, S_IRUGO, dedup_pages_show, NULL);
+static DEVICE_ATTR(dedup_saved_size, S_IRUGO, dedup_saved_size_show, NULL);
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
+static DEVICE_ATTR(writeback_idle_age, S_IRUGO | S_IWUSR,
+		writeback_idle_age_show, writeback_idle_age_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+static DEVICE_ATTR(wb_pages, S_IRUGO, wb_pages_show, NULL);
+static DEVICE_ATTR(wb_reads, S_IRUGO, wb_reads_show, NULL);
+static DEVICE_ATTR(wb_writes, S_IRUGO, wb_writes_show, NULL);
+static DEVICE_ATTR(compact, S_IWUSR, NULL, compact_store);
+static DEVICE_ATTR(pages_compacted, S_IRUGO, pages_compacted_show, NULL);
+static DEVICE_ATTR(objs_migrated, S_IRUGO, objs_migrated_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
 	&dev_attr_initstate.attr,
+	&dev_attr_max_comp_streams.attr,
+	&dev_attr_comp_streams.attr,
+	&dev_attr_comp_algorithm.attr,
+	&dev_attr_comp_stats.attr,
 	&dev_attr_reset.attr,
 	&dev_attr_num_reads.attr,
 	&dev_attr_num_writes.attr,
@@ -213,6 +536,18 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_zero_pages.attr,
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
+	&dev_attr_dedup_hits.attr,
+	&dev_attr_dedup_pages.attr,
+	&dev_attr_dedup_saved_size.attr,
+	&dev_attr_backing_dev.attr,
+	&dev_attr_writeback_idle_age.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_wb_pages.attr,
+	&dev_attr_wb_reads.attr,
+	&dev_attr_wb_writes.attr,
+	&dev_attr_compact.attr,
+	&dev_attr_pages_compacted.attr,
+	&dev_attr_objs_migrated.attr,
 	&dev_attr_mem_used_total.attr,
 	NULL,
 };
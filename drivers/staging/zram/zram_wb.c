@@ -0,0 +1,175 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com/
+ */
+
+/*
+ * Backing device for writeback. Pages zram does not want to keep in
+ * memory are written, uncompressed, to page sized blocks of an ordinary
+ * block device; a bitmap tracks the blocks in use. Block 0 is never
+ * handed out, so a block number is never confused with an empty table
+ * entry.
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/bitops.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "zram_drv.h"
+
+#define ZRAM_WB_FMODE	(FMODE_READ | FMODE_WRITE)
+
+int zram_wb_open(struct zram *zram, const char *path)
+{
+	int ret;
+	unsigned long nr_blocks;
+	unsigned long *bitmap;
+	char *wb_path;
+	struct block_device *bdev;
+	struct workqueue_struct *wq;
+
+	bdev = open_bdev_exclusive(path, ZRAM_WB_FMODE, zram);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_blocks < 2) {
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	ret = -ENOMEM;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap)
+		goto fail;
+
+	wb_path = kstrdup(path, GFP_KERNEL);
+	if (!wb_path)
+		goto free_bitmap;
+
+	/* Reads and writes of the backing device must not wait on reclaim */
+	wq = alloc_workqueue("zram_wb", WQ_MEM_RECLAIM, 0);
+	if (!wq)
+		goto free_path;
+
+	__set_bit(0, bitmap);
+	zram->wb_bdev = bdev;
+	zram->wb_path = wb_path;
+	zram->wb_bitmap = bitmap;
+	zram->wb_nr_blocks = nr_blocks;
+	zram->wb_wq = wq;
+
+	pr_info("Writeback to %s, %lu pages\n", path, nr_blocks - 1);
+	return 0;
+
+free_path:
+	kfree(wb_path);
+free_bitmap:
+	vfree(bitmap);
+fail:
+	close_bdev_exclusive(bdev, ZRAM_WB_FMODE);
+	return ret;
+}
+
+/* Called once no entry refers to the backing device any more */
+void zram_wb_close(struct zram *zram)
+{
+	if (!zram->wb_bdev)
+		return;
+
+	destroy_workqueue(zram->wb_wq);
+	zram->wb_wq = NULL;
+
+	vfree(zram->wb_bitmap);
+	zram->wb_bitmap = NULL;
+	zram->wb_nr_blocks = 0;
+
+	close_bdev_exclusive(zram->wb_bdev, ZRAM_WB_FMODE);
+	zram->wb_bdev = NULL;
+
+	kfree(zram->wb_path);
+	zram->wb_path = NULL;
+}
+
+/* Returns a free block, or 0 if the backing device is full */
+unsigned long zram_wb_alloc_block(struct zram *zram)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->wb_lock);
+	blk = find_first_zero_bit(zram->wb_bitmap, zram->wb_nr_blocks);
+	if (blk < zram->wb_nr_blocks)
+		__set_bit(blk, zram->wb_bitmap);
+	else
+		blk = 0;
+	spin_unlock(&zram->wb_lock);
+
+	return blk;
+}
+
+void zram_wb_free_block(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->wb_lock);
+	WARN_ON(!test_bit(blk, zram->wb_bitmap));
+	__clear_bit(blk, zram->wb_bitmap);
+	spin_unlock(&zram->wb_lock);
+}
+
+static void zram_wb_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/*
+ * Synchronously read or write one page at block 'blk'. This sleeps, so it
+ * must not be called from zram_make_request(): bios submitted from there
+ * are only issued once it returns.
+ */
+int zram_wb_rw(struct zram *zram, int rw, struct page *page,
+	       unsigned long blk)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->wb_bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_wb_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
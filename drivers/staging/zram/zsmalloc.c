@@ -0,0 +1,413 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped into size classes ZS_ALIGN bytes apart, and each
+ * class carves its objects out of zspages holding objects of that size
+ * only. Unlike a free-list allocator, this lets live objects be moved:
+ * compaction packs the objects of sparsely used zspages into the fuller
+ * ones of the same class and gives the emptied zspages back to the
+ * system. Users only ever hold handles, which compaction updates.
+ */
+
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/list_sort.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static unsigned int get_class_index(size_t size)
+{
+	size = max_t(size_t, size + ZS_HANDLE_SIZE, ZS_MIN_ALLOC_SIZE);
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_ALIGN);
+}
+
+/*
+ * Pick the zspage order that wastes the least space per page after the
+ * last object. Ties go to the lower order.
+ */
+static unsigned int get_zspage_order(unsigned int size)
+{
+	unsigned int order, best_order = 0;
+	unsigned long waste, best_waste = ULONG_MAX;
+
+	for (order = 0; order <= ZS_MAX_ORDER; order++) {
+		waste = ((PAGE_SIZE << order) % size) >> order;
+		if (waste < best_waste) {
+			best_waste = waste;
+			best_order = order;
+		}
+	}
+
+	return best_order;
+}
+
+static struct zs_page *alloc_zspage(struct zs_pool *pool,
+			struct size_class *class, gfp_t flags)
+{
+	unsigned int order = class->order, objs;
+	struct page *page = NULL;
+	struct zs_page *zspage;
+
+	/* Multi-page zspages are addressed linearly, so no highmem */
+	if (order)
+		page = alloc_pages((flags & ~__GFP_HIGHMEM) | __GFP_NOWARN |
+				   __GFP_NORETRY, order);
+	if (!page) {
+		order = 0;
+		page = alloc_page(flags);
+		if (unlikely(!page))
+			return NULL;
+	}
+
+	objs = (PAGE_SIZE << order) / class->size;
+	zspage = kzalloc(sizeof(*zspage) + BITS_TO_LONGS(objs) * sizeof(long),
+			 flags & ~__GFP_HIGHMEM);
+	if (unlikely(!zspage)) {
+		__free_pages(page, order);
+		return NULL;
+	}
+
+	zspage->page = page;
+	zspage->order = order;
+	zspage->objs = objs;
+	atomic_long_add(1 << order, &pool->total_pages);
+
+	return zspage;
+}
+
+static void free_zspage(struct zs_pool *pool, struct zs_page *zspage)
+{
+	atomic_long_sub(1 << zspage->order, &pool->total_pages);
+	__free_pages(zspage->page, zspage->order);
+	kfree(zspage);
+}
+
+/*
+ * Move one object from 'src' to a free slot of 'dst' and point its handle
+ * at the new place. Called with class->lock held.
+ */
+static void migrate_obj(struct zs_pool *pool, struct size_class *class,
+			struct zs_page *src, unsigned int slot,
+			struct zs_page *dst)
+{
+	unsigned int dslot;
+	struct zs_handle *handle;
+	unsigned char *s, *d;
+
+	dslot = find_first_zero_bit(dst->used, dst->objs);
+
+	s = kmap_atomic(src->page, KM_USER0) + slot * class->size;
+	d = kmap_atomic(dst->page, KM_USER1) + dslot * class->size;
+	handle = (struct zs_handle *)*(unsigned long *)s;
+
+	write_lock(&pool->migrate_lock);
+	memcpy(d, s, class->size);
+	handle->zspage = dst;
+	handle->slot = dslot;
+	write_unlock(&pool->migrate_lock);
+
+	kunmap_atomic(d, KM_USER1);
+	kunmap_atomic(s, KM_USER0);
+
+	__clear_bit(slot, src->used);
+	src->inuse--;
+	__set_bit(dslot, dst->used);
+	if (++dst->inuse == dst->objs)
+		list_move(&dst->list, &class->full);
+}
+
+/* Fullest zspages first */
+static int zspage_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	return (int)list_entry(b, struct zs_page, list)->inuse -
+		(int)list_entry(a, struct zs_page, list)->inuse;
+}
+
+/*
+ * Empty the least used zspages of a class into the most used ones for as
+ * long as that frees a zspage. Returns the number of pages freed.
+ */
+static unsigned long compact_class(struct zs_pool *pool,
+			struct size_class *class)
+{
+	unsigned int slot;
+	unsigned long freed = 0;
+	struct zs_page *src, *dst;
+
+	spin_lock(&class->lock);
+	list_sort(NULL, &class->partial, zspage_cmp);
+
+	while (!list_empty(&class->partial)) {
+		src = list_entry(class->partial.prev, struct zs_page, list);
+
+		/* Can the other partial zspages take all of src? */
+		if (class->free_objs - (src->objs - src->inuse) < src->inuse)
+			break;
+
+		/* ... yes, so the head of the list is never src */
+		for_each_set_bit(slot, src->used, src->objs) {
+			dst = list_first_entry(&class->partial,
+					       struct zs_page, list);
+			migrate_obj(pool, class, src, slot, dst);
+			pool->objs_migrated++;
+		}
+
+		list_del(&src->list);
+		class->free_objs -= src->objs;
+		spin_unlock(&class->lock);
+
+		freed += 1 << src->order;
+		free_zspage(pool, src);
+
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Move objects to free as many zspages as possible.
+ * @pool: pool to compact
+ *
+ * May sleep. Objects mapped with zs_map_object() are not moved until they
+ * are unmapped. Returns the number of pages given back to the system.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned int i;
+	unsigned long freed = 0;
+
+	mutex_lock(&pool->compact_lock);
+	for (i = 0; i < ZS_NR_CLASSES; i++)
+		freed += compact_class(pool, &pool->classes[i]);
+	pool->pages_compacted += freed;
+	mutex_unlock(&pool->compact_lock);
+
+	return freed;
+}
+
+static void zs_compact_work(struct work_struct *work)
+{
+	struct zs_pool *pool = container_of(work, struct zs_pool,
+					    compact_work);
+
+	zs_compact(pool);
+}
+
+/*
+ * Create a memory pool. Sets up the size classes; no memory is allocated
+ * for objects until the first zs_malloc().
+ */
+struct zs_pool *zs_create_pool(void)
+{
+	unsigned int i;
+	struct zs_pool *pool;
+
+	pool = vzalloc(sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_NR_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		spin_lock_init(&class->lock);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_ALIGN;
+		class->order = get_zspage_order(class->size);
+		INIT_LIST_HEAD(&class->partial);
+		INIT_LIST_HEAD(&class->full);
+	}
+
+	rwlock_init(&pool->migrate_lock);
+	mutex_init(&pool->compact_lock);
+	INIT_WORK(&pool->compact_work, zs_compact_work);
+
+	return pool;
+}
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	unsigned int i;
+	struct zs_page *zspage, *tmp;
+
+	cancel_work_sync(&pool->compact_work);
+
+	for (i = 0; i < ZS_NR_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		WARN_ON(!list_empty(&class->partial) ||
+			!list_empty(&class->full));
+
+		list_splice_init(&class->full, &class->partial);
+		list_for_each_entry_safe(zspage, tmp, &class->partial, list)
+			free_zspage(pool, zspage);
+	}
+
+	vfree(pool);
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @flags: allocation flags, __GFP_HIGHMEM allowed
+ *
+ * On success, returns a handle for the object, to be passed to
+ * zs_map_object() to get at its contents. On failure, returns 0.
+ *
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	unsigned int slot;
+	unsigned char *obj;
+	struct zs_page *zspage;
+	struct zs_handle *handle;
+	struct size_class *class;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return 0;
+
+	handle = kmalloc(sizeof(*handle), flags & ~__GFP_HIGHMEM);
+	if (unlikely(!handle))
+		return 0;
+
+	handle->class = get_class_index(size);
+	class = &pool->classes[handle->class];
+
+	spin_lock(&class->lock);
+	if (list_empty(&class->partial)) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class, flags);
+		if (unlikely(!zspage)) {
+			kfree(handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		list_add(&zspage->list, &class->partial);
+		class->free_objs += zspage->objs;
+	}
+
+	zspage = list_first_entry(&class->partial, struct zs_page, list);
+	slot = find_first_zero_bit(zspage->used, zspage->objs);
+	__set_bit(slot, zspage->used);
+	class->free_objs--;
+	if (++zspage->inuse == zspage->objs)
+		list_move(&zspage->list, &class->full);
+
+	handle->zspage = zspage;
+	handle->slot = slot;
+
+	obj = kmap_atomic(zspage->page, KM_USER0) + slot * class->size;
+	*(unsigned long *)obj = (unsigned long)handle;
+	kunmap_atomic(obj, KM_USER0);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+
+/*
+ * Free block identified with 'handle'
+ */
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	int compact = 0;
+	struct zs_page *zspage;
+	struct size_class *class;
+	struct zs_handle *h = (struct zs_handle *)handle;
+
+	class = &pool->classes[h->class];
+
+	spin_lock(&class->lock);
+	zspage = h->zspage;
+
+	/* Catch double free bugs */
+	BUG_ON(!test_bit(h->slot, zspage->used));
+	__clear_bit(h->slot, zspage->used);
+
+	if (zspage->inuse-- == zspage->objs)
+		list_move(&zspage->list, &class->partial);
+	class->free_objs++;
+
+	/* No used objects in this zspage. Free it. */
+	if (!zspage->inuse) {
+		list_del(&zspage->list);
+		class->free_objs -= zspage->objs;
+		spin_unlock(&class->lock);
+
+		free_zspage(pool, zspage);
+		kfree(h);
+		return;
+	}
+
+	compact = class->free_objs >= ZS_COMPACT_THRESHOLD * zspage->objs;
+	spin_unlock(&class->lock);
+
+	kfree(h);
+	if (compact)
+		schedule_work(&pool->compact_work);
+}
+
+/**
+ * zs_map_object - Get a pointer to the contents of an object.
+ * @pool: pool the object was allocated from
+ * @handle: handle returned by zs_malloc()
+ * @type: kmap_atomic() slot to use
+ *
+ * The object stays in place until zs_unmap_object(); the caller must not
+ * sleep in between.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum km_type type)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	unsigned char *obj;
+
+	read_lock(&pool->migrate_lock);
+	obj = kmap_atomic(h->zspage->page, type);
+
+	return obj + h->slot * pool->classes[h->class].size + ZS_HANDLE_SIZE;
+}
+
+void zs_unmap_object(struct zs_pool *pool, void *obj, enum km_type type)
+{
+	kunmap_atomic(obj, type);
+	read_unlock(&pool->migrate_lock);
+}
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->total_pages) << PAGE_SHIFT;
+}
+
+void zs_get_compact_stats(struct zs_pool *pool, u64 *pages_compacted,
+			u64 *objs_migrated)
+{
+	mutex_lock(&pool->compact_lock);
+	*pages_compacted = pool->pages_compacted;
+	*objs_migrated = pool->objs_migrated;
+	mutex_unlock(&pool->compact_lock);
+}
@@ -0,0 +1,100 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+/* User configurable params */
+
+/* Size classes are separated by ZS_ALIGN bytes. Must be power of two. */
+#define ZS_ALIGN_SHIFT	4
+#define ZS_ALIGN	(1 << ZS_ALIGN_SHIFT)
+
+/* Every object starts with a back-pointer to its handle */
+#define ZS_HANDLE_SIZE	sizeof(unsigned long)
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+#define ZS_NR_CLASSES	((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+				/ ZS_ALIGN + 1)
+
+/*
+ * A zspage is 1 << order physically contiguous pages. Larger zspages
+ * waste less at the end for awkward object sizes, but need lowmem and
+ * can fail under fragmentation, in which case an order 0 zspage is used.
+ */
+#define ZS_MAX_ORDER	2
+
+/*
+ * Background compaction is kicked once the free slots of a class add up
+ * to this many zspages.
+ */
+#define ZS_COMPACT_THRESHOLD	4
+
+/* End of user params */
+
+struct size_class;
+
+/*
+ * What zs_malloc() hands out. Objects are found through their handle
+ * only, so compaction can move them by updating it.
+ */
+struct zs_handle {
+	struct zs_page *zspage;
+	u16 slot;		/* object index within zspage */
+	u16 class;		/* never changes, unlike zspage */
+};
+
+struct zs_page {
+	struct list_head list;	/* on class->partial or class->full */
+	struct page *page;	/* first of 1 << order pages */
+	unsigned int order;
+	unsigned int objs;	/* capacity */
+	unsigned int inuse;
+	unsigned long used[0];	/* bitmap of allocated slots */
+};
+
+struct size_class {
+	spinlock_t lock;	/* protect everything below and handles */
+	unsigned int size;	/* object size, handle included */
+	unsigned int order;	/* preferred zspage order */
+	struct list_head partial;
+	struct list_head full;
+	unsigned long free_objs; /* free slots in partial zspages */
+};
+
+struct zs_pool {
+	struct size_class classes[ZS_NR_CLASSES];
+
+	/*
+	 * Held for reading while an object is mapped, for writing while
+	 * compaction moves one.
+	 */
+	rwlock_t migrate_lock;
+
+	struct work_struct compact_work;
+	struct mutex compact_lock;	/* serialize compaction, protect stats */
+
+	/* stats */
+	atomic_long_t total_pages;
+	u64 pages_compacted;
+	u64 objs_migrated;
+};
+
+#endif
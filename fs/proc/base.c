@@ -1097,6 +1097,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		oom_adj_changed(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1224,6 +1226,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		oom_adj_changed(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
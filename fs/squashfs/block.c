@@ -30,6 +30,7 @@
 #include <linux/vfs.h>
 #include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/percpu.h>
 #include <linux/buffer_head.h>
 
 #include "squashfs_fs.h"
@@ -70,6 +71,31 @@ static struct buffer_head *get_block_length(struct super_block *sb,
 }
 
 
+/*
+ * Start reading the block that follows the one at index, ending at next,
+ * so that its I/O overlaps decompressing this one.  Only done when reads
+ * are sequential, as when a file is read through: random reads would
+ * just waste I/O.  next_read_index is not locked, racing readers at
+ * worst miss or issue one read-ahead.
+ */
+static void squashfs_read_ahead(struct super_block *sb, u64 index, u64 next,
+	int length)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	u64 cur_index, end;
+	int sequential = index == msblk->next_read_index;
+
+	msblk->next_read_index = next;
+	if (!sequential)
+		return;
+
+	end = min_t(u64, next + length, msblk->bytes_used);
+	for (cur_index = next >> msblk->devblksize_log2;
+			(cur_index << msblk->devblksize_log2) < end; cur_index++)
+		sb_breadahead(sb, cur_index);
+}
+
+
 /*
  * Read and decompress a metadata block or datablock.  Length is non-zero
  * if a datablock is being read (the size is stored elsewhere in the
@@ -85,7 +111,7 @@ int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
 	struct buffer_head **bh;
 	int offset = index & ((1 << msblk->devblksize_log2) - 1);
 	u64 cur_index = index >> msblk->devblksize_log2;
-	int bytes, compressed, b = 0, k = 0, page = 0, avail;
+	int bytes, compressed, b = 0, i, k = 0, page = 0, avail;
 
 	bh = kcalloc(((srclength + msblk->devblksize - 1)
 		>> msblk->devblksize_log2) + 1, sizeof(*bh), GFP_KERNEL);
@@ -116,6 +142,7 @@ int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
 			bytes += msblk->devblksize;
 		}
 		ll_rw_block(READ, b, bh);
+		squashfs_read_ahead(sb, index, index + length, srclength);
 	} else {
 		/*
 		 * Metadata block.
@@ -148,6 +175,14 @@ int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
 			bytes += msblk->devblksize;
 		}
 		ll_rw_block(READ, b - 1, bh + 1);
+		squashfs_read_ahead(sb, index, index + length + 2,
+			SQUASHFS_METADATA_SIZE + 2);
+	}
+
+	for (i = 0; i < b; i++) {
+		wait_on_buffer(bh[i]);
+		if (!buffer_uptodate(bh[i]))
+			goto block_release;
 	}
 
 	if (compressed) {
@@ -159,13 +194,7 @@ int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
 		/*
 		 * Block is uncompressed.
 		 */
-		int i, in, pg_offset = 0;
-
-		for (i = 0; i < b; i++) {
-			wait_on_buffer(bh[i]);
-			if (!buffer_uptodate(bh[i]))
-				goto block_release;
-		}
+		int in, pg_offset = 0;
 
 		for (bytes = length; k < b; k++) {
 			in = min(bytes, msblk->devblksize - offset);
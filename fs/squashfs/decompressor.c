@@ -23,6 +23,7 @@
 
 #include <linux/types.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/buffer_head.h>
 
 #include "squashfs_fs.h"
@@ -72,3 +73,51 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 
 	return decompressor[i];
 }
+
+
+/*
+ * Every possible CPU gets a stream of its own, so that blocks read on
+ * different CPUs decompress in parallel rather than queueing on a single
+ * stream.  A reader uses the stream of the CPU it is running on.  It can
+ * be migrated while decompressing, so each stream keeps a mutex, but
+ * that is seldom contended.
+ */
+int squashfs_decompressor_create(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *s;
+	int cpu;
+
+	msblk->stream = alloc_percpu(struct squashfs_stream);
+	if (msblk->stream == NULL)
+		goto failed;
+
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(msblk->stream, cpu);
+		mutex_init(&s->mutex);
+		s->stream = msblk->decompressor->init(msblk);
+		if (s->stream == NULL)
+			goto failed;
+	}
+
+	return 0;
+
+failed:
+	squashfs_decompressor_destroy(msblk);
+	return -ENOMEM;
+}
+
+
+void squashfs_decompressor_destroy(struct squashfs_sb_info *msblk)
+{
+	int cpu;
+
+	if (msblk->stream == NULL)
+		return;
+
+	for_each_possible_cpu(cpu)
+		msblk->decompressor->free(per_cpu_ptr(msblk->stream,
+			cpu)->stream);
+
+	free_percpu(msblk->stream);
+	msblk->stream = NULL;
+}
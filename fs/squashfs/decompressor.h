@@ -26,30 +26,36 @@
 struct squashfs_decompressor {
 	void	*(*init)(struct squashfs_sb_info *);
 	void	(*free)(void *);
-	int	(*decompress)(struct squashfs_sb_info *, void **,
+	int	(*decompress)(struct squashfs_sb_info *, void *, void **,
 		struct buffer_head **, int, int, int, int, int);
 	int	id;
 	char	*name;
 	int	supported;
 };
 
-static inline void *squashfs_decompressor_init(struct squashfs_sb_info *msblk)
-{
-	return msblk->decompressor->init(msblk);
-}
-
-static inline void squashfs_decompressor_free(struct squashfs_sb_info *msblk,
-	void *s)
-{
-	if (msblk->decompressor)
-		msblk->decompressor->free(s);
-}
+/* One per possible CPU, see decompressor.c */
+struct squashfs_stream {
+	struct mutex	mutex;
+	void		*stream;
+};
 
+/*
+ * The buffer_heads must be up to date, squashfs_read_data() waits for
+ * them before decompressing.
+ */
 static inline int squashfs_decompress(struct squashfs_sb_info *msblk,
 	void **buffer, struct buffer_head **bh, int b, int offset, int length,
 	int srclength, int pages)
 {
-	return msblk->decompressor->decompress(msblk, buffer, bh, b, offset,
-		length, srclength, pages);
+	struct squashfs_stream *s = per_cpu_ptr(msblk->stream,
+		raw_smp_processor_id());
+	int res;
+
+	mutex_lock(&s->mutex);
+	res = msblk->decompressor->decompress(msblk, s->stream, buffer, bh, b,
+		offset, length, srclength, pages);
+	mutex_unlock(&s->mutex);
+
+	return res;
 }
 #endif
@@ -53,6 +53,8 @@ extern int squashfs_read_table(struct super_block *, void *, u64, int);
 
 /* decompressor.c */
 extern const struct squashfs_decompressor *squashfs_lookup_decompressor(int);
+extern int squashfs_decompressor_create(struct squashfs_sb_info *);
+extern void squashfs_decompressor_destroy(struct squashfs_sb_info *);
 
 /* export.c */
 extern __le64 *squashfs_read_inode_lookup_table(struct super_block *, u64,
@@ -13,6 +13,7 @@
 
 #include "yaffs_checkptrw.h"
 #include "yaffs_getblockinfo.h"
+#include "yaffs_yaffs2.h"
 
 static int yaffs2_checkpt_space_ok(struct yaffs_dev *dev)
 {
@@ -24,6 +25,18 @@ static int yaffs2_checkpt_space_ok(struct yaffs_dev *dev)
 	return (blocks_avail <= 0) ? 0 : 1;
 }
 
+/* Is this checkpoint block part of a delta rather than of the base? */
+static int yaffs2_checkpt_is_delta_block(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_ext_tags tags;
+	int chunk = blk * dev->param.chunks_per_block - dev->chunk_offset;
+
+	dev->param.read_chunk_tags_fn(dev, chunk, NULL, &tags);
+
+	return tags.chunk_id > YAFFS_CHECKPOINT_DELTA_PAGE_SEQ;
+}
+
+/* Erases the whole checkpoint, or only the old delta if writing a delta */
 static int yaffs_checkpt_erase(struct yaffs_dev *dev)
 {
 	int i;
@@ -36,9 +49,12 @@ static int yaffs_checkpt_erase(struct yaffs_dev *dev)
 
 	for (i = dev->internal_start_block; i <= dev->internal_end_block; i++) {
 		struct yaffs_block_info *bi = yaffs_get_block_info(dev, i);
-		if (bi->block_state == YAFFS_BLOCK_STATE_CHECKPOINT) {
+		if (bi->block_state == YAFFS_BLOCK_STATE_CHECKPOINT &&
+		    (!dev->checkpt_delta ||
+		     yaffs2_checkpt_is_delta_block(dev, i))) {
 			yaffs_trace(YAFFS_TRACE_CHECKPOINT,
 			"erasing checkpt block %d", i);
+			yaffs2_checkpt_block_changed(dev, i);
 
 			dev->n_erasures++;
 
@@ -115,7 +131,9 @@ static void yaffs2_checkpt_find_block(struct yaffs_dev *dev)
 				i, tags.obj_id, tags.seq_number,
 				tags.ecc_result);
 
-			if (tags.seq_number == YAFFS_SEQUENCE_CHECKPOINT_DATA) {
+			if (tags.seq_number == YAFFS_SEQUENCE_CHECKPOINT_DATA &&
+			    (tags.chunk_id > YAFFS_CHECKPOINT_DELTA_PAGE_SEQ) ==
+			    !!dev->checkpt_delta) {
 				/* Right kind of block */
 				dev->checkpt_next_block = tags.obj_id;
 				dev->checkpt_cur_block = i;
@@ -154,7 +172,8 @@ int yaffs2_checkpt_open(struct yaffs_dev *dev, int writing)
 	if (!dev->checkpt_buffer)
 		return 0;
 
-	dev->checkpt_page_seq = 0;
+	dev->checkpt_page_seq =
+	    dev->checkpt_delta ? YAFFS_CHECKPOINT_DELTA_PAGE_SEQ : 0;
 	dev->checkpt_byte_count = 0;
 	dev->checkpt_sum = 0;
 	dev->checkpt_xor = 0;
@@ -224,6 +243,7 @@ static int yaffs2_checkpt_flush_buffer(struct yaffs_dev *dev)
 		    yaffs_get_block_info(dev, dev->checkpt_cur_block);
 		bi->block_state = YAFFS_BLOCK_STATE_CHECKPOINT;
 		dev->blocks_in_checkpt++;
+		yaffs2_checkpt_block_changed(dev, dev->checkpt_cur_block);
 	}
 
 	chunk =
@@ -46,6 +46,8 @@
 static int yaffs_wr_data_obj(struct yaffs_obj *in, int inode_chunk,
 			     const u8 * buffer, int n_bytes, int use_reserve);
 
+static void yaffs_gc_index_update(struct yaffs_dev *dev, int block_no);
+
 
 
 /* Function to calculate chunk and offset */
@@ -469,6 +471,7 @@ static int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
 		    dev->alloc_page;
 		bi->pages_in_use++;
 		yaffs_set_chunk_bit(dev, dev->alloc_block, dev->alloc_page);
+		yaffs2_checkpt_block_changed(dev, dev->alloc_block);
 
 		dev->alloc_page++;
 
@@ -477,6 +480,7 @@ static int yaffs_alloc_chunk(struct yaffs_dev *dev, int use_reserver,
 		/* If the block is full set the state to full */
 		if (dev->alloc_page >= dev->param.chunks_per_block) {
 			bi->block_state = YAFFS_BLOCK_STATE_FULL;
+			yaffs_gc_index_update(dev, dev->alloc_block);
 			dev->alloc_block = -1;
 		}
 
@@ -515,6 +519,7 @@ void yaffs_skip_rest_of_block(struct yaffs_dev *dev)
 		    yaffs_get_block_info(dev, dev->alloc_block);
 		if (bi->block_state == YAFFS_BLOCK_STATE_ALLOCATING) {
 			bi->block_state = YAFFS_BLOCK_STATE_FULL;
+			yaffs_gc_index_update(dev, dev->alloc_block);
 			dev->alloc_block = -1;
 		}
 	}
@@ -662,6 +667,7 @@ static void yaffs_retire_block(struct yaffs_dev *dev, int flash_block)
 	bi->block_state = YAFFS_BLOCK_STATE_DEAD;
 	bi->gc_prioritise = 0;
 	bi->needs_retiring = 0;
+	yaffs_gc_index_update(dev, flash_block);
 
 	dev->n_retired_blocks++;
 }
@@ -1057,8 +1063,10 @@ static int yaffs_find_del_file_chunk(struct yaffs_obj *in, int inode_chunk,
 					      inode_chunk);
 
 		/* Delete the entry in the filestructure (if found) */
-		if (ret_val != -1)
+		if (ret_val != -1) {
 			yaffs_load_tnode_0(dev, tn, inode_chunk, 0);
+			yaffs2_checkpt_obj_changed(in);
+		}
 	}
 
 	return ret_val;
@@ -1184,6 +1192,7 @@ int yaffs_put_chunk_in_file(struct yaffs_obj *in, int inode_chunk,
 		in->n_data_chunks++;
 
 	yaffs_load_tnode_0(dev, tn, inode_chunk, nand_chunk);
+	yaffs2_checkpt_obj_changed(in);
 
 	return YAFFS_OK;
 }
@@ -1201,6 +1210,7 @@ static void yaffs_soft_del_chunk(struct yaffs_dev *dev, int chunk)
 		the_block->soft_del_pages++;
 		dev->n_free_chunks++;
 		yaffs2_update_oldest_dirty_seq(dev, block_no, the_block);
+		yaffs_gc_index_update(dev, block_no);
 	}
 }
 
@@ -1283,6 +1293,7 @@ static void yaffs_remove_obj_from_dir(struct yaffs_obj *obj)
 
 	list_del_init(&obj->siblings);
 	obj->parent = NULL;
+	yaffs2_checkpt_obj_changed(obj);
 
 	yaffs_verify_dir(parent);
 }
@@ -1394,10 +1405,30 @@ static int yaffs_change_obj_name(struct yaffs_obj *obj,
  *   In Linux, the page cache provides read buffering and the short op cache 
  *   provides write buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   Caches in use are hashed by (object, chunk_id) so lookups stay cheap
+ *   however many there are. All caches also sit on dev->cache_lru: free
+ *   ones at the front, then those in use from least to most recently used,
+ *   so the next cache to hand out is always near the front.
  */
 
+static struct list_head *yaffs_cache_bucket(struct yaffs_dev *dev,
+					    const struct yaffs_obj *obj,
+					    int chunk_id)
+{
+	return &dev->cache_hash[(obj->obj_id * 31 + chunk_id) &
+				dev->cache_hash_mask];
+}
+
+/* Hand a cache back to the free end of the LRU. */
+static void yaffs_release_cache(struct yaffs_dev *dev,
+				struct yaffs_cache *cache)
+{
+	list_del_init(&cache->hash_list);
+	list_move(&cache->lru_list, &dev->cache_lru);
+	cache->object = NULL;
+	cache->dirty = 0;
+}
+
 static int yaffs_obj_cache_dirty(struct yaffs_obj *obj)
 {
 	struct yaffs_dev *dev = obj->my_dev;
@@ -1448,8 +1479,7 @@ static void yaffs_flush_file_cache(struct yaffs_obj *obj)
 						      cache->chunk_id,
 						      cache->data,
 						      cache->n_bytes, 1);
-				cache->dirty = 0;
-				cache->object = NULL;
+				yaffs_release_cache(dev, cache);
 			}
 
 		} while (cache && chunk_written > 0);
@@ -1498,64 +1528,69 @@ void yaffs_flush_whole_cache(struct yaffs_dev *dev)
  */
 static struct yaffs_cache *yaffs_grab_chunk_worker(struct yaffs_dev *dev)
 {
-	int i;
+	struct yaffs_cache *cache;
 
-	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (!dev->cache[i].object)
-				return &dev->cache[i];
-		}
+	if (dev->param.n_caches > 0 && !list_empty(&dev->cache_lru)) {
+		cache = list_entry(dev->cache_lru.next, struct yaffs_cache,
+				   lru_list);
+		if (!cache->object)
+			return cache;
 	}
 
 	return NULL;
 }
 
-static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev)
+static struct yaffs_cache *yaffs_grab_chunk_cache(struct yaffs_dev *dev,
+						  struct yaffs_obj *obj,
+						  int chunk_id)
 {
 	struct yaffs_cache *cache;
-	struct yaffs_obj *the_obj;
-	int usage;
-	int i;
-	int pushout;
+	struct yaffs_cache *lru;
 
 	if (dev->param.n_caches > 0) {
+		dev->cache_misses++;
+
 		/* Try find a non-dirty one... */
 
 		cache = yaffs_grab_chunk_worker(dev);
 
 		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
+			/* They were all in use, push out the least recently used
+			 * one. If it is dirty, flush its object and find again.
+			 * NB what's here is not very accurate, we actually flush the
+			 * whole object owning the least recently used page.
 			 */
 
-			/* With locking we can't assume we can use entry zero */
-
-			the_obj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+			/* With locking we can't assume we can use the first one */
 
-			for (i = 0; i < dev->param.n_caches; i++) {
-				if (dev->cache[i].object &&
-				    !dev->cache[i].locked &&
-				    (dev->cache[i].last_use < usage
-				     || !cache)) {
-					usage = dev->cache[i].last_use;
-					the_obj = dev->cache[i].object;
-					cache = &dev->cache[i];
-					pushout = i;
+			list_for_each_entry(lru, &dev->cache_lru, lru_list) {
+				if (!lru->locked) {
+					cache = lru;
+					break;
 				}
 			}
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_flush_file_cache(the_obj);
-				cache = yaffs_grab_chunk_worker(dev);
+			if (cache) {
+				dev->cache_evictions++;
+				if (cache->dirty) {
+					/* Flush and try again */
+					yaffs_flush_file_cache(cache->object);
+					cache = yaffs_grab_chunk_worker(dev);
+				} else {
+					yaffs_release_cache(dev, cache);
+				}
 			}
 
 		}
+
+		if (cache) {
+			cache->object = obj;
+			cache->chunk_id = chunk_id;
+			cache->dirty = 0;
+			cache->locked = 0;
+			list_add(&cache->hash_list,
+				 yaffs_cache_bucket(dev, obj, chunk_id));
+		}
 		return cache;
 	} else {
 		return NULL;
@@ -1567,14 +1602,16 @@ static struct yaffs_cache *yaffs_find_chunk_cache(const struct yaffs_obj *obj,
 						  int chunk_id)
 {
 	struct yaffs_dev *dev = obj->my_dev;
-	int i;
+	struct yaffs_cache *cache;
 	if (dev->param.n_caches > 0) {
-		for (i = 0; i < dev->param.n_caches; i++) {
-			if (dev->cache[i].object == obj &&
-			    dev->cache[i].chunk_id == chunk_id) {
+		list_for_each_entry(cache,
+				    yaffs_cache_bucket(dev, obj, chunk_id),
+				    hash_list) {
+			if (cache->object == obj &&
+			    cache->chunk_id == chunk_id) {
 				dev->cache_hits++;
 
-				return &dev->cache[i];
+				return cache;
 			}
 		}
 	}
@@ -1587,18 +1624,7 @@ static void yaffs_use_cache(struct yaffs_dev *dev, struct yaffs_cache *cache,
 {
 
 	if (dev->param.n_caches > 0) {
-		if (dev->cache_last_use < 0 || dev->cache_last_use > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->param.n_caches; i++)
-				dev->cache[i].last_use = 0;
-
-			dev->cache_last_use = 0;
-		}
-
-		dev->cache_last_use++;
-
-		cache->last_use = dev->cache_last_use;
+		list_move_tail(&cache->lru_list, &dev->cache_lru);
 
 		if (is_write)
 			cache->dirty = 1;
@@ -1616,7 +1642,7 @@ static void yaffs_invalidate_chunk_cache(struct yaffs_obj *object, int chunk_id)
 		    yaffs_find_chunk_cache(object, chunk_id);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_release_cache(object->my_dev, cache);
 	}
 }
 
@@ -1632,7 +1658,7 @@ static void yaffs_invalidate_whole_cache(struct yaffs_obj *in)
 		/* Invalidate it. */
 		for (i = 0; i < dev->param.n_caches; i++) {
 			if (dev->cache[i].object == in)
-				dev->cache[i].object = NULL;
+				yaffs_release_cache(dev, &dev->cache[i]);
 		}
 	}
 }
@@ -1728,6 +1754,7 @@ static void yaffs_soft_del_file(struct yaffs_obj *obj)
 					      obj->variant.
 					      file_variant.top_level, 0);
 			obj->soft_del = 1;
+			yaffs2_checkpt_obj_changed(obj);
 		}
 	}
 }
@@ -1998,6 +2025,7 @@ struct yaffs_obj *yaffs_new_obj(struct yaffs_dev *dev, int number,
 		yaffs_hash_obj(the_obj);
 		the_obj->variant_type = type;
 		yaffs_load_current_time(the_obj, 1, 1);
+		yaffs2_checkpt_obj_changed(the_obj);
 
 		switch (type) {
 		case YAFFS_OBJECT_TYPE_FILE:
@@ -2298,12 +2326,98 @@ struct yaffs_obj *yaffs_link_obj(struct yaffs_obj *parent, const YCHAR * name,
 
 /*------------------------- Block Management and Page Allocation ----------------*/
 
+/*
+ * GC candidate index.
+ * Every FULL block that still has a discarded page sits on
+ * dev->gc_index[pages_used], pages_used being pages_in_use less
+ * soft_del_pages. yaffs_gc_index_update() must be called whenever either
+ * count or the state of a block changes; it puts the block on the right
+ * list, or takes it off when it is no longer a candidate. That makes it
+ * the place where checkpoint deltas learn which blocks changed, too.
+ */
+static void yaffs_gc_index_place(struct yaffs_dev *dev, int block_no)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, block_no);
+	struct list_head *link =
+	    &dev->gc_index_links[block_no - dev->internal_start_block];
+	int pages_used = bi->pages_in_use - bi->soft_del_pages;
+
+	if (bi->block_state != YAFFS_BLOCK_STATE_FULL ||
+	    pages_used >= dev->param.chunks_per_block) {
+		list_del_init(link);
+		return;
+	}
+
+	if (pages_used < 0)
+		pages_used = 0;
+	list_move_tail(link, &dev->gc_index[pages_used]);
+	if (pages_used < dev->gc_index_min)
+		dev->gc_index_min = pages_used;
+}
+
+static void yaffs_gc_index_update(struct yaffs_dev *dev, int block_no)
+{
+	yaffs2_checkpt_block_changed(dev, block_no);
+	yaffs_gc_index_place(dev, block_no);
+}
+
+/* Used once block_info has been set up wholesale by a scan or checkpoint */
+static void yaffs_gc_index_rebuild(struct yaffs_dev *dev)
+{
+	int i;
+	int n_blocks = dev->internal_end_block - dev->internal_start_block + 1;
+
+	for (i = 0; i < dev->param.chunks_per_block; i++)
+		INIT_LIST_HEAD(&dev->gc_index[i]);
+	for (i = 0; i < n_blocks; i++)
+		INIT_LIST_HEAD(&dev->gc_index_links[i]);
+	dev->gc_index_min = dev->param.chunks_per_block;
+
+	for (i = dev->internal_start_block; i <= dev->internal_end_block; i++)
+		yaffs_gc_index_place(dev, i);
+}
+
+/*
+ * Returns the block with the fewest pages in use that may be collected,
+ * or 0 if there is none.
+ */
+static int yaffs_gc_index_find(struct yaffs_dev *dev, int *pages_used)
+{
+	struct list_head *link;
+	struct yaffs_block_info *bi;
+	int block_no;
+	int i;
+
+	for (i = dev->gc_index_min; i < dev->param.chunks_per_block; i++) {
+		if (list_empty(&dev->gc_index[i])) {
+			if (i == dev->gc_index_min)
+				dev->gc_index_min++;
+			continue;
+		}
+
+		list_for_each(link, &dev->gc_index[i]) {
+			block_no = (link - dev->gc_index_links) +
+			    dev->internal_start_block;
+			bi = yaffs_get_block_info(dev, block_no);
+			if (yaffs_block_ok_for_gc(dev, bi)) {
+				*pages_used = i;
+				return block_no;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
 static int yaffs_init_blocks(struct yaffs_dev *dev)
 {
 	int n_blocks = dev->internal_end_block - dev->internal_start_block + 1;
 
 	dev->block_info = NULL;
 	dev->chunk_bits = NULL;
+	dev->gc_index = NULL;
+	dev->gc_index_links = NULL;
 
 	dev->alloc_block = -1;	/* force it to get a new one */
 
@@ -2333,9 +2447,27 @@ static int yaffs_init_blocks(struct yaffs_dev *dev)
 	}
 
 	if (dev->block_info && dev->chunk_bits) {
+		dev->gc_index =
+		    kmalloc(dev->param.chunks_per_block *
+			    sizeof(struct list_head), GFP_NOFS);
+		dev->gc_index_links =
+		    kmalloc(n_blocks * sizeof(struct list_head), GFP_NOFS);
+		if (!dev->gc_index_links) {
+			dev->gc_index_links =
+			    vmalloc(n_blocks * sizeof(struct list_head));
+			dev->gc_index_alt = 1;
+		} else {
+			dev->gc_index_alt = 0;
+		}
+	}
+
+	if (dev->block_info && dev->chunk_bits &&
+	    dev->gc_index && dev->gc_index_links) {
 		memset(dev->block_info, 0,
 		       n_blocks * sizeof(struct yaffs_block_info));
 		memset(dev->chunk_bits, 0, dev->chunk_bit_stride * n_blocks);
+		yaffs_gc_index_rebuild(dev);
+		yaffs2_checkpt_delta_init(dev);
 		return YAFFS_OK;
 	}
 
@@ -2359,6 +2491,18 @@ static void yaffs_deinit_blocks(struct yaffs_dev *dev)
 		kfree(dev->chunk_bits);
 	dev->chunk_bits_alt = 0;
 	dev->chunk_bits = NULL;
+
+	if (dev->gc_index_alt && dev->gc_index_links)
+		vfree(dev->gc_index_links);
+	else if (dev->gc_index_links)
+		kfree(dev->gc_index_links);
+	dev->gc_index_alt = 0;
+	dev->gc_index_links = NULL;
+
+	kfree(dev->gc_index);
+	dev->gc_index = NULL;
+
+	yaffs2_checkpt_delta_deinit(dev);
 }
 
 void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
@@ -2379,6 +2523,7 @@ void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
 	yaffs2_clear_oldest_dirty_seq(dev, bi);
 
 	bi->block_state = YAFFS_BLOCK_STATE_DIRTY;
+	yaffs_gc_index_update(dev, block_no);
 
 	/* If this is the block being garbage collected then stop gc'ing this block */
 	if (block_no == dev->gc_block)
@@ -2468,8 +2613,10 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 
 	/*yaffs_verify_free_chunks(dev); */
 
-	if (bi->block_state == YAFFS_BLOCK_STATE_FULL)
+	if (bi->block_state == YAFFS_BLOCK_STATE_FULL) {
 		bi->block_state = YAFFS_BLOCK_STATE_COLLECTING;
+		yaffs_gc_index_update(dev, block);
+	}
 
 	bi->has_shrink_hdr = 0;	/* clear the flag so that the block can erase */
 
@@ -2562,6 +2709,7 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 					bi->soft_del_pages--;
 
 					object->n_data_chunks--;
+					yaffs2_checkpt_obj_changed(object);
 
 					if (object->n_data_chunks <= 0) {
 						/* remeber to clean up the object */
@@ -2652,6 +2800,8 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 							    new_chunk;
 							object->serial =
 							    tags.serial_number;
+							yaffs2_checkpt_obj_changed
+							    (object);
 						} else {
 							/* It's a data chunk */
 							int ok;
@@ -2679,6 +2829,7 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 		 * because checkpointing does not restore gc.
 		 */
 		bi->block_state = YAFFS_BLOCK_STATE_FULL;
+		yaffs_gc_index_update(dev, block);
 	} else {
 		/* The gc completed. */
 		/* Do any required cleanups */
@@ -2724,7 +2875,6 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 				    int aggressive, int background)
 {
 	int i;
-	int iterations;
 	unsigned selected = 0;
 	int prioritised = 0;
 	int prioritised_exist = 0;
@@ -2770,12 +2920,17 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 	 */
 
 	if (!selected) {
-		int pages_used;
-		int n_blocks =
-		    dev->internal_end_block - dev->internal_start_block + 1;
+		int pages_used = 0;
+
 		if (aggressive) {
-			threshold = dev->param.chunks_per_block;
-			iterations = n_blocks;
+			/*
+			 * The background thread only tops up the reserve from
+			 * blocks that are at least half dirty; writers really
+			 * short of space take anything.
+			 */
+			threshold = background ?
+			    dev->param.chunks_per_block / 2 :
+			    dev->param.chunks_per_block;
 		} else {
 			int max_threshold;
 
@@ -2792,35 +2947,10 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 				threshold = YAFFS_GC_PASSIVE_THRESHOLD;
 			if (threshold > max_threshold)
 				threshold = max_threshold;
-
-			iterations = n_blocks / 16 + 1;
-			if (iterations > 100)
-				iterations = 100;
 		}
 
-		for (i = 0;
-		     i < iterations &&
-		     (dev->gc_dirtiest < 1 ||
-		      dev->gc_pages_in_use > YAFFS_GC_GOOD_ENOUGH); i++) {
-			dev->gc_block_finder++;
-			if (dev->gc_block_finder < dev->internal_start_block ||
-			    dev->gc_block_finder > dev->internal_end_block)
-				dev->gc_block_finder =
-				    dev->internal_start_block;
-
-			bi = yaffs_get_block_info(dev, dev->gc_block_finder);
-
-			pages_used = bi->pages_in_use - bi->soft_del_pages;
-
-			if (bi->block_state == YAFFS_BLOCK_STATE_FULL &&
-			    pages_used < dev->param.chunks_per_block &&
-			    (dev->gc_dirtiest < 1
-			     || pages_used < dev->gc_pages_in_use)
-			    && yaffs_block_ok_for_gc(dev, bi)) {
-				dev->gc_dirtiest = dev->gc_block_finder;
-				dev->gc_pages_in_use = pages_used;
-			}
-		}
+		dev->gc_dirtiest = yaffs_gc_index_find(dev, &pages_used);
+		dev->gc_pages_in_use = pages_used;
 
 		if (dev->gc_dirtiest > 0 && dev->gc_pages_in_use <= threshold)
 			selected = dev->gc_dirtiest;
@@ -2865,8 +2995,8 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 	} else {
 		dev->gc_not_done++;
 		yaffs_trace(YAFFS_TRACE_GC,
-			"GC none: finder %d skip %d threshold %d dirtiest %d using %d oldest %d%s",
-			dev->gc_block_finder, dev->gc_not_done, threshold,
+			"GC none: skip %d threshold %d dirtiest %d using %d oldest %d%s",
+			dev->gc_not_done, threshold,
 			dev->gc_dirtiest, dev->gc_pages_in_use,
 			dev->oldest_dirty_block, background ? " bg" : "");
 	}
@@ -2874,6 +3004,41 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
 	return selected;
 }
 
+/*
+ * Whether the background gc should collect aggressively to get the reserve
+ * of erased blocks back up. Not when there is little to reclaim, or it
+ * would just churn the flash.
+ */
+int yaffs_gc_reserve_short(struct yaffs_dev *dev)
+{
+	int min_erased = dev->param.n_reserved_blocks +
+	    yaffs_calc_checkpt_blocks_required(dev) + 1;
+	int erased_chunks = dev->n_erased_blocks * dev->param.chunks_per_block;
+
+	if (dev->n_erased_blocks >= min_erased + dev->param.gc_reserve_blocks)
+		return 0;
+
+	return dev->n_free_chunks - erased_chunks >=
+	    2 * dev->param.chunks_per_block;
+}
+
+static void yaffs_gc_record_latency(struct yaffs_dev *dev, int background,
+				    u64 us)
+{
+	int i = 0;
+
+	us >>= YAFFS_GC_HIST_SHIFT;
+	while (us && i < YAFFS_GC_HIST_BUCKETS - 1) {
+		us >>= 1;
+		i++;
+	}
+
+	if (background)
+		dev->gc_bg_hist[i]++;
+	else
+		dev->gc_fg_hist[i]++;
+}
+
 /* New garbage collector
  * If we're very low on erased blocks then we do aggressive garbage collection
  * otherwise we do "leasurely" garbage collection.
@@ -2882,6 +3047,11 @@ static unsigned yaffs_find_gc_block(struct yaffs_dev *dev,
  *
  * The idea is to help clear out space in a more spread-out manner.
  * Dunno if it really does anything useful.
+ *
+ * While the OS runs a background gc thread (dev->bg_gc_running), writers
+ * only gc when they are about to eat into the reserve; everything else is
+ * left to the thread, which also collects aggressively until
+ * param.gc_reserve_blocks erased blocks are in hand.
  */
 static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 {
@@ -2891,6 +3061,7 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 	int min_erased;
 	int erased_chunks;
 	int checkpt_block_adjust;
+	u64 gc_start;
 
 	if (dev->param.gc_control && (dev->param.gc_control(dev) & 1) == 0)
 		return YAFFS_OK;
@@ -2915,9 +3086,18 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 		    dev->n_erased_blocks * dev->param.chunks_per_block;
 
 		/* If we need a block soon then do aggressive gc. */
-		if (dev->n_erased_blocks < min_erased)
+		if (dev->n_erased_blocks < min_erased) {
 			aggressive = 1;
-		else {
+			if (!background && dev->bg_gc_running)
+				dev->param.gc_wake_fn(dev);
+		} else if (background && yaffs_gc_reserve_short(dev)) {
+			/* Top up the reserve so that writers don't have to */
+			aggressive = 1;
+		} else if (!background && dev->bg_gc_running) {
+			if (yaffs_gc_reserve_short(dev))
+				dev->param.gc_wake_fn(dev);
+			break;
+		} else {
 			if (!background
 			    && erased_chunks > (dev->n_free_chunks / 4))
 				break;
@@ -2958,7 +3138,10 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 				"yaffs: GC n_erased_blocks %d aggressive %d",
 				dev->n_erased_blocks, aggressive);
 
+			gc_start = Y_TIME_US();
 			gc_ok = yaffs_gc_block(dev, dev->gc_block, aggressive);
+			yaffs_gc_record_latency(dev, background,
+						Y_TIME_US() - gc_start);
 		}
 
 		if (dev->n_erased_blocks < (dev->param.n_reserved_blocks)
@@ -3061,6 +3244,7 @@ void yaffs_chunk_del(struct yaffs_dev *dev, int chunk_id, int mark_flash,
 		yaffs_clear_chunk_bit(dev, block, page);
 
 		bi->pages_in_use--;
+		yaffs_gc_index_update(dev, block);
 
 		if (bi->pages_in_use == 0 &&
 		    !bi->has_shrink_hdr &&
@@ -3498,6 +3682,7 @@ int yaffs_update_oh(struct yaffs_obj *in, const YCHAR * name, int force,
 		if (new_chunk_id >= 0) {
 
 			in->hdr_chunk = new_chunk_id;
+			yaffs2_checkpt_obj_changed(in);
 
 			if (prev_chunk_id > 0) {
 				yaffs_chunk_del(dev, prev_chunk_id, 1,
@@ -3580,11 +3765,8 @@ int yaffs_file_rd(struct yaffs_obj *in, u8 * buffer, loff_t offset, int n_bytes)
 
 				if (!cache) {
 					cache =
-					    yaffs_grab_chunk_cache(in->my_dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					    yaffs_grab_chunk_cache(in->my_dev,
+								   in, chunk);
 					yaffs_rd_data_obj(in, chunk,
 							  cache->data);
 					cache->n_bytes = 0;
@@ -3706,11 +3888,8 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 
 				if (!cache
 				    && yaffs_check_alloc_available(dev, 1)) {
-					cache = yaffs_grab_chunk_cache(dev);
-					cache->object = in;
-					cache->chunk_id = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					cache = yaffs_grab_chunk_cache(dev, in,
+								       chunk);
 					yaffs_rd_data_obj(in, chunk,
 							  cache->data);
 				} else if (cache &&
@@ -3790,8 +3969,10 @@ int yaffs_do_file_wr(struct yaffs_obj *in, const u8 * buffer, loff_t offset,
 
 	/* Update file object */
 
-	if ((start_write + n_done) > in->variant.file_variant.file_size)
+	if ((start_write + n_done) > in->variant.file_variant.file_size) {
 		in->variant.file_variant.file_size = (start_write + n_done);
+		yaffs2_checkpt_obj_changed(in);
+	}
 
 	in->dirty = 1;
 
@@ -3842,6 +4023,7 @@ static void yaffs_prune_chunks(struct yaffs_obj *in, int new_size)
 					chunk_id, i);
 			} else {
 				in->n_data_chunks--;
+				yaffs2_checkpt_obj_changed(in);
 				yaffs_chunk_del(dev, chunk_id, 1, __LINE__);
 			}
 		}
@@ -3875,6 +4057,7 @@ void yaffs_resize_file_down(struct yaffs_obj *obj, loff_t new_size)
 	}
 
 	obj->variant.file_variant.file_size = new_size;
+	yaffs2_checkpt_obj_changed(obj);
 
 	yaffs_prune_tree(dev, &obj->variant.file_variant);
 }
@@ -3898,6 +4081,7 @@ int yaffs_resize_file(struct yaffs_obj *in, loff_t new_size)
 	if (new_size > old_size) {
 		yaffs2_handle_hole(in, new_size);
 		in->variant.file_variant.file_size = new_size;
+		yaffs2_checkpt_obj_changed(in);
 	} else {
 		/* new_size < old_size */
 		yaffs_resize_file_down(in, new_size);
@@ -3962,6 +4146,7 @@ static int yaffs_unlink_file_if_needed(struct yaffs_obj *in)
 			"yaffs: immediate deletion of file %d",
 			in->obj_id);
 		in->deleted = 1;
+		yaffs2_checkpt_obj_changed(in);
 		in->my_dev->n_deleted_files++;
 		if (dev->param.disable_soft_del || dev->param.is_yaffs2)
 			yaffs_resize_file(in, 0);
@@ -3995,6 +4180,7 @@ int yaffs_del_file(struct yaffs_obj *in)
 
 		if (ret_val == YAFFS_OK && in->unlinked && !in->deleted) {
 			in->deleted = 1;
+			yaffs2_checkpt_obj_changed(in);
 			deleted = 1;
 			in->my_dev->n_deleted_files++;
 			yaffs_soft_del_file(in);
@@ -4916,7 +5102,6 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	dev->passive_gc_count = 0;
 	dev->oldest_dirty_gc_count = 0;
 	dev->bg_gcs = 0;
-	dev->gc_block_finder = 0;
 	dev->buffered_block = -1;
 	dev->doing_buffered_block_rewrite = 0;
 	dev->n_deleted_files = 0;
@@ -4939,17 +5124,20 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		init_failed = 1;
 
 	dev->cache = NULL;
+	dev->cache_hash = NULL;
 	dev->gc_cleanup_list = NULL;
 
 	if (!init_failed && dev->param.n_caches > 0) {
 		int i;
+		int n_buckets;
 		void *buf;
-		int cache_bytes =
-		    dev->param.n_caches * sizeof(struct yaffs_cache);
+		int cache_bytes;
 
 		if (dev->param.n_caches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->param.n_caches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		cache_bytes = dev->param.n_caches * sizeof(struct yaffs_cache);
+
 		dev->cache = kmalloc(cache_bytes, GFP_NOFS);
 
 		buf = (u8 *) dev->cache;
@@ -4957,20 +5145,37 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 		if (dev->cache)
 			memset(dev->cache, 0, cache_bytes);
 
+		INIT_LIST_HEAD(&dev->cache_lru);
 		for (i = 0; i < dev->param.n_caches && buf; i++) {
 			dev->cache[i].object = NULL;
-			dev->cache[i].last_use = 0;
 			dev->cache[i].dirty = 0;
+			INIT_LIST_HEAD(&dev->cache[i].hash_list);
+			list_add_tail(&dev->cache[i].lru_list,
+				      &dev->cache_lru);
 			dev->cache[i].data = buf =
 			    kmalloc(dev->param.total_bytes_per_chunk, GFP_NOFS);
 		}
-		if (!buf)
-			init_failed = 1;
 
-		dev->cache_last_use = 0;
+		/* At least one bucket per cache */
+		n_buckets = 1;
+		while (n_buckets < dev->param.n_caches)
+			n_buckets <<= 1;
+		if (buf)
+			dev->cache_hash =
+			    kmalloc(n_buckets * sizeof(struct list_head),
+				    GFP_NOFS);
+		if (!buf || !dev->cache_hash)
+			init_failed = 1;
+		for (i = 0; i < n_buckets && dev->cache_hash; i++)
+			INIT_LIST_HEAD(&dev->cache_hash[i]);
+		dev->cache_hash_mask = n_buckets - 1;
 	}
 
 	dev->cache_hits = 0;
+	dev->cache_misses = 0;
+	dev->cache_evictions = 0;
+	memset(dev->gc_fg_hist, 0, sizeof(dev->gc_fg_hist));
+	memset(dev->gc_bg_hist, 0, sizeof(dev->gc_bg_hist));
 
 	if (!init_failed) {
 		dev->gc_cleanup_list =
@@ -5032,6 +5237,10 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 			init_failed = 1;
                 }
 
+		/* The scan or checkpoint filled in block_info behind our back */
+		if (!init_failed)
+			yaffs_gc_index_rebuild(dev);
+
 		yaffs_strip_deleted_objs(dev);
 		yaffs_fix_hanging_objs(dev);
 		if (dev->param.empty_lost_n_found)
@@ -5086,6 +5295,8 @@ void yaffs_deinitialise(struct yaffs_dev *dev)
 
 			kfree(dev->cache);
 			dev->cache = NULL;
+			kfree(dev->cache_hash);
+			dev->cache_hash = NULL;
 		}
 
 		kfree(dev->gc_cleanup_list);
@@ -61,6 +61,8 @@
 #define YAFFS_MAX_OBJECT_ID		(YAFFS_OBJECT_SPACE -1)
 
 #define YAFFS_CHECKPOINT_VERSION 	4
+/* Same layout, but the checkpoint may be kept while the fs is written */
+#define YAFFS_CHECKPOINT_VERSION_KEPT	5
 
 #ifdef CONFIG_YAFFS_UNICODE
 #define YAFFS_MAX_NAME_LENGTH		127
@@ -83,10 +85,17 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+/* Checkpoint delta pages are numbered from here, base pages from 0 */
+#define YAFFS_CHECKPOINT_DELTA_PAGE_SEQ	0x01000000
+
+#define YAFFS_MAX_SHORT_OP_CACHES	128
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
+/* GC latency histogram: bucket i counts passes under 128us << i */
+#define YAFFS_GC_HIST_BUCKETS		12
+#define YAFFS_GC_HIST_SHIFT		7
+
 /* We limit the number attempts at sucessfully saving a chunk of data.
  * Small-page devices have 32 pages per block; large-page devices have 64.
  * Default to something in the order of 5 to 10 blocks worth of chunks.
@@ -108,9 +117,10 @@
 
 /* ChunkCache is used for short read/write operations.*/
 struct yaffs_cache {
+	struct list_head hash_list;	/* On a dev->cache_hash bucket while in use */
+	struct list_head lru_list;	/* On dev->cache_lru, least recently used first */
 	struct yaffs_obj *object;
 	int chunk_id;
-	int last_use;
 	int dirty;
 	int n_bytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -286,6 +296,12 @@ struct yaffs_block_info {
 
 };
 
+/* A block to be scanned, sorted into sequence number order for the scan */
+struct yaffs_block_index {
+	int seq;
+	int block;
+};
+
 /* -------------------------- Object structure -------------------------------*/
 /* This is the object structure as stored on NAND */
 
@@ -524,6 +540,12 @@ struct yaffs_param {
 
 	int enable_xattr;	/* Enable xattribs */
 
+	/* Checkpoint deltas written on top of a full checkpoint before the
+	 * next full one. 0 erases the checkpoint on the first write, as
+	 * before deltas.
+	 */
+	int checkpt_max_deltas;
+
 	/* NAND access functions (Must be set before calling YAFFS) */
 
 	int (*write_chunk_fn) (struct yaffs_dev * dev,
@@ -547,6 +569,15 @@ struct yaffs_param {
 	int (*query_block_fn) (struct yaffs_dev * dev, int block_no,
 			       enum yaffs_block_state * state,
 			       u32 * seq_number);
+
+	/* Optional: start reading the tags of the blocks a backwards scan is
+	 * about to visit, ie. block_index from the last entry down, so that
+	 * read_chunk_tags_fn finds them ready. Stopped once the scan is done.
+	 */
+	void (*scan_prefetch_start_fn) (struct yaffs_dev * dev,
+					const struct yaffs_block_index *
+					block_index, int n_blocks);
+	void (*scan_prefetch_stop_fn) (struct yaffs_dev * dev);
 #endif
 
 	/* The remove_obj_fn function must be supplied by OS flavours that
@@ -562,6 +593,12 @@ struct yaffs_param {
 	/*  Callback to control garbage collection. */
 	unsigned (*gc_control) (struct yaffs_dev * dev);
 
+	/* Callback to wake the background gc thread, see bg_gc_running */
+	void (*gc_wake_fn) (struct yaffs_dev * dev);
+
+	/* Erased blocks the background gc keeps in hand beyond the reserve */
+	int gc_reserve_blocks;
+
 	/* Debug control flags. Don't use unless you know what you're doing */
 	int use_header_file_size;	/* Flag to determine if we should use file sizes from the header */
 	int disable_lazy_load;	/* Disable lazy loading on this device */
@@ -630,6 +667,20 @@ struct yaffs_dev {
 	u32 checkpt_sum;
 	u32 checkpt_xor;
 
+	/* Checkpoint deltas. The last full checkpoint (the base) stays on
+	 * flash across writes; what changed since is tracked here and
+	 * written as a delta next to it.
+	 */
+	int checkpt_delta;	/* The open checkpoint stream is a delta */
+	int checkpt_base_blocks;	/* Blocks holding the base, 0 if none */
+	u32 checkpt_base_sum;	/* Checksum of the base */
+	int checkpt_n_deltas;	/* Deltas written on top of the base */
+	u8 *checkpt_obj_bits;	/* Objects changed since the base, by id */
+	u8 *checkpt_block_bits;	/* Blocks changed since the base */
+	int checkpt_objs_changed;
+	int checkpt_blocks_changed;
+	unsigned checkpt_obj_bits_alt:1;	/* vmalloc'd */
+
 	int checkpoint_blocks_required;	/* Number of blocks needed to store current checkpoint set */
 
 	/* Block Info */
@@ -664,13 +715,19 @@ struct yaffs_dev {
 
 	unsigned has_pending_prioritised_gc;	/* We think this device might have pending prioritised gcs */
 	unsigned gc_disable;
-	unsigned gc_block_finder;
 	unsigned gc_dirtiest;
 	unsigned gc_pages_in_use;
 	unsigned gc_not_done;
 	unsigned gc_block;
 	unsigned gc_chunk;
 	unsigned gc_skip;
+	int bg_gc_running;	/* Set by the OS while a background thread gcs */
+
+	/* FULL blocks by pages in use, see yaffs_gc_index_update() */
+	struct list_head *gc_index;
+	struct list_head *gc_index_links;	/* One per block */
+	int gc_index_min;	/* No candidates below this many pages in use */
+	int gc_index_alt;	/* gc_index_links was vmalloc()ed */
 
 	/* Special directories */
 	struct yaffs_obj *root_dir;
@@ -685,7 +742,9 @@ struct yaffs_dev {
 	int doing_buffered_block_rewrite;
 
 	struct yaffs_cache *cache;
-	int cache_last_use;
+	struct list_head *cache_hash;	/* Caches in use, by (object, chunk_id) */
+	u32 cache_hash_mask;
+	struct list_head cache_lru;	/* Free caches first, then by last use */
 
 	/* Stuff for background deletion and unlinked files. */
 	struct yaffs_obj *unlinked_dir;	/* Directory where unlinked and deleted files live. */
@@ -734,6 +793,17 @@ struct yaffs_dev {
 	u32 n_unmarked_deletions;
 	u32 refresh_count;
 	u32 cache_hits;
+	u32 cache_misses;
+	u32 cache_evictions;
+	u32 gc_fg_hist[YAFFS_GC_HIST_BUCKETS];	/* Foreground gc latency */
+	u32 gc_bg_hist[YAFFS_GC_HIST_BUCKETS];	/* Background gc latency */
+
+	/* Time taken by each phase of the last yaffs2 scan */
+	u32 scan_query_us;	/* Querying block states */
+	u32 scan_sort_us;	/* Sorting blocks by sequence number */
+	u32 scan_tags_us;	/* Waiting for chunk tags */
+	u32 scan_process_us;	/* Processing the tags */
+	u32 scan_fixup_us;	/* Fixing up hard links */
 
 };
 
@@ -763,6 +833,18 @@ struct yaffs_checkpt_validity {
 	u32 head;
 };
 
+/*
+ * A delta stream is: validity marker, this, yaffs_checkpt_dev, changed
+ * blocks as (block number, block info, chunk bits) ended by ~0, changed
+ * objects as in a full checkpoint with YAFFS_OBJECT_TYPE_UNKNOWN for
+ * ones that are gone, validity marker and checksum.
+ */
+struct yaffs_checkpt_delta {
+	int struct_type;
+	u32 base_sum;		/* Checksum of the base this applies to */
+	int n_deltas;
+};
+
 struct yaffs_shadow_fixer {
 	int obj_id;
 	int shadowed_id;
@@ -857,6 +939,7 @@ void yaffs_handle_defered_free(struct yaffs_obj *obj);
 void yaffs_update_dirty_dirs(struct yaffs_dev *dev);
 
 int yaffs_bg_gc(struct yaffs_dev *dev, unsigned urgency);
+int yaffs_gc_reserve_short(struct yaffs_dev *dev);
 
 /* Debug dump  */
 int yaffs_dump_obj(struct yaffs_obj *obj);
@@ -18,16 +18,20 @@
 
 #include "yportenv.h"
 
+struct nandmtd2_prefetch;
+
 struct yaffs_linux_context {
 	struct list_head context_list;	/* List of these we have mounted */
 	struct yaffs_dev *dev;
 	struct super_block *super;
 	struct task_struct *bg_thread;	/* Background thread for this device */
 	int bg_running;
+	int bg_gc_wanted;	/* Writer asked for a gc pass right away */
 	struct mutex gross_lock;	/* Gross locking mutex*/
 	u8 *spare_buffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 				 */
+	struct nandmtd2_prefetch *scan_prefetch;	/* Tag read-ahead while scanning */
 	struct list_head search_contexts;
 	void (*put_super_fn) (struct super_block * sb);
 
@@ -21,6 +21,8 @@
 #include "linux/mtd/mtd.h"
 #include "linux/types.h"
 #include "linux/time.h"
+#include "linux/kthread.h"
+#include "linux/wait.h"
 
 #include "yaffs_packedtags2.h"
 
@@ -84,6 +86,229 @@ int nandmtd2_write_chunk_tags(struct yaffs_dev *dev, int nand_chunk,
 		return YAFFS_FAIL;
 }
 
+/*
+ * Tag read-ahead for yaffs2_scan_backwards().
+ *
+ * Without a checkpoint the scan reads the tags of every chunk one at a
+ * time and only then decides what to do with it, so the flash sits idle
+ * while a chunk is processed and the CPU sits idle while a chunk is read.
+ * Here a thread reads the spare areas of the blocks the scan is about to
+ * visit, a whole block per read_oob call, into a small ring of block
+ * sized buffers. nandmtd2_read_chunk_tags() copies the tags from there
+ * instead of going to the flash.
+ *
+ * The thread only touches its own buffers: the tags are unpacked, and ECC
+ * results and errors accounted, by the scan as if it had read them itself.
+ */
+
+#define NANDMTD2_PREFETCH_BLOCKS	4
+
+struct nandmtd2_prefetch {
+	struct yaffs_dev *dev;
+	struct task_struct *thread;
+	wait_queue_head_t wait;
+	spinlock_t lock;	/* Protects n_read and cur */
+	int n_read;		/* Blocks in the ring, counted from blocks[0] */
+	int cur;		/* Block the scan is reading from */
+	int n_blocks;
+	int *blocks;		/* Blocks to read, in scan order */
+	int oob_per_chunk;
+	u8 *oob;		/* Spare areas, a block per ring slot */
+	int *retval;		/* read_oob result, a chunk per entry */
+};
+
+static int nandmtd2_prefetch_test(struct nandmtd2_prefetch *pf, int *counter,
+				  int val)
+{
+	int ret;
+
+	spin_lock(&pf->lock);
+	ret = *counter > val;
+	spin_unlock(&pf->lock);
+
+	return ret;
+}
+
+static void nandmtd2_prefetch_set(struct nandmtd2_prefetch *pf, int *counter,
+				  int val)
+{
+	spin_lock(&pf->lock);
+	*counter = val;
+	spin_unlock(&pf->lock);
+	wake_up(&pf->wait);
+}
+
+static void nandmtd2_prefetch_block(struct nandmtd2_prefetch *pf, int i)
+{
+	struct yaffs_dev *dev = pf->dev;
+	struct mtd_info *mtd = yaffs_dev_to_mtd(dev);
+	int chunks = dev->param.chunks_per_block;
+	int slot = (i % NANDMTD2_PREFETCH_BLOCKS) * chunks;
+	int first = pf->blocks[i] * chunks - dev->chunk_offset;
+	loff_t addr = ((loff_t) first) * dev->param.total_bytes_per_chunk;
+	struct mtd_oob_ops ops;
+	int retval;
+	int c;
+
+	ops.mode = MTD_OOB_AUTO;
+	ops.ooboffs = 0;
+	ops.datbuf = NULL;
+	ops.oobbuf = pf->oob + slot * pf->oob_per_chunk;
+	ops.ooblen = chunks * pf->oob_per_chunk;
+	ops.len = ops.ooblen;
+	ops.oobretlen = 0;
+	retval = mtd->read_oob(mtd, addr, &ops);
+
+	if (retval == 0 && ops.oobretlen == ops.ooblen) {
+		for (c = 0; c < chunks; c++)
+			pf->retval[slot + c] = 0;
+		return;
+	}
+
+	/* Something went wrong, get a result for each chunk */
+	for (c = 0; c < chunks; c++) {
+		ops.oobbuf = pf->oob + (slot + c) * pf->oob_per_chunk;
+		ops.ooblen = pf->oob_per_chunk;
+		ops.len = ops.ooblen;
+		pf->retval[slot + c] = mtd->read_oob(mtd, addr, &ops);
+		addr += dev->param.total_bytes_per_chunk;
+	}
+}
+
+static int nandmtd2_prefetch_thread(void *data)
+{
+	struct nandmtd2_prefetch *pf = data;
+	int i;
+
+	for (i = 0; i < pf->n_blocks && !kthread_should_stop(); i++) {
+		/* Wait for the scan to finish with the slot we need */
+		wait_event_interruptible(pf->wait, kthread_should_stop() ||
+			nandmtd2_prefetch_test(pf, &pf->cur,
+					       i - NANDMTD2_PREFETCH_BLOCKS));
+		if (kthread_should_stop())
+			break;
+
+		nandmtd2_prefetch_block(pf, i);
+		nandmtd2_prefetch_set(pf, &pf->n_read, i + 1);
+	}
+
+	/* kthread_stop() needs us around until it is called */
+	while (!kthread_should_stop())
+		wait_event_interruptible(pf->wait, kthread_should_stop());
+
+	return 0;
+}
+
+static void nandmtd2_prefetch_free(struct nandmtd2_prefetch *pf)
+{
+	kfree(pf->retval);
+	kfree(pf->oob);
+	vfree(pf->blocks);
+	kfree(pf);
+}
+
+void nandmtd2_scan_prefetch_start(struct yaffs_dev *dev,
+				  const struct yaffs_block_index *block_index,
+				  int n_blocks)
+{
+	struct yaffs_linux_context *lc = yaffs_dev_to_lc(dev);
+	struct mtd_info *mtd = yaffs_dev_to_mtd(dev);
+	struct nandmtd2_prefetch *pf;
+	int chunks = dev->param.chunks_per_block;
+	int i;
+
+	if (dev->param.inband_tags || n_blocks < 1 || lc->scan_prefetch)
+		return;
+
+	pf = kzalloc(sizeof(*pf), GFP_NOFS);
+	if (!pf)
+		goto fail;
+
+	pf->dev = dev;
+	init_waitqueue_head(&pf->wait);
+	spin_lock_init(&pf->lock);
+	pf->n_blocks = n_blocks;
+	pf->oob_per_chunk = mtd->oobavail;
+
+	pf->blocks = vmalloc(n_blocks * sizeof(int));
+	pf->oob = kmalloc(NANDMTD2_PREFETCH_BLOCKS * chunks *
+			  pf->oob_per_chunk, GFP_NOFS);
+	pf->retval = kmalloc(NANDMTD2_PREFETCH_BLOCKS * chunks * sizeof(int),
+			     GFP_NOFS);
+	if (!pf->blocks || !pf->oob || !pf->retval)
+		goto fail_free;
+
+	for (i = 0; i < n_blocks; i++)
+		pf->blocks[i] = block_index[n_blocks - 1 - i].block;
+
+	pf->thread = kthread_run(nandmtd2_prefetch_thread, pf,
+				 "yaffs-scan-%u", lc->mount_id);
+	if (IS_ERR(pf->thread))
+		goto fail_free;
+
+	lc->scan_prefetch = pf;
+	return;
+
+fail_free:
+	nandmtd2_prefetch_free(pf);
+fail:
+	yaffs_trace(YAFFS_TRACE_SCAN,
+		"could not start tag read-ahead, scanning without it");
+}
+
+void nandmtd2_scan_prefetch_stop(struct yaffs_dev *dev)
+{
+	struct yaffs_linux_context *lc = yaffs_dev_to_lc(dev);
+	struct nandmtd2_prefetch *pf = lc->scan_prefetch;
+
+	if (!pf)
+		return;
+
+	lc->scan_prefetch = NULL;
+	kthread_stop(pf->thread);
+	nandmtd2_prefetch_free(pf);
+}
+
+/*
+ * Copy the packed tags of nand_chunk into the spare buffer if the
+ * read-ahead has them, waiting for it if need be. The scan moves from one
+ * block to the next in the order it gave us, anything else is read from
+ * the flash as usual.
+ */
+static int nandmtd2_scan_prefetched(struct yaffs_dev *dev, int nand_chunk,
+				    int *retval)
+{
+	struct nandmtd2_prefetch *pf = yaffs_dev_to_lc(dev)->scan_prefetch;
+	int chunks = dev->param.chunks_per_block;
+	int i;
+	int c;
+	int slot;
+
+	if (!pf)
+		return 0;
+
+	i = pf->cur;
+	c = nand_chunk - (pf->blocks[i] * chunks - dev->chunk_offset);
+	if (c < 0 || c >= chunks) {
+		if (i + 1 >= pf->n_blocks)
+			return 0;
+		c = nand_chunk - (pf->blocks[i + 1] * chunks -
+				  dev->chunk_offset);
+		if (c < 0 || c >= chunks)
+			return 0;
+		nandmtd2_prefetch_set(pf, &pf->cur, ++i);
+	}
+
+	wait_event(pf->wait, nandmtd2_prefetch_test(pf, &pf->n_read, i));
+
+	slot = (i % NANDMTD2_PREFETCH_BLOCKS) * chunks + c;
+	memcpy(yaffs_dev_to_lc(dev)->spare_buffer,
+	       pf->oob + slot * pf->oob_per_chunk, pf->oob_per_chunk);
+	*retval = pf->retval[slot];
+
+	return 1;
+}
+
 int nandmtd2_read_chunk_tags(struct yaffs_dev *dev, int nand_chunk,
 			     u8 * data, struct yaffs_ext_tags *tags)
 {
@@ -103,6 +328,8 @@ int nandmtd2_read_chunk_tags(struct yaffs_dev *dev, int nand_chunk,
 	void *packed_tags_ptr =
 	    dev->param.no_tags_ecc ? (void *)&pt.t : (void *)&pt;
 
+	int prefetched;
+
 	yaffs_trace(YAFFS_TRACE_MTD,
 		"nandmtd2_read_chunk_tags chunk %d data %p tags %p",
 		nand_chunk, data, tags);
@@ -116,10 +343,13 @@ int nandmtd2_read_chunk_tags(struct yaffs_dev *dev, int nand_chunk,
 
 	}
 
+	prefetched = !dev->param.inband_tags && !data && tags &&
+	    nandmtd2_scan_prefetched(dev, nand_chunk, &retval);
+
 	if (dev->param.inband_tags || (data && !tags))
 		retval = mtd->read(mtd, addr, dev->param.total_bytes_per_chunk,
 				   &dummy, data);
-	else if (tags) {
+	else if (tags && !prefetched) {
 		ops.mode = MTD_OOB_AUTO;
 		ops.ooblen = packed_tags_size;
 		ops.len = data ? dev->data_bytes_per_chunk : packed_tags_size;
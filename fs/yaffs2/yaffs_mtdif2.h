@@ -25,5 +25,9 @@ int nandmtd2_read_chunk_tags(struct yaffs_dev *dev, int nand_chunk,
 int nandmtd2_mark_block_bad(struct yaffs_dev *dev, int block_no);
 int nandmtd2_query_block(struct yaffs_dev *dev, int block_no,
 			 enum yaffs_block_state *state, u32 * seq_number);
+void nandmtd2_scan_prefetch_start(struct yaffs_dev *dev,
+				  const struct yaffs_block_index *block_index,
+				  int n_blocks);
+void nandmtd2_scan_prefetch_stop(struct yaffs_dev *dev);
 
 #endif
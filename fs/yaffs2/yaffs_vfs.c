@@ -97,6 +97,8 @@ unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
+unsigned int yaffs_gc_reserve = 4;
+unsigned int yaffs_checkpt_deltas = 8;
 
 /* Module Parameters */
 module_param(yaffs_trace_mask, uint, 0644);
@@ -104,6 +106,8 @@ module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_gc_reserve, uint, 0644);
+module_param(yaffs_checkpt_deltas, uint, 0644);
 
 
 #define yaffs_inode_to_obj_lv(iptr) ((iptr)->i_private)
@@ -1542,8 +1546,10 @@ static void yaffs_flush_super(struct super_block *sb, int do_checkpoint)
 	yaffs_flush_inodes(sb);
 	yaffs_update_dirty_dirs(dev);
 	yaffs_flush_whole_cache(dev);
-	if (do_checkpoint)
+	if (do_checkpoint) {
+		dev->param.checkpt_max_deltas = yaffs_checkpt_deltas;
 		yaffs_checkpoint_save(dev);
+	}
 }
 
 static unsigned yaffs_bg_gc_urgency(struct yaffs_dev *dev)
@@ -1615,6 +1621,17 @@ void yaffs_background_waker(unsigned long data)
 	wake_up_process((struct task_struct *)data);
 }
 
+/* Called with the gross lock held when writers run low on erased blocks */
+static void yaffs_bg_gc_wake(struct yaffs_dev *dev)
+{
+	struct yaffs_linux_context *context = yaffs_dev_to_lc(dev);
+
+	if (context->bg_thread) {
+		context->bg_gc_wanted = 1;
+		wake_up_process(context->bg_thread);
+	}
+}
+
 static int yaffs_bg_thread_fn(void *data)
 {
 	struct yaffs_dev *dev = (struct yaffs_dev *)data;
@@ -1624,6 +1641,8 @@ static int yaffs_bg_thread_fn(void *data)
 	unsigned long next_gc = now;
 	unsigned long expires;
 	unsigned int urgency;
+	u32 n_gc_blocks;
+	int gc_wanted;
 
 	int gc_result;
 	struct timer_list timer;
@@ -1645,16 +1664,28 @@ static int yaffs_bg_thread_fn(void *data)
 
 		now = jiffies;
 
+		dev->param.gc_reserve_blocks = yaffs_gc_reserve;
+		dev->bg_gc_running = yaffs_bg_enable;
+
 		if (time_after(now, next_dir_update) && yaffs_bg_enable) {
 			yaffs_update_dirty_dirs(dev);
 			next_dir_update = now + HZ;
 		}
 
-		if (time_after(now, next_gc) && yaffs_bg_enable) {
+		gc_wanted = context->bg_gc_wanted;
+		context->bg_gc_wanted = 0;
+
+		if ((time_after(now, next_gc) || gc_wanted) &&
+		    yaffs_bg_enable) {
 			if (!dev->is_checkpointed) {
+				n_gc_blocks = dev->n_gc_blocks;
 				urgency = yaffs_bg_gc_urgency(dev);
 				gc_result = yaffs_bg_gc(dev, urgency);
-				if (urgency > 1)
+				if (yaffs_gc_reserve_short(dev) &&
+				    dev->n_gc_blocks != n_gc_blocks)
+					/* Keep going, a block per tick */
+					next_gc = now;
+				else if (urgency > 1)
 					next_gc = now + HZ / 20 + 1;
 				else if (urgency > 0)
 					next_gc = now + HZ / 10 + 1;
@@ -1682,7 +1713,10 @@ static int yaffs_bg_thread_fn(void *data)
 
 		set_current_state(TASK_INTERRUPTIBLE);
 		add_timer(&timer);
-		schedule();
+		/* Don't sleep through a wake that came in since we unlocked */
+		if (!context->bg_gc_wanted)
+			schedule();
+		__set_current_state(TASK_RUNNING);
 		del_timer_sync(&timer);
 	}
 
@@ -1716,6 +1750,7 @@ static void yaffs_bg_stop(struct yaffs_dev *dev)
 	struct yaffs_linux_context *ctxt = yaffs_dev_to_lc(dev);
 
 	ctxt->bg_running = 0;
+	dev->bg_gc_running = 0;
 
 	if (ctxt->bg_thread) {
 		kthread_stop(ctxt->bg_thread);
@@ -1758,6 +1793,7 @@ struct yaffs_options {
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int n_caches;
 	int tags_ecc_on;
 	int tags_ecc_overridden;
 	int lazy_loading_enabled;
@@ -1813,6 +1849,9 @@ static int yaffs_parse_options(struct yaffs_options *options,
 			options->empty_lost_and_found_overridden = 1;
 		} else if (!strcmp(cur_opt, "no-cache")) {
 			options->no_cache = 1;
+		} else if (!strncmp(cur_opt, "n-caches=", 9)) {
+			options->n_caches =
+			    simple_strtoul(cur_opt + 9, NULL, 0);
 		} else if (!strcmp(cur_opt, "no-checkpoint-read")) {
 			options->skip_checkpoint_read = 1;
 		} else if (!strcmp(cur_opt, "no-checkpoint-write")) {
@@ -2215,7 +2254,8 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->chunks_per_block = YAFFS_CHUNKS_PER_BLOCK;
 	param->total_bytes_per_chunk = YAFFS_BYTES_PER_CHUNK;
 	param->n_reserved_blocks = 5;
-	param->n_caches = (options.no_cache) ? 0 : 10;
+	param->n_caches = (options.no_cache) ? 0 :
+			  (options.n_caches > 0) ? options.n_caches : 10;
 	param->inband_tags = options.inband_tags;
 
 #ifdef CONFIG_YAFFS_DISABLE_LAZY_LOAD
@@ -2262,6 +2302,8 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 		param->read_chunk_tags_fn = nandmtd2_read_chunk_tags;
 		param->bad_block_fn = nandmtd2_mark_block_bad;
 		param->query_block_fn = nandmtd2_query_block;
+		param->scan_prefetch_start_fn = nandmtd2_scan_prefetch_start;
+		param->scan_prefetch_stop_fn = nandmtd2_scan_prefetch_stop;
 		yaffs_dev_to_lc(dev)->spare_buffer = 
 		                kmalloc(mtd->oobsize, GFP_NOFS);
 		param->is_yaffs2 = 1;
@@ -2287,6 +2329,9 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 
 	param->sb_dirty_fn = yaffs_touch_super;
 	param->gc_control = yaffs_gc_control_callback;
+	param->gc_wake_fn = yaffs_bg_gc_wake;
+	param->gc_reserve_blocks = yaffs_gc_reserve;
+	param->checkpt_max_deltas = yaffs_checkpt_deltas;
 
 	yaffs_dev_to_lc(dev)->super = sb;
 
@@ -2442,6 +2487,24 @@ static char *yaffs_dump_dev_part0(char *buf, struct yaffs_dev *dev)
 			param->n_reserved_blocks);
 	buf += sprintf(buf, "always_check_erased... %d\n",
 			param->always_check_erased);
+	buf += sprintf(buf, "gc_reserve_blocks..... %d\n",
+			param->gc_reserve_blocks);
+	buf += sprintf(buf, "checkpt_max_deltas.... %d\n",
+			param->checkpt_max_deltas);
+
+	return buf;
+}
+
+/* One "<bound>:count" pair per bucket, the last one is open ended */
+static char *yaffs_dump_gc_hist(char *buf, const char *name, const u32 *hist)
+{
+	int i;
+
+	buf += sprintf(buf, "%s", name);
+	for (i = 0; i < YAFFS_GC_HIST_BUCKETS - 1; i++)
+		buf += sprintf(buf, " <%u:%u",
+			       (1 << YAFFS_GC_HIST_SHIFT) << i, hist[i]);
+	buf += sprintf(buf, " more:%u\n", hist[i]);
 
 	return buf;
 }
@@ -2457,6 +2520,9 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_erased_blocks....... %d\n", dev->n_erased_blocks);
 	buf +=
 	    sprintf(buf, "blocks_in_checkpt..... %d\n", dev->blocks_in_checkpt);
+	buf += sprintf(buf, "checkpt_base_blocks... %d\n",
+			dev->checkpt_base_blocks);
+	buf += sprintf(buf, "checkpt_n_deltas...... %d\n", dev->checkpt_n_deltas);
 	buf += sprintf(buf, "\n");
 	buf += sprintf(buf, "n_tnodes.............. %d\n", dev->n_tnodes);
 	buf += sprintf(buf, "n_obj................. %d\n", dev->n_obj);
@@ -2474,6 +2540,13 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 		    dev->oldest_dirty_gc_count);
 	buf += sprintf(buf, "n_gc_blocks........... %u\n", dev->n_gc_blocks);
 	buf += sprintf(buf, "bg_gcs................ %u\n", dev->bg_gcs);
+	buf = yaffs_dump_gc_hist(buf, "gc_fg_latency_us......", dev->gc_fg_hist);
+	buf = yaffs_dump_gc_hist(buf, "gc_bg_latency_us......", dev->gc_bg_hist);
+	buf +=
+	    sprintf(buf, "scan_us............... query:%u sort:%u tags:%u "
+		    "process:%u fixup:%u\n", dev->scan_query_us,
+		    dev->scan_sort_us, dev->scan_tags_us, dev->scan_process_us,
+		    dev->scan_fixup_us);
 	buf +=
 	    sprintf(buf, "n_retired_writes...... %u\n", dev->n_retired_writes);
 	buf +=
@@ -2486,6 +2559,9 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_tags_ecc_unfixed.... %u\n",
 		    dev->n_tags_ecc_unfixed);
 	buf += sprintf(buf, "cache_hits............ %u\n", dev->cache_hits);
+	buf += sprintf(buf, "cache_misses.......... %u\n", dev->cache_misses);
+	buf +=
+	    sprintf(buf, "cache_evictions....... %u\n", dev->cache_evictions);
 	buf +=
 	    sprintf(buf, "n_deleted_files....... %u\n", dev->n_deleted_files);
 	buf +=
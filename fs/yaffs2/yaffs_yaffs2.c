@@ -250,6 +250,138 @@ int yaffs_calc_checkpt_blocks_required(struct yaffs_dev *dev)
 
 /*--------------------- Checkpointing --------------------*/
 
+/* Can the base checkpoint be kept on flash and added to with deltas? */
+static int yaffs2_checkpt_may_keep(struct yaffs_dev *dev)
+{
+	return dev->param.checkpt_max_deltas > 0 && dev->checkpt_obj_bits;
+}
+
+/*
+ * Checkpoint deltas.
+ * With deltas on, a full checkpoint (the base) is no longer erased by the
+ * first write after it. Instead every object and block that changes is
+ * marked, and the next checkpoint only writes those, as a delta stream
+ * next to the base. Deltas are cumulative: a new one replaces the last,
+ * so a mount reads at most the base and one delta. The base is dropped
+ * once it holds blocks we need, or when a full checkpoint is cheaper.
+ */
+#define YAFFS_CHECKPT_OBJ_BITS_SIZE	(YAFFS_OBJECT_SPACE / 8)
+
+static int yaffs2_checkpt_block_bits_size(struct yaffs_dev *dev)
+{
+	return (dev->internal_end_block - dev->internal_start_block + 8) / 8;
+}
+
+static int yaffs2_checkpt_bit(const u8 *bits, int n)
+{
+	return bits[n / 8] & (1 << (n & 7));
+}
+
+static void yaffs2_checkpt_mark(u8 *bits, int n, int *n_marked)
+{
+	if (!yaffs2_checkpt_bit(bits, n)) {
+		bits[n / 8] |= (1 << (n & 7));
+		(*n_marked)++;
+	}
+}
+
+static int yaffs2_checkpt_tracking(struct yaffs_dev *dev)
+{
+	return dev->checkpt_base_blocks > 0 && dev->checkpt_obj_bits;
+}
+
+void yaffs2_checkpt_obj_changed(struct yaffs_obj *obj)
+{
+	struct yaffs_dev *dev = obj->my_dev;
+
+	if (yaffs2_checkpt_tracking(dev))
+		yaffs2_checkpt_mark(dev->checkpt_obj_bits, obj->obj_id,
+				    &dev->checkpt_objs_changed);
+}
+
+void yaffs2_checkpt_block_changed(struct yaffs_dev *dev, int block_no)
+{
+	if (yaffs2_checkpt_tracking(dev))
+		yaffs2_checkpt_mark(dev->checkpt_block_bits,
+				    block_no - dev->internal_start_block,
+				    &dev->checkpt_blocks_changed);
+}
+
+static void yaffs2_checkpt_delta_reset(struct yaffs_dev *dev)
+{
+	if (!dev->checkpt_obj_bits)
+		return;
+
+	memset(dev->checkpt_obj_bits, 0, YAFFS_CHECKPT_OBJ_BITS_SIZE);
+	memset(dev->checkpt_block_bits, 0,
+	       yaffs2_checkpt_block_bits_size(dev));
+	dev->checkpt_objs_changed = 0;
+	dev->checkpt_blocks_changed = 0;
+}
+
+void yaffs2_checkpt_delta_init(struct yaffs_dev *dev)
+{
+	dev->checkpt_base_blocks = 0;
+	dev->checkpt_n_deltas = 0;
+
+	if (!dev->param.is_yaffs2)
+		return;
+
+	dev->checkpt_obj_bits = kmalloc(YAFFS_CHECKPT_OBJ_BITS_SIZE, GFP_NOFS);
+	if (!dev->checkpt_obj_bits) {
+		dev->checkpt_obj_bits = vmalloc(YAFFS_CHECKPT_OBJ_BITS_SIZE);
+		dev->checkpt_obj_bits_alt = 1;
+	} else {
+		dev->checkpt_obj_bits_alt = 0;
+	}
+
+	dev->checkpt_block_bits =
+	    kmalloc(yaffs2_checkpt_block_bits_size(dev), GFP_NOFS);
+
+	if (!dev->checkpt_obj_bits || !dev->checkpt_block_bits) {
+		yaffs_trace(YAFFS_TRACE_ALWAYS,
+			"no memory for checkpoint deltas, not using them");
+		yaffs2_checkpt_delta_deinit(dev);
+		return;
+	}
+
+	yaffs2_checkpt_delta_reset(dev);
+}
+
+void yaffs2_checkpt_delta_deinit(struct yaffs_dev *dev)
+{
+	if (dev->checkpt_obj_bits_alt)
+		vfree(dev->checkpt_obj_bits);
+	else
+		kfree(dev->checkpt_obj_bits);
+	kfree(dev->checkpt_block_bits);
+
+	dev->checkpt_obj_bits = NULL;
+	dev->checkpt_block_bits = NULL;
+	dev->checkpt_obj_bits_alt = 0;
+	dev->checkpt_base_blocks = 0;
+}
+
+/* Keep the base through this write? Not if its blocks are needed. */
+static int yaffs2_checkpt_keep_base(struct yaffs_dev *dev)
+{
+	return dev->checkpt_base_blocks > 0 &&
+	    yaffs2_checkpt_may_keep(dev) &&
+	    yaffs2_checkpt_required(dev) &&
+	    (dev->n_erased_blocks - dev->param.n_reserved_blocks >
+	     dev->blocks_in_checkpt);
+}
+
+/* Erase the base and any delta */
+static void yaffs2_checkpt_drop(struct yaffs_dev *dev)
+{
+	dev->is_checkpointed = 0;
+	dev->checkpt_base_blocks = 0;
+	dev->checkpt_n_deltas = 0;
+	yaffs2_checkpt_invalidate_stream(dev);
+	yaffs2_checkpt_delta_reset(dev);
+}
+
 static int yaffs2_wr_checkpt_validity_marker(struct yaffs_dev *dev, int head)
 {
 	struct yaffs_checkpt_validity cp;
@@ -258,12 +390,14 @@ static int yaffs2_wr_checkpt_validity_marker(struct yaffs_dev *dev, int head)
 
 	cp.struct_type = sizeof(cp);
 	cp.magic = YAFFS_MAGIC;
-	cp.version = YAFFS_CHECKPOINT_VERSION;
+	cp.version = yaffs2_checkpt_may_keep(dev) ?
+	    YAFFS_CHECKPOINT_VERSION_KEPT : YAFFS_CHECKPOINT_VERSION;
 	cp.head = (head) ? 1 : 0;
 
 	return (yaffs2_checkpt_wr(dev, &cp, sizeof(cp)) == sizeof(cp)) ? 1 : 0;
 }
 
+/* Returns the checkpoint version, or 0 if the marker is no good */
 static int yaffs2_rd_checkpt_validity_marker(struct yaffs_dev *dev, int head)
 {
 	struct yaffs_checkpt_validity cp;
@@ -274,9 +408,10 @@ static int yaffs2_rd_checkpt_validity_marker(struct yaffs_dev *dev, int head)
 	if (ok)
 		ok = (cp.struct_type == sizeof(cp)) &&
 		    (cp.magic == YAFFS_MAGIC) &&
-		    (cp.version == YAFFS_CHECKPOINT_VERSION) &&
+		    (cp.version == YAFFS_CHECKPOINT_VERSION ||
+		     cp.version == YAFFS_CHECKPOINT_VERSION_KEPT) &&
 		    (cp.head == ((head) ? 1 : 0));
-	return ok ? 1 : 0;
+	return ok ? cp.version : 0;
 }
 
 static void yaffs2_dev_to_checkpt_dev(struct yaffs_checkpt_dev *cp,
@@ -340,7 +475,41 @@ static int yaffs2_wr_checkpt_dev(struct yaffs_dev *dev)
 
 }
 
-static int yaffs2_rd_checkpt_dev(struct yaffs_dev *dev)
+/* Read the base's block info, keeping what a delta already put there */
+static int yaffs2_rd_checkpt_blocks_unchanged(struct yaffs_dev *dev)
+{
+	struct yaffs_block_info bi;
+	u32 n_blocks =
+	    (dev->internal_end_block - dev->internal_start_block + 1);
+	u8 *scratch;
+	u8 *bits;
+	int n_bytes;
+	int ok = 1;
+	int i;
+
+	for (i = 0; ok && i < n_blocks; i++) {
+		n_bytes = sizeof(struct yaffs_block_info);
+		if (yaffs2_checkpt_bit(dev->checkpt_block_bits, i))
+			ok = (yaffs2_checkpt_rd(dev, &bi, n_bytes) == n_bytes);
+		else
+			ok = (yaffs2_checkpt_rd(dev, &dev->block_info[i],
+						n_bytes) == n_bytes);
+	}
+
+	scratch = yaffs_get_temp_buffer(dev, __LINE__);
+	for (i = 0; ok && i < n_blocks; i++) {
+		n_bytes = dev->chunk_bit_stride;
+		bits = dev->chunk_bits + i * n_bytes;
+		if (yaffs2_checkpt_bit(dev->checkpt_block_bits, i))
+			bits = scratch;
+		ok = (yaffs2_checkpt_rd(dev, bits, n_bytes) == n_bytes);
+	}
+	yaffs_release_temp_buffer(dev, scratch, __LINE__);
+
+	return ok;
+}
+
+static int yaffs2_rd_checkpt_dev(struct yaffs_dev *dev, int delta_loaded)
 {
 	struct yaffs_checkpt_dev cp;
 	u32 n_bytes;
@@ -356,6 +525,10 @@ static int yaffs2_rd_checkpt_dev(struct yaffs_dev *dev)
 	if (cp.struct_type != sizeof(cp))
 		return 0;
 
+	/* A delta carries newer runtime values and block info */
+	if (delta_loaded)
+		return yaffs2_rd_checkpt_blocks_unchanged(dev);
+
 	yaffs_checkpt_dev_to_dev(dev, &cp);
 
 	n_bytes = n_blocks * sizeof(struct yaffs_block_info);
@@ -554,10 +727,39 @@ static int yaffs2_rd_checkpt_tnodes(struct yaffs_obj *obj)
 	return ok ? 1 : 0;
 }
 
+static int yaffs2_wr_checkpt_obj(struct yaffs_dev *dev, struct yaffs_obj *obj)
+{
+	struct yaffs_checkpt_obj cp;
+	int ok;
+
+	yaffs2_obj_checkpt_obj(&cp, obj);
+	cp.struct_type = sizeof(cp);
+
+	yaffs_trace(YAFFS_TRACE_CHECKPOINT,
+		"Checkpoint write object %d parent %d type %d chunk %d obj addr %p",
+		cp.obj_id, cp.parent_id, cp.variant_type, cp.hdr_chunk, obj);
+
+	ok = (yaffs2_checkpt_wr(dev, &cp, sizeof(cp)) == sizeof(cp));
+
+	if (ok && obj->variant_type == YAFFS_OBJECT_TYPE_FILE)
+		ok = yaffs2_wr_checkpt_tnodes(obj);
+
+	return ok;
+}
+
+static int yaffs2_wr_checkpt_obj_end(struct yaffs_dev *dev)
+{
+	struct yaffs_checkpt_obj cp;
+
+	memset(&cp, 0xFF, sizeof(struct yaffs_checkpt_obj));
+	cp.struct_type = sizeof(cp);
+
+	return (yaffs2_checkpt_wr(dev, &cp, sizeof(cp)) == sizeof(cp));
+}
+
 static int yaffs2_wr_checkpt_objs(struct yaffs_dev *dev)
 {
 	struct yaffs_obj *obj;
-	struct yaffs_checkpt_obj cp;
 	int i;
 	int ok = 1;
 	struct list_head *lh;
@@ -571,46 +773,58 @@ static int yaffs2_wr_checkpt_objs(struct yaffs_dev *dev)
 			if (lh) {
 				obj =
 				    list_entry(lh, struct yaffs_obj, hash_link);
-				if (!obj->defered_free) {
-					yaffs2_obj_checkpt_obj(&cp, obj);
-					cp.struct_type = sizeof(cp);
-
-					yaffs_trace(YAFFS_TRACE_CHECKPOINT,
-						"Checkpoint write object %d parent %d type %d chunk %d obj addr %p",
-						cp.obj_id, cp.parent_id,
-						cp.variant_type, cp.hdr_chunk, obj);
-
-					ok = (yaffs2_checkpt_wr
-					      (dev, &cp,
-					       sizeof(cp)) == sizeof(cp));
-
-					if (ok
-					    && obj->variant_type ==
-					    YAFFS_OBJECT_TYPE_FILE)
-						ok = yaffs2_wr_checkpt_tnodes
-						    (obj);
-				}
+				if (!obj->defered_free)
+					ok = yaffs2_wr_checkpt_obj(dev, obj);
 			}
 		}
 	}
 
 	/* Dump end of list */
-	memset(&cp, 0xFF, sizeof(struct yaffs_checkpt_obj));
-	cp.struct_type = sizeof(cp);
-
 	if (ok)
-		ok = (yaffs2_checkpt_wr(dev, &cp, sizeof(cp)) == sizeof(cp));
+		ok = yaffs2_wr_checkpt_obj_end(dev);
 
 	return ok ? 1 : 0;
 }
 
-static int yaffs2_rd_checkpt_objs(struct yaffs_dev *dev)
+/* Step over the tnodes of an object a delta has replaced */
+static int yaffs2_skip_checkpt_tnodes(struct yaffs_dev *dev)
+{
+	u32 base_chunk;
+	u8 *scratch;
+	int ok;
+
+	scratch = yaffs_get_temp_buffer(dev, __LINE__);
+
+	ok = (yaffs2_checkpt_rd(dev, &base_chunk, sizeof(base_chunk)) ==
+	      sizeof(base_chunk));
+	while (ok && (~base_chunk)) {
+		ok = (yaffs2_checkpt_rd(dev, scratch, dev->tnode_size) ==
+		      dev->tnode_size);
+		if (ok)
+			ok = (yaffs2_checkpt_rd
+			      (dev, &base_chunk,
+			       sizeof(base_chunk)) == sizeof(base_chunk));
+	}
+
+	yaffs_release_temp_buffer(dev, scratch, __LINE__);
+
+	return ok;
+}
+
+/*
+ * Objects from a delta are read first and marked changed; the base then
+ * skips its stale copies of them. A delta record of type unknown is an
+ * object that no longer exists. Hard links are only collected on
+ * hard_list, they are fixed up once everything has been read.
+ */
+static int yaffs2_rd_checkpt_objs(struct yaffs_dev *dev,
+				  struct yaffs_obj **hard_list, int delta,
+				  int skip_changed)
 {
 	struct yaffs_obj *obj;
 	struct yaffs_checkpt_obj cp;
 	int ok = 1;
 	int done = 0;
-	struct yaffs_obj *hard_list = NULL;
 
 	while (ok && !done) {
 		ok = (yaffs2_checkpt_rd(dev, &cp, sizeof(cp)) == sizeof(cp));
@@ -628,7 +842,23 @@ static int yaffs2_rd_checkpt_objs(struct yaffs_dev *dev)
 
 		if (ok && cp.obj_id == ~0) {
 			done = 1;
+		} else if (ok && (delta || skip_changed) &&
+			   cp.obj_id > YAFFS_MAX_OBJECT_ID) {
+			ok = 0;
+		} else if (ok && skip_changed &&
+			   yaffs2_checkpt_bit(dev->checkpt_obj_bits,
+					      cp.obj_id)) {
+			if (cp.variant_type == YAFFS_OBJECT_TYPE_FILE)
+				ok = yaffs2_skip_checkpt_tnodes(dev);
+		} else if (ok && delta &&
+			   cp.variant_type == YAFFS_OBJECT_TYPE_UNKNOWN) {
+			yaffs2_checkpt_mark(dev->checkpt_obj_bits, cp.obj_id,
+					    &dev->checkpt_objs_changed);
 		} else if (ok) {
+			if (delta)
+				yaffs2_checkpt_mark(dev->checkpt_obj_bits,
+						    cp.obj_id,
+						    &dev->checkpt_objs_changed);
 			obj =
 			    yaffs_find_or_create_by_number(dev, cp.obj_id,
 							   cp.variant_type);
@@ -641,8 +871,8 @@ static int yaffs2_rd_checkpt_objs(struct yaffs_dev *dev)
 				} else if (obj->variant_type ==
 					   YAFFS_OBJECT_TYPE_HARDLINK) {
 					obj->hard_links.next =
-					    (struct list_head *)hard_list;
-					hard_list = obj;
+					    (struct list_head *)*hard_list;
+					*hard_list = obj;
 				}
 			} else {
 				ok = 0;
@@ -650,13 +880,10 @@ static int yaffs2_rd_checkpt_objs(struct yaffs_dev *dev)
 		}
 	}
 
-	if (ok)
-		yaffs_link_fixup(dev, hard_list);
-
 	return ok ? 1 : 0;
 }
 
-static int yaffs2_wr_checkpt_sum(struct yaffs_dev *dev)
+static int yaffs2_wr_checkpt_sum(struct yaffs_dev *dev, u32 *sum)
 {
 	u32 checkpt_sum;
 	int ok;
@@ -669,10 +896,11 @@ static int yaffs2_wr_checkpt_sum(struct yaffs_dev *dev)
 	if (!ok)
 		return 0;
 
+	*sum = checkpt_sum;
 	return 1;
 }
 
-static int yaffs2_rd_checkpt_sum(struct yaffs_dev *dev)
+static int yaffs2_rd_checkpt_sum(struct yaffs_dev *dev, u32 *sum)
 {
 	u32 checkpt_sum0;
 	u32 checkpt_sum1;
@@ -689,11 +917,13 @@ static int yaffs2_rd_checkpt_sum(struct yaffs_dev *dev)
 	if (checkpt_sum0 != checkpt_sum1)
 		return 0;
 
+	*sum = checkpt_sum0;
 	return 1;
 }
 
 static int yaffs2_wr_checkpt_data(struct yaffs_dev *dev)
 {
+	u32 sum;
 	int ok = 1;
 
 	if (!yaffs2_checkpt_required(dev)) {
@@ -727,23 +957,366 @@ static int yaffs2_wr_checkpt_data(struct yaffs_dev *dev)
 	}
 
 	if (ok)
-		ok = yaffs2_wr_checkpt_sum(dev);
+		ok = yaffs2_wr_checkpt_sum(dev, &sum);
 
 	if (!yaffs_checkpt_close(dev))
 		ok = 0;
 
-	if (ok)
+	if (ok) {
 		dev->is_checkpointed = 1;
-	else
+
+		/* This is the new base */
+		dev->checkpt_base_blocks = yaffs2_checkpt_may_keep(dev) ?
+		    dev->blocks_in_checkpt : 0;
+		dev->checkpt_base_sum = sum;
+		dev->checkpt_n_deltas = 0;
+		yaffs2_checkpt_delta_reset(dev);
+	} else {
 		dev->is_checkpointed = 0;
+	}
 
 	return dev->is_checkpointed;
 }
 
+static int yaffs2_wr_checkpt_delta_dev(struct yaffs_dev *dev)
+{
+	struct yaffs_checkpt_dev cp;
+
+	yaffs2_dev_to_checkpt_dev(&cp, dev);
+	cp.struct_type = sizeof(cp);
+
+	/* Closing the base on mount takes its blocks off again */
+	cp.n_erased_blocks += dev->checkpt_base_blocks;
+	cp.n_free_chunks +=
+	    dev->checkpt_base_blocks * dev->param.chunks_per_block;
+
+	return (yaffs2_checkpt_wr(dev, &cp, sizeof(cp)) == sizeof(cp));
+}
+
+static int yaffs2_wr_checkpt_delta_blocks(struct yaffs_dev *dev)
+{
+	u32 n_blocks =
+	    (dev->internal_end_block - dev->internal_start_block + 1);
+	u32 end_marker = ~0;
+	u32 i;
+	int n_bytes;
+	int ok = 1;
+
+	for (i = 0; ok && i < n_blocks; i++) {
+		if (!yaffs2_checkpt_bit(dev->checkpt_block_bits, i))
+			continue;
+
+		ok = (yaffs2_checkpt_wr(dev, &i, sizeof(i)) == sizeof(i));
+
+		n_bytes = sizeof(struct yaffs_block_info);
+		if (ok)
+			ok = (yaffs2_checkpt_wr(dev, &dev->block_info[i],
+						n_bytes) == n_bytes);
+
+		n_bytes = dev->chunk_bit_stride;
+		if (ok)
+			ok = (yaffs2_checkpt_wr(dev,
+						dev->chunk_bits + i * n_bytes,
+						n_bytes) == n_bytes);
+	}
+
+	if (ok)
+		ok = (yaffs2_checkpt_wr(dev, &end_marker, sizeof(end_marker)) ==
+		      sizeof(end_marker));
+
+	return ok;
+}
+
+static int yaffs2_wr_checkpt_delta_objs(struct yaffs_dev *dev)
+{
+	struct yaffs_checkpt_obj cp;
+	struct yaffs_obj *obj;
+	int ok = 1;
+	int i;
+
+	for (i = 0; ok && i < YAFFS_OBJECT_SPACE; i++) {
+		if (!(i & 7) && !dev->checkpt_obj_bits[i / 8]) {
+			i += 7;
+			continue;
+		}
+		if (!yaffs2_checkpt_bit(dev->checkpt_obj_bits, i))
+			continue;
+
+		obj = yaffs_find_by_number(dev, i);
+		if (obj && !obj->defered_free) {
+			ok = yaffs2_wr_checkpt_obj(dev, obj);
+		} else {
+			/* Gone since the base */
+			memset(&cp, 0, sizeof(cp));
+			cp.struct_type = sizeof(cp);
+			cp.obj_id = i;
+			cp.variant_type = YAFFS_OBJECT_TYPE_UNKNOWN;
+			ok = (yaffs2_checkpt_wr(dev, &cp, sizeof(cp)) ==
+			      sizeof(cp));
+		}
+	}
+
+	if (ok)
+		ok = yaffs2_wr_checkpt_obj_end(dev);
+
+	return ok;
+}
+
+/*
+ * Write what changed since the base, in place of the last delta.
+ * Returns 0 if a full checkpoint should be written instead.
+ */
+static int yaffs2_wr_checkpt_delta(struct yaffs_dev *dev)
+{
+	struct yaffs_checkpt_delta cd;
+	int n_blocks = dev->internal_end_block - dev->internal_start_block + 1;
+	u32 sum;
+	int ok;
+
+	if (!yaffs2_checkpt_keep_base(dev) ||
+	    dev->checkpt_n_deltas >= dev->param.checkpt_max_deltas)
+		return 0;
+
+	/* Past half of everything a full checkpoint is about as big */
+	if (dev->checkpt_objs_changed > dev->n_obj / 2 ||
+	    dev->checkpt_blocks_changed > n_blocks / 2)
+		return 0;
+
+	dev->checkpt_delta = 1;
+	if (!yaffs2_checkpt_open(dev, 1)) {
+		dev->checkpt_delta = 0;
+		return 0;
+	}
+
+	yaffs_trace(YAFFS_TRACE_CHECKPOINT,
+		"write checkpoint delta %d: %d objects %d blocks",
+		dev->checkpt_n_deltas + 1, dev->checkpt_objs_changed,
+		dev->checkpt_blocks_changed);
+
+	ok = yaffs2_wr_checkpt_validity_marker(dev, 1);
+	if (ok) {
+		memset(&cd, 0, sizeof(cd));
+		cd.struct_type = sizeof(cd);
+		cd.base_sum = dev->checkpt_base_sum;
+		cd.n_deltas = dev->checkpt_n_deltas + 1;
+		ok = (yaffs2_checkpt_wr(dev, &cd, sizeof(cd)) == sizeof(cd));
+	}
+	if (ok)
+		ok = yaffs2_wr_checkpt_delta_dev(dev);
+	if (ok)
+		ok = yaffs2_wr_checkpt_delta_blocks(dev);
+	if (ok)
+		ok = yaffs2_wr_checkpt_delta_objs(dev);
+	if (ok)
+		ok = yaffs2_wr_checkpt_validity_marker(dev, 0);
+	if (ok)
+		ok = yaffs2_wr_checkpt_sum(dev, &sum);
+
+	if (!yaffs_checkpt_close(dev))
+		ok = 0;
+	dev->checkpt_delta = 0;
+
+	/* The base's blocks were left alone */
+	dev->blocks_in_checkpt += dev->checkpt_base_blocks;
+
+	if (ok) {
+		dev->checkpt_n_deltas++;
+		dev->is_checkpointed = 1;
+	}
+
+	return ok;
+}
+
+static int yaffs2_rd_checkpt_delta_blocks(struct yaffs_dev *dev)
+{
+	u32 n_blocks =
+	    (dev->internal_end_block - dev->internal_start_block + 1);
+	u32 i;
+	int n_bytes;
+	int ok;
+
+	ok = (yaffs2_checkpt_rd(dev, &i, sizeof(i)) == sizeof(i));
+
+	while (ok && i != ~0) {
+		ok = (i < n_blocks);
+
+		n_bytes = sizeof(struct yaffs_block_info);
+		if (ok)
+			ok = (yaffs2_checkpt_rd(dev, &dev->block_info[i],
+						n_bytes) == n_bytes);
+
+		n_bytes = dev->chunk_bit_stride;
+		if (ok)
+			ok = (yaffs2_checkpt_rd(dev,
+						dev->chunk_bits + i * n_bytes,
+						n_bytes) == n_bytes);
+
+		if (ok) {
+			yaffs2_checkpt_mark(dev->checkpt_block_bits, i,
+					    &dev->checkpt_blocks_changed);
+			ok = (yaffs2_checkpt_rd(dev, &i, sizeof(i)) ==
+			      sizeof(i));
+		}
+	}
+
+	return ok;
+}
+
+/*
+ * Read the delta, if one was written since the base. What it holds is
+ * marked, so that reading the base afterwards skips it. *found tells
+ * whether the base must be a kept one that matches.
+ */
+static int yaffs2_rd_checkpt_delta(struct yaffs_dev *dev,
+				   struct yaffs_obj **hard_list, int *found)
+{
+	struct yaffs_checkpt_delta cd;
+	struct yaffs_checkpt_dev cp;
+	u32 sum;
+	int version;
+	int blk;
+	int i;
+	int ok;
+
+	*found = 0;
+
+	dev->checkpt_delta = 1;
+	ok = yaffs2_checkpt_open(dev, 0);
+
+	if (ok) {
+		version = yaffs2_rd_checkpt_validity_marker(dev, 1);
+		if (!version && dev->blocks_in_checkpt == 0) {
+			/* Nothing but the base */
+			yaffs_checkpt_close(dev);
+			dev->checkpt_delta = 0;
+			return 1;
+		}
+		*found = 1;
+		ok = (version == YAFFS_CHECKPOINT_VERSION_KEPT);
+	}
+	if (ok) {
+		ok = (yaffs2_checkpt_rd(dev, &cd, sizeof(cd)) == sizeof(cd)) &&
+		    cd.struct_type == sizeof(cd);
+	}
+	if (ok) {
+		ok = (yaffs2_checkpt_rd(dev, &cp, sizeof(cp)) == sizeof(cp)) &&
+		    cp.struct_type == sizeof(cp);
+		if (ok)
+			yaffs_checkpt_dev_to_dev(dev, &cp);
+	}
+	if (ok)
+		ok = yaffs2_rd_checkpt_delta_blocks(dev);
+	if (ok)
+		ok = yaffs2_rd_checkpt_objs(dev, hard_list, 1, 0);
+	if (ok)
+		ok = (yaffs2_rd_checkpt_validity_marker(dev, 0) ==
+		      YAFFS_CHECKPOINT_VERSION_KEPT);
+	if (ok)
+		ok = yaffs2_rd_checkpt_sum(dev, &sum);
+
+	/* The delta's own blocks are not for the base to describe */
+	for (i = 0; ok && i < dev->blocks_in_checkpt; i++) {
+		blk = dev->checkpt_block_list[i];
+		if (blk < dev->internal_start_block ||
+		    blk > dev->internal_end_block)
+			continue;
+		yaffs_get_block_info(dev, blk)->block_state =
+		    YAFFS_BLOCK_STATE_CHECKPOINT;
+		yaffs2_checkpt_mark(dev->checkpt_block_bits,
+				    blk - dev->internal_start_block,
+				    &dev->checkpt_blocks_changed);
+	}
+
+	if (!yaffs_checkpt_close(dev))
+		ok = 0;
+	dev->checkpt_delta = 0;
+
+	if (ok) {
+		dev->checkpt_base_sum = cd.base_sum;
+		dev->checkpt_n_deltas = cd.n_deltas;
+	}
+
+	return ok;
+}
+
+/*
+ * A kept checkpoint is not erased by writes, so after a crash it can be
+ * older than the flash. Only trust it if every block is still in the
+ * state it records and nothing was written past the allocation point.
+ */
+static int yaffs2_checkpt_fresh(struct yaffs_dev *dev)
+{
+	struct yaffs_block_info *bi;
+	struct yaffs_ext_tags tags;
+	enum yaffs_block_state state;
+	u32 seq_number;
+	int blk;
+	int ok = 1;
+
+	for (blk = dev->internal_start_block;
+	     ok && blk <= dev->internal_end_block; blk++) {
+		bi = yaffs_get_block_info(dev, blk);
+		yaffs_query_init_block_state(dev, blk, &state, &seq_number);
+
+		if (seq_number == YAFFS_SEQUENCE_CHECKPOINT_DATA)
+			state = YAFFS_BLOCK_STATE_CHECKPOINT;
+		else if (seq_number == YAFFS_SEQUENCE_BAD_BLOCK)
+			state = YAFFS_BLOCK_STATE_DEAD;
+
+		switch (state) {
+		case YAFFS_BLOCK_STATE_EMPTY:
+			ok = bi->pages_in_use == 0 &&
+			    bi->block_state != YAFFS_BLOCK_STATE_CHECKPOINT &&
+			    bi->block_state != YAFFS_BLOCK_STATE_DEAD;
+			break;
+		case YAFFS_BLOCK_STATE_CHECKPOINT:
+		case YAFFS_BLOCK_STATE_DEAD:
+			ok = (bi->block_state == state);
+			break;
+		default:
+			ok = bi->block_state != YAFFS_BLOCK_STATE_EMPTY &&
+			    bi->block_state != YAFFS_BLOCK_STATE_CHECKPOINT &&
+			    bi->block_state != YAFFS_BLOCK_STATE_DEAD &&
+			    bi->seq_number == seq_number;
+			break;
+		}
+
+		if (!ok)
+			yaffs_trace(YAFFS_TRACE_CHECKPOINT | YAFFS_TRACE_MOUNT,
+				"checkpoint is stale: block %d is %d on flash, %d in checkpoint",
+				blk, state, bi->block_state);
+	}
+
+	if (ok && dev->alloc_block > 0 &&
+	    dev->alloc_page < dev->param.chunks_per_block) {
+		yaffs_rd_chunk_tags_nand(dev,
+					 dev->alloc_block *
+					 dev->param.chunks_per_block +
+					 dev->alloc_page, NULL, &tags);
+		if (tags.chunk_used) {
+			yaffs_trace(YAFFS_TRACE_CHECKPOINT | YAFFS_TRACE_MOUNT,
+				"checkpoint is stale: chunk %d of block %d written",
+				dev->alloc_page, dev->alloc_block);
+			ok = 0;
+		}
+	}
+
+	return ok;
+}
+
 static int yaffs2_rd_checkpt_data(struct yaffs_dev *dev)
 {
+	struct yaffs_obj *hard_list = NULL;
+	int delta_found = 0;
+	int delta_blocks = 0;
+	int version = 0;
+	u32 sum = 0;
 	int ok = 1;
 
+	dev->checkpt_base_blocks = 0;
+	dev->checkpt_n_deltas = 0;
+	yaffs2_checkpt_delta_reset(dev);
+
 	if (!dev->param.is_yaffs2)
 		ok = 0;
 
@@ -753,32 +1326,42 @@ static int yaffs2_rd_checkpt_data(struct yaffs_dev *dev)
 		ok = 0;
 	}
 
+	if (ok && yaffs2_checkpt_may_keep(dev)) {
+		yaffs_trace(YAFFS_TRACE_CHECKPOINT,
+			"read checkpoint delta");
+		ok = yaffs2_rd_checkpt_delta(dev, &hard_list, &delta_found);
+		delta_blocks = dev->blocks_in_checkpt;
+	}
+
 	if (ok)
 		ok = yaffs2_checkpt_open(dev, 0); /* open for read */
 
 	if (ok) {
 		yaffs_trace(YAFFS_TRACE_CHECKPOINT,
 			"read checkpoint validity");
-		ok = yaffs2_rd_checkpt_validity_marker(dev, 1);
+		version = yaffs2_rd_checkpt_validity_marker(dev, 1);
+		ok = version &&
+		    (!delta_found || version == YAFFS_CHECKPOINT_VERSION_KEPT);
 	}
 	if (ok) {
 		yaffs_trace(YAFFS_TRACE_CHECKPOINT,
 			"read checkpoint device");
-		ok = yaffs2_rd_checkpt_dev(dev);
+		ok = yaffs2_rd_checkpt_dev(dev, delta_found);
 	}
 	if (ok) {
 		yaffs_trace(YAFFS_TRACE_CHECKPOINT,
 			"read checkpoint objects");
-		ok = yaffs2_rd_checkpt_objs(dev);
+		ok = yaffs2_rd_checkpt_objs(dev, &hard_list, 0, delta_found);
 	}
 	if (ok) {
 		yaffs_trace(YAFFS_TRACE_CHECKPOINT,
 			"read checkpoint validity");
-		ok = yaffs2_rd_checkpt_validity_marker(dev, 0);
+		ok = (yaffs2_rd_checkpt_validity_marker(dev, 0) == version);
 	}
 
 	if (ok) {
-		ok = yaffs2_rd_checkpt_sum(dev);
+		ok = yaffs2_rd_checkpt_sum(dev, &sum) &&
+		    (!delta_found || sum == dev->checkpt_base_sum);
 		yaffs_trace(YAFFS_TRACE_CHECKPOINT,
 			"read checkpoint checksum %d", ok);
 	}
@@ -786,10 +1369,27 @@ static int yaffs2_rd_checkpt_data(struct yaffs_dev *dev)
 	if (!yaffs_checkpt_close(dev))
 		ok = 0;
 
-	if (ok)
+	if (ok && version == YAFFS_CHECKPOINT_VERSION_KEPT)
+		ok = yaffs2_checkpt_fresh(dev);
+
+	if (ok) {
+		yaffs_link_fixup(dev, hard_list);
+
+		if (version == YAFFS_CHECKPOINT_VERSION_KEPT &&
+		    yaffs2_checkpt_may_keep(dev))
+			dev->checkpt_base_blocks = dev->blocks_in_checkpt;
+		if (!delta_found) {
+			dev->checkpt_base_sum = sum;
+			dev->checkpt_n_deltas = 0;
+		}
+		dev->blocks_in_checkpt += delta_blocks;
 		dev->is_checkpointed = 1;
-	else
+	} else {
+		dev->checkpt_base_blocks = 0;
+		dev->checkpt_n_deltas = 0;
+		yaffs2_checkpt_delta_reset(dev);
 		dev->is_checkpointed = 0;
+	}
 
 	return ok ? 1 : 0;
 
@@ -799,7 +1399,8 @@ void yaffs2_checkpt_invalidate(struct yaffs_dev *dev)
 {
 	if (dev->is_checkpointed || dev->blocks_in_checkpt > 0) {
 		dev->is_checkpointed = 0;
-		yaffs2_checkpt_invalidate_stream(dev);
+		if (!yaffs2_checkpt_keep_base(dev))
+			yaffs2_checkpt_drop(dev);
 	}
 	if (dev->param.sb_dirty_fn)
 		dev->param.sb_dirty_fn(dev);
@@ -816,8 +1417,8 @@ int yaffs_checkpoint_save(struct yaffs_dev *dev)
 	yaffs_verify_blocks(dev);
 	yaffs_verify_free_chunks(dev);
 
-	if (!dev->is_checkpointed) {
-		yaffs2_checkpt_invalidate(dev);
+	if (!dev->is_checkpointed && !yaffs2_wr_checkpt_delta(dev)) {
+		yaffs2_checkpt_drop(dev);
 		yaffs2_wr_checkpt_data(dev);
 	}
 
@@ -937,11 +1538,6 @@ int yaffs2_handle_hole(struct yaffs_obj *obj, loff_t new_size)
 
 }
 
-struct yaffs_block_index {
-	int seq;
-	int block;
-};
-
 static int yaffs2_ybicmp(const void *a, const void *b)
 {
 	int aseq = ((struct yaffs_block_index *)a)->seq;
@@ -987,10 +1583,17 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	struct yaffs_block_index *block_index = NULL;
 	int alt_block_index = 0;
 
+	u64 scan_start;
+	u64 phase_start;
+	u64 tags_start;
+	u64 tags_us = 0;
+
 	yaffs_trace(YAFFS_TRACE_SCAN,
 		"yaffs2_scan_backwards starts  intstartblk %d intendblk %d...",
 		dev->internal_start_block, dev->internal_end_block);
 
+	scan_start = Y_TIME_US();
+
 	dev->seq_number = YAFFS_LOWEST_SEQUENCE_NUMBER;
 
 	block_index = kmalloc(n_blocks * sizeof(struct yaffs_block_index),
@@ -1014,6 +1617,7 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	chunk_data = yaffs_get_temp_buffer(dev, __LINE__);
 
 	/* Scan all the blocks to determine their state */
+	phase_start = Y_TIME_US();
 	bi = dev->block_info;
 	for (blk = dev->internal_start_block; blk <= dev->internal_end_block;
 	     blk++) {
@@ -1069,18 +1673,27 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 		bi++;
 	}
 
+	dev->scan_query_us = Y_TIME_US() - phase_start;
+
 	yaffs_trace(YAFFS_TRACE_SCAN, "%d blocks to be sorted...", n_to_scan);
 
 	cond_resched();
 
 	/* Sort the blocks by sequence number */
+	phase_start = Y_TIME_US();
 	sort(block_index, n_to_scan, sizeof(struct yaffs_block_index),
 		   yaffs2_ybicmp, NULL);
+	dev->scan_sort_us = Y_TIME_US() - phase_start;
 
 	cond_resched();
 
 	yaffs_trace(YAFFS_TRACE_SCAN, "...done");
 
+	/* Get the tags of the first blocks on their way while we start */
+	if (dev->param.scan_prefetch_start_fn)
+		dev->param.scan_prefetch_start_fn(dev, block_index, n_to_scan);
+	phase_start = Y_TIME_US();
+
 	/* Now scan the blocks looking at the data. */
 	start_iter = 0;
 	end_iter = n_to_scan - 1;
@@ -1114,8 +1727,10 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 			chunk = blk * dev->param.chunks_per_block + c;
 
+			tags_start = Y_TIME_US();
 			result = yaffs_rd_chunk_tags_nand(dev, chunk, NULL,
 							  &tags);
+			tags_us += Y_TIME_US() - tags_start;
 
 			/* Let's have a good look at this chunk... */
 
@@ -1573,6 +2188,11 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 	}
 
+	if (dev->param.scan_prefetch_stop_fn)
+		dev->param.scan_prefetch_stop_fn(dev);
+	dev->scan_tags_us = tags_us;
+	dev->scan_process_us = Y_TIME_US() - phase_start - tags_us;
+
 	yaffs_skip_rest_of_block(dev);
 
 	if (alt_block_index)
@@ -1585,10 +2205,19 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	 * We should now have scanned all the objects, now it's time to add these
 	 * hardlinks.
 	 */
+	phase_start = Y_TIME_US();
 	yaffs_link_fixup(dev, hard_list);
+	dev->scan_fixup_us = Y_TIME_US() - phase_start;
 
 	yaffs_release_temp_buffer(dev, chunk_data, __LINE__);
 
+	yaffs_trace(YAFFS_TRACE_ALWAYS,
+		"scanned %d blocks in %u ms: query %u sort %u tags %u process %u fixup %u",
+		n_to_scan, (u32) (Y_TIME_US() - scan_start) / 1000,
+		dev->scan_query_us / 1000, dev->scan_sort_us / 1000,
+		dev->scan_tags_us / 1000, dev->scan_process_us / 1000,
+		dev->scan_fixup_us / 1000);
+
 	if (alloc_failed)
 		return YAFFS_FAIL;
 
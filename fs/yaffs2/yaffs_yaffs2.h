@@ -30,6 +30,10 @@ int yaffs2_checkpt_required(struct yaffs_dev *dev);
 int yaffs_calc_checkpt_blocks_required(struct yaffs_dev *dev);
 
 void yaffs2_checkpt_invalidate(struct yaffs_dev *dev);
+void yaffs2_checkpt_obj_changed(struct yaffs_obj *obj);
+void yaffs2_checkpt_block_changed(struct yaffs_dev *dev, int block_no);
+void yaffs2_checkpt_delta_init(struct yaffs_dev *dev);
+void yaffs2_checkpt_delta_deinit(struct yaffs_dev *dev);
 int yaffs2_checkpt_save(struct yaffs_dev *dev);
 int yaffs2_checkpt_restore(struct yaffs_dev *dev);
 
@@ -89,6 +89,20 @@ struct mmc_host_ops {
 	int (*enable)(struct mmc_host *host);
 	int (*disable)(struct mmc_host *host, int lazy);
 	void	(*request)(struct mmc_host *host, struct mmc_request *req);
+	/*
+	 * Optional. 'pre_req' is called before 'request', possibly while
+	 * another request is still running on the host, so that the data of
+	 * the next request can be mapped for DMA off the critical path.
+	 * 'is_first_req' is set when nothing is running, in which case there
+	 * is nothing to overlap with. Each request that went through
+	 * 'pre_req' is passed to 'post_req' once it has completed, with
+	 * 'err' non-zero if it was never started; 'post_req' releases what
+	 * 'pre_req' set up. Neither may touch the controller registers.
+	 */
+	void	(*pre_req)(struct mmc_host *host, struct mmc_request *req,
+			   bool is_first_req);
+	void	(*post_req)(struct mmc_host *host, struct mmc_request *req,
+			    int err);
 	/*
 	 * Avoid calling these three functions too often or in a "fast path",
 	 * since underlaying controller might implement them in an expensive
@@ -1235,6 +1235,9 @@ struct task_struct {
 
 	struct list_head tasks;
 	struct plist_node pushable_tasks;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct list_head lowmem_list;	/* lowmemorykiller oom_adj bucket */
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #if defined(SPLIT_RSS_COUNTING)
@@ -1697,6 +1700,10 @@ extern void thread_group_times(struct task_struct *p, cputime_t *ut, cputime_t *
 
 extern int task_free_register(struct notifier_block *n);
 extern int task_free_unregister(struct notifier_block *n);
+extern int task_fork_register(struct notifier_block *n);
+extern int task_fork_unregister(struct notifier_block *n);
+extern int task_release_register(struct notifier_block *n);
+extern int task_release_unregister(struct notifier_block *n);
 
 /*
  * Per process flags
@@ -154,6 +154,21 @@ static void __exit_signal(struct task_struct *tsk)
 	}
 }
 
+/* Notifier list called when a task is unhashed, under tasklist_lock */
+static ATOMIC_NOTIFIER_HEAD(task_release_notifier);
+
+int task_release_register(struct notifier_block *n)
+{
+	return atomic_notifier_chain_register(&task_release_notifier, n);
+}
+EXPORT_SYMBOL(task_release_register);
+
+int task_release_unregister(struct notifier_block *n)
+{
+	return atomic_notifier_chain_unregister(&task_release_notifier, n);
+}
+EXPORT_SYMBOL(task_release_unregister);
+
 static void delayed_put_task_struct(struct rcu_head *rhp)
 {
 	struct task_struct *tsk = container_of(rhp, struct task_struct, rcu);
@@ -181,6 +196,7 @@ repeat:
 	write_lock_irq(&tasklist_lock);
 	tracehook_finish_release_task(p);
 	__exit_signal(p);
+	atomic_notifier_call_chain(&task_release_notifier, 0, p);
 
 	/*
 	 * If we are the last non-leader member of the thread
@@ -27,6 +27,9 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/jiffies.h>
+#include <linux/moduleparam.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -37,10 +40,11 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its own `lock'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
+	struct mutex lock;		/* protects the area and its ranges */
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
 	struct list_head unpinned_list;	/* list of all ashmem areas */
 	struct file *file;		/* the shmem-based backing file */
@@ -51,7 +55,7 @@ struct ashmem_area {
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `lock'; `lru' also by `ashmem_lru_lock'
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
@@ -60,20 +64,37 @@ struct ashmem_range {
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
+	unsigned long unpinned_at;	/* jiffies when unpinned */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, oldest first, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list, lru_count and purge_age
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Lock Ordering: asma->lock -> ashmem_lru_lock,
+ *		  asma->lock -> i_mutex -> i_alloc_sem
+ *
+ * The shrinker walks the LRU under ashmem_lru_lock and may only trylock
+ * an area from there; areas that are busy are simply passed over.
+ */
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/*
+ * Ranges must have been unpinned for purge_min_age_ms before the shrinker
+ * purges them. While the shrinker cannot free what it is asked to from
+ * ranges that old, the age it requires is halved on every call, down to
+ * zero; it is restored as soon as a call is satisfied again.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static unsigned int purge_min_age_ms = 1000;
+module_param(purge_min_age_ms, uint, S_IRUGO | S_IWUSR);
+
+/* Currently required age in jiffies, protected by ashmem_lru_lock */
+static unsigned long purge_age = ~0UL;
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -102,16 +123,30 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
+/*
+ * lru_add - put a range on the LRU, which is kept sorted by unpin time.
+ * Freshly unpinned ranges go straight to the tail; only halves of split
+ * ranges are inserted further up.
+ */
 static inline void lru_add(struct ashmem_range *range)
 {
-	list_add_tail(&range->lru, &ashmem_lru_list);
+	struct ashmem_range *pos;
+
+	spin_lock(&ashmem_lru_lock);
+	list_for_each_entry_reverse(pos, &ashmem_lru_list, lru)
+		if (!time_after(pos->unpinned_at, range->unpinned_at))
+			break;
+	list_add(&range->lru, &pos->lru);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static inline void lru_del(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_del(&range->lru);
 	lru_count -= range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 /*
@@ -122,16 +157,19 @@ static inline void lru_del(struct ashmem_range *range)
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
+ * 'unpinned_at' - time of unpin, in jiffies
+ * 'gfp' - allocation flags
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int range_alloc(struct ashmem_area *asma,
 		       struct ashmem_range *prev_range, unsigned int purged,
-		       size_t start, size_t end)
+		       size_t start, size_t end, unsigned long unpinned_at,
+		       gfp_t gfp)
 {
 	struct ashmem_range *range;
 
-	range = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
+	range = kmem_cache_zalloc(ashmem_range_cachep, gfp);
 	if (unlikely(!range))
 		return -ENOMEM;
 
@@ -139,6 +177,7 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgstart = start;
 	range->pgend = end;
 	range->purged = purged;
+	range->unpinned_at = unpinned_at;
 
 	list_add_tail(&range->unpinned, &prev_range->unpinned);
 
@@ -159,7 +198,7 @@ static void range_del(struct ashmem_range *range)
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -169,8 +208,11 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -186,6 +228,7 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
+	mutex_init(&asma->lock);
 	INIT_LIST_HEAD(&asma->unpinned_list);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
@@ -199,10 +242,10 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	if (asma->file)
 		fput(asma->file);
@@ -217,7 +260,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -238,7 +281,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -247,7 +290,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -268,7 +311,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -285,7 +328,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -328,10 +371,82 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
+/*
+ * ashmem_lru_first - find the oldest range the shrinker may purge
+ *
+ * Returns the first range on the LRU that has been unpinned for at least
+ * 'min_age' jiffies and whose area could be locked, or NULL. On success
+ * the caller holds the area's lock.
+ */
+static struct ashmem_range *ashmem_lru_first(unsigned long min_age)
+{
+	struct ashmem_range *range;
+
+	spin_lock(&ashmem_lru_lock);
+	list_for_each_entry(range, &ashmem_lru_list, lru) {
+		/* the list is sorted, so everything from here is younger */
+		if (time_before(jiffies, range->unpinned_at + min_age))
+			break;
+
+		/* an area someone is working on is likely to be re-pinned */
+		if (mutex_trylock(&range->asma->lock)) {
+			spin_unlock(&ashmem_lru_lock);
+			return range;
+		}
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	return NULL;
+}
+
+/*
+ * ashmem_purge - purge up to 'nr_to_scan' pages of ranges that have been
+ * unpinned for at least 'min_age' jiffies. Returns the number of pages
+ * still to purge.
+ *
+ * A range larger than what is left to purge only loses its top pages;
+ * the rest of it stays on the LRU.
+ */
+static int ashmem_purge(int nr_to_scan, unsigned long min_age)
+{
+	struct ashmem_range *range;
+
+	while (nr_to_scan > 0 && (range = ashmem_lru_first(min_age))) {
+		struct ashmem_area *asma = range->asma;
+		struct inode *inode = asma->file->f_dentry->d_inode;
+		size_t pgstart = range->pgstart, pgend = range->pgend;
+
+		/*
+		 * Split off the top for purging. We are called from reclaim,
+		 * so the allocation must not recurse into it; if it fails,
+		 * the whole range goes.
+		 */
+		if (range_size(range) > nr_to_scan &&
+		    !range_alloc(asma, range, ASHMEM_WAS_PURGED,
+				 pgend - nr_to_scan + 1, pgend,
+				 range->unpinned_at, GFP_NOWAIT | __GFP_NOWARN)) {
+			pgstart = pgend - nr_to_scan + 1;
+			range_shrink(range, range->pgstart, pgstart - 1);
+			nr_to_scan = 0;
+		} else {
+			range->purged = ASHMEM_WAS_PURGED;
+			lru_del(range);
+			nr_to_scan -= range_size(range);
+		}
+
+		vmtruncate_range(inode, pgstart * PAGE_SIZE,
+				 (pgend + 1) * PAGE_SIZE - 1);
+
+		mutex_unlock(&asma->lock);
+	}
+
+	return nr_to_scan;
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -345,11 +460,12 @@ out:
  *
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * pages freed. Recently unpinned ranges are spared while pressure is light,
+ * see purge_min_age_ms.
  */
 static int ashmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
-	struct ashmem_range *range, *next;
+	unsigned long min_age, max_age;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (nr_to_scan && !(gfp_mask & __GFP_FS))
@@ -357,21 +473,16 @@ static int ashmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	if (!nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	max_age = msecs_to_jiffies(purge_min_age_ms);
+	spin_lock(&ashmem_lru_lock);
+	min_age = purge_age = min(purge_age, max_age);
+	spin_unlock(&ashmem_lru_lock);
 
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+	nr_to_scan = ashmem_purge(nr_to_scan, min_age);
 
-		nr_to_scan -= range_size(range);
-		if (nr_to_scan <= 0)
-			break;
-	}
-	mutex_unlock(&ashmem_mutex);
+	spin_lock(&ashmem_lru_lock);
+	purge_age = nr_to_scan > 0 ? min_age / 2 : max_age;
+	spin_unlock(&ashmem_lru_lock);
 
 	return lru_count;
 }
@@ -385,7 +496,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -400,7 +511,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -408,7 +519,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -422,7 +533,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -431,7 +542,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -448,7 +559,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -457,7 +568,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -511,7 +622,8 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 			 * second half and adjust the first chunk's endpoint.
 			 */
 			range_alloc(asma, range, range->purged,
-				    pgend + 1, range->pgend);
+				    pgend + 1, range->pgend, range->unpinned_at,
+				    GFP_KERNEL);
 			range_shrink(range, range->pgstart, pgstart - 1);
 			break;
 		}
@@ -523,7 +635,7 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -551,14 +663,15 @@ restart:
 		}
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, range, purged, pgstart, pgend, jiffies,
+			   GFP_KERNEL);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->lock.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
@@ -607,7 +720,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -621,7 +734,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -662,8 +775,8 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ASHMEM_PURGE_ALL_CACHES:
 		ret = -EPERM;
 		if (capable(CAP_SYS_ADMIN)) {
-			ret = ashmem_shrink(&ashmem_shrinker, 0, GFP_KERNEL);
-			ashmem_shrink(&ashmem_shrinker, ret, GFP_KERNEL);
+			ret = lru_count;
+			ashmem_purge(ret, 0);
 		}
 		break;
 	}
@@ -1804,6 +1804,55 @@ out:
 	}
 }
 
+/*
+ * Reclaim efficiency of global reclaim, reported to the vmpressure
+ * notifier chain once every VMPRESSURE_WIN scanned pages as a percentage:
+ * 0 when everything scanned was reclaimed, 100 when nothing was.
+ */
+#define VMPRESSURE_WIN	(SWAP_CLUSTER_MAX * 16)
+
+static DEFINE_SPINLOCK(vmpressure_lock);
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+static ATOMIC_NOTIFIER_HEAD(vmpressure_notifier);
+
+int register_vmpressure_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(register_vmpressure_notifier);
+
+int unregister_vmpressure_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_vmpressure_notifier);
+
+static void vmpressure(struct scan_control *sc, unsigned long scanned,
+		       unsigned long reclaimed)
+{
+	unsigned long pressure;
+
+	if (!scanning_global_lru(sc) || !scanned)
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	if (vmpressure_scanned < VMPRESSURE_WIN) {
+		spin_unlock(&vmpressure_lock);
+		return;
+	}
+	scanned = vmpressure_scanned;
+	reclaimed = min(vmpressure_reclaimed, scanned);
+	vmpressure_scanned = 0;
+	vmpressure_reclaimed = 0;
+	spin_unlock(&vmpressure_lock);
+
+	pressure = 100 - reclaimed * 100 / scanned;
+	atomic_notifier_call_chain(&vmpressure_notifier, pressure, NULL);
+}
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
@@ -1815,6 +1864,7 @@ static void shrink_zone(int priority, struct zone *zone,
 	enum lru_list l;
 	unsigned long nr_reclaimed = sc->nr_reclaimed;
 	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
+	unsigned long nr_scanned = sc->nr_scanned;
 
 	get_scan_count(zone, sc, nr, priority);
 
@@ -1842,6 +1892,8 @@ static void shrink_zone(int priority, struct zone *zone,
 			break;
 	}
 
+	vmpressure(sc, sc->nr_scanned - nr_scanned,
+		   nr_reclaimed - sc->nr_reclaimed);
 	sc->nr_reclaimed = nr_reclaimed;
 
 	/*
@@ -0,0 +1,509 @@
+/*
+ * binder_bench.c -- binder transaction throughput benchmark
+ *
+ * Forks a small broker that becomes the binder context manager, then N
+ * server/client process pairs.  Each server registers a local binder object
+ * with the broker; its client looks the object up and hammers it with
+ * synchronous transactions that the server echoes back.  Every client
+ * reports how many round trips it completed, and the totals are printed
+ * once all pairs are done.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/* $(CROSS_COMPILE)cc -Wall -O2 -I../../drivers/staging/android -o binder_bench binder_bench.c -lrt */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define BINDER_DEV		"/dev/binder"
+#define BINDER_MAP_SIZE		(128 * 1024)
+#define MAX_PAYLOAD		4096
+
+/* transaction codes understood by the broker and the servers */
+enum {
+	BENCH_ADD = 1,		/* broker: register the object at offset 0 */
+	BENCH_GET,		/* broker: look up the object for a pair */
+	BENCH_ECHO,		/* server: reply with the same payload */
+	BENCH_QUIT,		/* server: one-way, exit the loop */
+};
+
+struct bctx {
+	int	fd;
+	void	*map;
+};
+
+struct bench_result {
+	unsigned long	count;
+	double		secs;
+};
+
+static int pairs = 1;
+static int seconds = 5;
+static size_t payload = 16;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bctx_open(struct bctx *b)
+{
+	struct binder_version vers;
+
+	b->fd = open(BINDER_DEV, O_RDWR);
+	if (b->fd < 0)
+		die("open " BINDER_DEV);
+	if (ioctl(b->fd, BINDER_VERSION, &vers) < 0)
+		die("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol %ld, expected %d\n",
+			vers.protocol_version, BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	b->map = mmap(NULL, BINDER_MAP_SIZE, PROT_READ, MAP_PRIVATE, b->fd, 0);
+	if (b->map == MAP_FAILED)
+		die("mmap");
+}
+
+/* one BINDER_WRITE_READ: write @wlen bytes, then read up to @rlen bytes */
+static size_t bctx_io(struct bctx *b, void *wbuf, size_t wlen,
+		      void *rbuf, size_t rlen)
+{
+	struct binder_write_read bwr;
+
+	bwr.write_size = wlen;
+	bwr.write_consumed = 0;
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.read_size = rlen;
+	bwr.read_consumed = 0;
+	bwr.read_buffer = (unsigned long)rbuf;
+
+	while (ioctl(b->fd, BINDER_WRITE_READ, &bwr) < 0) {
+		if (errno != EINTR)
+			die("BINDER_WRITE_READ");
+		/* only retry the part that did not make it */
+		bwr.write_size -= bwr.write_consumed;
+		bwr.write_buffer += bwr.write_consumed;
+		bwr.write_consumed = 0;
+	}
+	return bwr.read_consumed;
+}
+
+static void bctx_write(struct bctx *b, void *wbuf, size_t wlen)
+{
+	bctx_io(b, wbuf, wlen, NULL, 0);
+}
+
+static void bctx_cmd(struct bctx *b, uint32_t cmd, uint32_t arg)
+{
+	uint32_t buf[2] = { cmd, arg };
+
+	bctx_write(b, buf, sizeof(buf));
+}
+
+/*
+ * Read until a transaction, reply or failure shows up, acknowledging any
+ * node reference requests on the way.  Returns the BR_ code that ended the
+ * read and copies the transaction data into @txn.
+ */
+static uint32_t bctx_wait(struct bctx *b, struct binder_transaction_data *txn)
+{
+	uint32_t rbuf[64];
+
+	for (;;) {
+		size_t len = bctx_io(b, NULL, 0, rbuf, sizeof(rbuf));
+		char *ptr = (char *)rbuf;
+		char *end = ptr + len;
+
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+			struct binder_ptr_cookie *pc;
+
+			ptr += sizeof(uint32_t);
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_OK:
+			case BR_SPAWN_LOOPER:
+			case BR_TRANSACTION_COMPLETE:
+				break;
+			case BR_INCREFS:
+			case BR_ACQUIRE: {
+				struct {
+					uint32_t cmd;
+					struct binder_ptr_cookie pc;
+				} __attribute__((packed)) done;
+
+				pc = (struct binder_ptr_cookie *)ptr;
+				done.cmd = cmd == BR_INCREFS ?
+					BC_INCREFS_DONE : BC_ACQUIRE_DONE;
+				done.pc = *pc;
+				bctx_write(b, &done, sizeof(done));
+				ptr += sizeof(*pc);
+				break;
+			}
+			case BR_RELEASE:
+			case BR_DECREFS:
+				ptr += sizeof(struct binder_ptr_cookie);
+				break;
+			case BR_ERROR:
+				ptr += sizeof(uint32_t);
+				break;
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				memcpy(txn, ptr, sizeof(*txn));
+				return cmd;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				return cmd;
+			default:
+				fprintf(stderr, "unexpected binder command %#x\n",
+					cmd);
+				exit(1);
+			}
+		}
+	}
+}
+
+struct bc_txn {
+	uint32_t				cmd;
+	struct binder_transaction_data		txn;
+} __attribute__((packed));
+
+struct bc_free {
+	uint32_t	cmd;
+	const void	*buffer;
+} __attribute__((packed));
+
+static struct binder_transaction_data make_txn(uint32_t handle, uint32_t code,
+		uint32_t flags, const void *data, size_t size,
+		const void *offs, size_t offs_size)
+{
+	struct binder_transaction_data txn;
+
+	memset(&txn, 0, sizeof(txn));
+	txn.target.handle = handle;
+	txn.code = code;
+	txn.flags = flags;
+	txn.data_size = size;
+	txn.offsets_size = offs_size;
+	txn.data.ptr.buffer = data;
+	txn.data.ptr.offsets = offs;
+	return txn;
+}
+
+/* send a reply and release the buffer it answers in a single write */
+static void bctx_reply(struct bctx *b, const void *req, const void *data,
+		       size_t size, const void *offs, size_t offs_size)
+{
+	struct {
+		struct bc_txn	reply;
+		struct bc_free	free;
+	} __attribute__((packed)) w;
+
+	w.reply.cmd = BC_REPLY;
+	w.reply.txn = make_txn(0, 0, 0, data, size, offs, offs_size);
+	w.free.cmd = BC_FREE_BUFFER;
+	w.free.buffer = req;
+	bctx_write(b, &w, sizeof(w));
+}
+
+static void bctx_free(struct bctx *b, const void *buffer)
+{
+	struct bc_free w = { BC_FREE_BUFFER, buffer };
+
+	bctx_write(b, &w, sizeof(w));
+}
+
+/* synchronous call; the caller frees reply->data.ptr.buffer */
+static uint32_t bctx_call(struct bctx *b, uint32_t handle, uint32_t code,
+			  const void *data, size_t size, const void *offs,
+			  size_t offs_size, struct binder_transaction_data *reply)
+{
+	struct bc_txn w;
+	uint32_t ret;
+
+	w.cmd = BC_TRANSACTION;
+	w.txn = make_txn(handle, code, 0, data, size, offs, offs_size);
+	bctx_write(b, &w, sizeof(w));
+
+	ret = bctx_wait(b, reply);
+	if (ret == BR_TRANSACTION) {
+		fprintf(stderr, "nested transaction not supported\n");
+		exit(1);
+	}
+	return ret;
+}
+
+static void broker(int ready_fd)
+{
+	struct binder_transaction_data txn;
+	struct flat_binder_object obj;
+	uint32_t *handles;
+	size_t off = 0;
+	struct bctx b;
+	int32_t status;
+	uint32_t idx;
+
+	handles = calloc(pairs, sizeof(*handles));
+	if (!handles)
+		die("calloc");
+
+	bctx_open(&b);
+	if (ioctl(b.fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+		die("BINDER_SET_CONTEXT_MGR");
+	bctx_cmd(&b, BC_ENTER_LOOPER, 0);
+	if (write(ready_fd, "", 1) != 1)
+		die("write");
+	close(ready_fd);
+
+	for (;;) {
+		if (bctx_wait(&b, &txn) != BR_TRANSACTION)
+			continue;
+
+		idx = *(const uint32_t *)txn.data.ptr.buffer;
+		if (idx >= (uint32_t)pairs) {
+			status = -1;
+			bctx_reply(&b, txn.data.ptr.buffer, &status,
+				   sizeof(status), NULL, 0);
+			continue;
+		}
+
+		switch (txn.code) {
+		case BENCH_ADD:
+			memcpy(&obj, (const char *)txn.data.ptr.buffer +
+			       *(const size_t *)txn.data.ptr.offsets,
+			       sizeof(obj));
+			/* keep the server's node alive past this buffer */
+			bctx_cmd(&b, BC_ACQUIRE, obj.handle);
+			handles[idx] = obj.handle;
+			status = 0;
+			bctx_reply(&b, txn.data.ptr.buffer, &status,
+				   sizeof(status), NULL, 0);
+			break;
+		case BENCH_GET:
+			if (!handles[idx]) {
+				status = -1;
+				bctx_reply(&b, txn.data.ptr.buffer, &status,
+					   sizeof(status), NULL, 0);
+				break;
+			}
+			memset(&obj, 0, sizeof(obj));
+			obj.type = BINDER_TYPE_HANDLE;
+			obj.handle = handles[idx];
+			bctx_reply(&b, txn.data.ptr.buffer, &obj, sizeof(obj),
+				   &off, sizeof(off));
+			break;
+		default:
+			bctx_free(&b, txn.data.ptr.buffer);
+			break;
+		}
+	}
+}
+
+static void server(uint32_t idx)
+{
+	struct binder_transaction_data txn;
+	struct {
+		uint32_t			idx;
+		struct flat_binder_object	obj;
+	} __attribute__((packed)) add;
+	size_t off = sizeof(uint32_t);
+	struct bctx b;
+
+	bctx_open(&b);
+
+	memset(&add, 0, sizeof(add));
+	add.idx = idx;
+	add.obj.type = BINDER_TYPE_BINDER;
+	add.obj.flags = 0x7f;
+	add.obj.binder = (void *)(unsigned long)(idx + 1);
+	add.obj.cookie = NULL;
+	if (bctx_call(&b, 0, BENCH_ADD, &add, sizeof(add), &off, sizeof(off),
+		      &txn) != BR_REPLY || *(const int32_t *)txn.data.ptr.buffer) {
+		fprintf(stderr, "server %u: registration failed\n", idx);
+		exit(1);
+	}
+	bctx_free(&b, txn.data.ptr.buffer);
+
+	bctx_cmd(&b, BC_ENTER_LOOPER, 0);
+	for (;;) {
+		if (bctx_wait(&b, &txn) != BR_TRANSACTION)
+			continue;
+		if (txn.code == BENCH_QUIT) {
+			bctx_free(&b, txn.data.ptr.buffer);
+			break;
+		}
+		bctx_reply(&b, txn.data.ptr.buffer, txn.data.ptr.buffer,
+			   txn.data_size, NULL, 0);
+	}
+	exit(0);
+}
+
+static void client(uint32_t idx, int result_fd)
+{
+	struct binder_transaction_data reply;
+	const struct flat_binder_object *obj;
+	struct bench_result res;
+	struct bc_txn quit;
+	char buf[MAX_PAYLOAD];
+	uint32_t handle;
+	double start, end;
+	struct bctx b;
+
+	bctx_open(&b);
+
+	for (;;) {
+		if (bctx_call(&b, 0, BENCH_GET, &idx, sizeof(idx), NULL, 0,
+			      &reply) != BR_REPLY) {
+			fprintf(stderr, "client %u: lookup failed\n", idx);
+			exit(1);
+		}
+		if (reply.offsets_size)
+			break;
+		/* server not registered yet */
+		bctx_free(&b, reply.data.ptr.buffer);
+		usleep(10000);
+	}
+	obj = (const struct flat_binder_object *)reply.data.ptr.buffer;
+	handle = obj->handle;
+	bctx_cmd(&b, BC_ACQUIRE, handle);
+	bctx_free(&b, reply.data.ptr.buffer);
+
+	memset(buf, idx, payload);
+	res.count = 0;
+	start = now();
+	end = start + seconds;
+	do {
+		if (bctx_call(&b, handle, BENCH_ECHO, buf, payload, NULL, 0,
+			      &reply) != BR_REPLY) {
+			fprintf(stderr, "client %u: transaction failed\n", idx);
+			exit(1);
+		}
+		bctx_free(&b, reply.data.ptr.buffer);
+		res.count++;
+	} while ((res.count & 63) || now() < end);
+	res.secs = now() - start;
+
+	quit.cmd = BC_TRANSACTION;
+	quit.txn = make_txn(handle, BENCH_QUIT, TF_ONE_WAY, &idx, sizeof(idx),
+			    NULL, 0);
+	bctx_write(&b, &quit, sizeof(quit));
+
+	if (write(result_fd, &res, sizeof(res)) != sizeof(res))
+		die("write");
+	exit(0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-p pairs] [-t seconds] [-s payload]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_result res;
+	double total = 0;
+	int ready[2], results[2];
+	pid_t broker_pid;
+	char c;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "p:t:s:")) != -1) {
+		switch (opt) {
+		case 'p':
+			pairs = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 's':
+			payload = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (pairs < 1 || seconds < 1 || payload > MAX_PAYLOAD)
+		usage(argv[0]);
+
+	if (pipe(ready) < 0 || pipe(results) < 0)
+		die("pipe");
+
+	broker_pid = fork();
+	if (broker_pid < 0)
+		die("fork");
+	if (!broker_pid) {
+		close(ready[0]);
+		broker(ready[1]);
+	}
+	close(ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "broker failed to start\n");
+		return 1;
+	}
+
+	for (i = 0; i < pairs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			die("fork");
+		if (!pid)
+			server(i);
+
+		pid = fork();
+		if (pid < 0)
+			die("fork");
+		if (!pid)
+			client(i, results[1]);
+	}
+	close(results[1]);
+
+	for (i = 0; i < pairs; i++) {
+		if (read(results[0], &res, sizeof(res)) != sizeof(res)) {
+			fprintf(stderr, "lost results from %d pairs\n",
+				pairs - i);
+			break;
+		}
+		total += res.count / res.secs;
+	}
+
+	kill(broker_pid, SIGTERM);
+	while (wait(NULL) > 0)
+		;
+
+	printf("%d pairs, %zu byte payload: %.0f transactions/sec "
+	       "(%.0f per pair)\n", pairs, payload, total, total / pairs);
+	return 0;
+}